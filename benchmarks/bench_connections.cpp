@@ -0,0 +1,226 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Holds N secondary connections open against a primary instance and reports
+// the memory the primary spends per connection, the cost of dispatching one
+// message from every connection and the time until a broadcast reached every
+// connection. The secondaries are plain sockets of this process speaking the
+// protocol, so only the primary's side of each connection is in the resident
+// set.
+// Usage: bench_connections [N] [I/O threads], by default 5000 0
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+
+#include "singleapplication.h"
+#include "singleapplication_p.h"
+#include "message_coder.h"
+
+namespace {
+    // Resident set size of this process in KiB
+    qint64 residentSize()
+    {
+        QFile statm( QStringLiteral( "/proc/self/statm" ));
+        if( ! statm.open( QIODevice::ReadOnly )) return -1;
+        return statm.readAll().split( ' ' ).value( 1 ).toLongLong() * ::sysconf( _SC_PAGESIZE ) / 1024;
+    }
+
+    // Every connection needs a descriptor on both ends
+    int raiseDescriptorLimit( int count )
+    {
+        struct rlimit limit;
+        if( ::getrlimit( RLIMIT_NOFILE, &limit ) != 0 ) return count;
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit( RLIMIT_NOFILE, &limit );
+        ::getrlimit( RLIMIT_NOFILE, &limit );
+        const rlim_t spare = 64;
+        if( limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur >= 2 * static_cast<rlim_t>( count ) + spare )
+            return count;
+        return limit.rlim_cur > spare ? static_cast<int>(( limit.rlim_cur - spare ) / 2 ) : 0;
+    }
+
+    // Bytes waiting on a secondary's socket, which are discarded
+    qint64 drain( int descriptor )
+    {
+        char buffer[64 * 1024];
+        qint64 total = 0;
+        ssize_t count;
+        while(( count = ::recv( descriptor, buffer, sizeof( buffer ), 0 )) > 0 )
+            total += count;
+        return total;
+    }
+
+    bool sendAll( int descriptor, const QByteArray &data )
+    {
+        return ::send( descriptor, data.constData(), static_cast<size_t>( data.size() ), MSG_NOSIGNAL ) == data.size();
+    }
+
+    QByteArray frame( SingleApplication::MessageType type, const QByteArray &content )
+    {
+        QByteArray data;
+        FrameCodec::appendFrame( data, FrameCodec::Header{ 1, type, 0, 0, 0, content.size() }, content.constData() );
+        return data;
+    }
+
+    void waitFor( const std::function<bool()> &done, int timeout )
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while( ! done() && timer.elapsed() < timeout )
+            QCoreApplication::processEvents( QEventLoop::AllEvents, 10 );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication::setApplicationName( QStringLiteral( "bench_connections-%1" ).arg( ::getpid() ));
+    SingleApplication app( argc, argv );
+
+    const int requested = qMax( app.arguments().value( 1, QStringLiteral( "5000" )).toInt(), 1 );
+    app.setIoThreadCount( app.arguments().value( 2 ).toInt() );
+    const int count = raiseDescriptorLimit( requested );
+    if( count < requested )
+        std::fprintf( stderr, "The descriptor limit only allows %d connections\n", count );
+
+    // Addressed the same way QLocalSocket addresses a server name
+    const QString serverName = SingleApplicationPrivate::blockServerNameFor( SingleApplication::Mode::User, QStringList(), app.applicationName(),
+                                                                              app.applicationFilePath(), SingleApplicationPrivate::getUsername() );
+    const QByteArray path = QFile::encodeName( QDir::tempPath() + QLatin1Char( '/' ) + serverName );
+    struct sockaddr_un address;
+    std::memset( &address, 0, sizeof( address ));
+    address.sun_family = AF_UNIX;
+    std::memcpy( address.sun_path, path.constData(), qMin( static_cast<size_t>( path.size() ), sizeof( address.sun_path ) - 1 ));
+
+    const QByteArray handshake = frame( SingleApplication::MessageType::NewInstance, MessageCoder::handshake() );
+    const QByteArray message = frame( SingleApplication::MessageType::InstanceMessage, QByteArray( 64, 'm' ));
+    int received = 0;
+    QObject::connect( &app, &SingleApplication::receivedMessage, &app, [&received](){ ++received; });
+
+    // Lets the primary settle before the baseline is taken
+    QCoreApplication::processEvents( QEventLoop::AllEvents, 100 );
+    const qint64 before = residentSize();
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<int> descriptors;
+    descriptors.reserve( static_cast<size_t>( count ));
+    while( static_cast<int>( descriptors.size() ) < count && timer.elapsed() < 60000 ){
+        const int descriptor = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0 );
+        if( descriptor == -1 ){
+            std::perror( "socket" );
+            break;
+        }
+
+        // Refused with EAGAIN while the backlog is full, until the primary accepted
+        if( ::connect( descriptor, reinterpret_cast<struct sockaddr*>( &address ), sizeof( address )) == -1 ){
+            const int error = errno;
+            ::close( descriptor );
+            if( error != EAGAIN ){
+                std::fprintf( stderr, "connect: %s\n", std::strerror( error ));
+                break;
+            }
+            QCoreApplication::processEvents();
+            continue;
+        }
+
+        if( ! sendAll( descriptor, handshake )){
+            ::close( descriptor );
+            break;
+        }
+        descriptors.push_back( descriptor );
+        if( descriptors.size() % 64 == 0 )
+            QCoreApplication::processEvents();
+    }
+
+    const int connected = static_cast<int>( descriptors.size() );
+    waitFor( [&app, connected](){ return app.instances().size() > connected; }, 60000 );
+    const qint64 registered = app.instances().size() - 1;
+    const double connectTime = timer.elapsed();
+    const qint64 after = residentSize();
+
+    // One message from every connection per round
+    const int rounds = 10;
+    std::vector<double> dispatch;
+    for( int round = 0; round < rounds && registered == connected; ++round ){
+        const int expected = received + connected;
+        timer.restart();
+        for( int descriptor : descriptors )
+            sendAll( descriptor, message );
+        waitFor( [&received, expected](){ return received >= expected; }, 60000 );
+        if( received < expected ) break;
+        dispatch.push_back( timer.nsecsElapsed() / 1000.0 / connected );
+    }
+    std::sort( dispatch.begin(), dispatch.end() );
+    const qint64 loaded = residentSize();
+
+    // Acknowledgements still on their way are discarded before broadcasting
+    QCoreApplication::processEvents( QEventLoop::AllEvents, 100 );
+    for( int descriptor : descriptors )
+        drain( descriptor );
+
+    // One frame written to every connection per round
+    const QByteArray push( 4 * 1024, 'p' );
+    const qint64 pushSize = FrameCodec::frameSize( FrameCodec::Header{ FrameCodec::ProtocolVersion, SingleApplication::MessageType::InstanceMessage, 0, 0, 0, push.size() });
+    std::vector<double> fanOut;
+    for( int round = 0; round < rounds && registered == connected; ++round ){
+        timer.restart();
+        if( app.broadcast( push ) != connected ) break;
+        qint64 arrived = 0;
+        waitFor( [&descriptors, &arrived, pushSize, connected](){
+            for( int descriptor : descriptors )
+                arrived += drain( descriptor );
+            return arrived >= pushSize * connected;
+        }, 60000 );
+        if( arrived < pushSize * connected ) break;
+        fanOut.push_back( timer.nsecsElapsed() / 1000000.0 );
+    }
+    std::sort( fanOut.begin(), fanOut.end() );
+
+    std::printf( "%11s %10s %12s %14s %14s %20s %20s\n", "connections", "registered", "connect ms", "KiB/conn idle", "KiB/conn used",
+                 "dispatch p50/max us", "fan-out p50/max ms" );
+    std::printf( "%11d %10lld %12.0f %14.2f %14.2f %9.2f %10.2f %9.2f %10.2f\n", connected, registered, connectTime,
+                 connected ? double( after - before ) / connected : 0.0,
+                 connected ? double( loaded - before ) / connected : 0.0,
+                 dispatch.empty() ? 0.0 : dispatch[dispatch.size() / 2],
+                 dispatch.empty() ? 0.0 : dispatch.back(),
+                 fanOut.empty() ? 0.0 : fanOut[fanOut.size() / 2],
+                 fanOut.empty() ? 0.0 : fanOut.back() );
+
+    for( int descriptor : descriptors )
+        ::close( descriptor );
+    return registered == connected && static_cast<int>( dispatch.size() ) == rounds && static_cast<int>( fanOut.size() ) == rounds ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cstring>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QIODevice>
+#include <QtTest/QtTest>
+
+#include "frame_codec.h"
+
+namespace {
+    // Sequential device that makes its data available a part at a time, like
+    // a socket receiving a stream
+    class TrickleDevice : public QIODevice {
+    public:
+        explicit TrickleDevice( const QByteArray &data )
+            : data( data ), position( 0 ), available( 0 )
+        {
+            open( QIODevice::ReadOnly );
+        }
+
+        bool isSequential() const override { return true; }
+
+        qint64 bytesAvailable() const override
+        {
+            return available - position + QIODevice::bytesAvailable();
+        }
+
+        void reveal( qint64 bytes )
+        {
+            available = qMin<qint64>( available + bytes, data.size() );
+        }
+
+        void rewind()
+        {
+            position = 0;
+            available = 0;
+        }
+
+    protected:
+        qint64 readData( char *out, qint64 maxSize ) override
+        {
+            const qint64 length = qMin( maxSize, available - position );
+            memcpy( out, data.constData() + position, static_cast<size_t>( length ));
+            position += length;
+            return length;
+        }
+
+        qint64 writeData( const char *, qint64 ) override
+        {
+            return -1;
+        }
+
+    private:
+        QByteArray data;
+        qint64 position;
+        qint64 available;
+    };
+}
+
+class BenchDecoder : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void readFrame_data()
+    {
+        QTest::addColumn<int>( "length" );
+        QTest::addColumn<int>( "fragments" );
+
+        const QList<int> lengths{ 0, 64, 1024, 16 * 1024, 256 * 1024, static_cast<int>( FrameCodec::MaxContentLength ) };
+        for( int length : lengths ){
+            QTest::addRow( "%d B whole", length ) << length << 1;
+            QTest::addRow( "%d B in 4 fragments", length ) << length << 4;
+        }
+    }
+
+    // Decodes a stream of at least 1 MiB of frames of the same length
+    void readFrame()
+    {
+        QFETCH( int, length );
+        QFETCH( int, fragments );
+
+        const QByteArray content( length, 'x' );
+        QByteArray frame;
+        FrameCodec::appendFrame( frame, FrameCodec::Header{ FrameCodec::ProtocolVersion, SingleApplication::MessageType::InstanceMessage, 0, 0, 1, length }, content.constData() );
+        const int count = qMax( 1, static_cast<int>( FrameCodec::MaxContentLength / frame.size() ));
+        TrickleDevice device( frame.repeated( count ));
+        const qint64 fragment = qMax<qint64>( 1, ( frame.size() + fragments - 1 ) / fragments );
+
+        FrameCodec::Header header;
+        QByteArray received;
+        qint64 frames = 0;
+        qint64 iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            device.rewind();
+            for( int i = 0; i < count; ++i ){
+                for( int part = 0; part < fragments; ++part ){
+                    device.reveal( fragment );
+                    while( FrameCodec::readFrame( &device, header, received ) == FrameCodec::Result::Complete )
+                        ++frames;
+                }
+            }
+            ++iterations;
+        }
+        const qint64 elapsed = qMax<qint64>( 1, timer.nsecsElapsed() );
+
+        QCOMPARE( frames, iterations * count );
+        qInfo( "%.0f frames/s, %.1f MB/s", frames * 1e9 / elapsed, frames * double( frame.size() ) * 1e3 / elapsed );
+    }
+
+    void appendFrame_data()
+    {
+        QTest::addColumn<int>( "length" );
+
+        const QList<int> lengths{ 0, 64, 1024, 16 * 1024, 256 * 1024, static_cast<int>( FrameCodec::MaxContentLength ) };
+        for( int length : lengths )
+            QTest::addRow( "%d B", length ) << length;
+    }
+
+    // Encodes at least 1 MiB of frames of the same length into one buffer,
+    // the way batches are written
+    void appendFrame()
+    {
+        QFETCH( int, length );
+
+        const QByteArray content( length, 'x' );
+        const FrameCodec::Header header{ FrameCodec::ProtocolVersion, SingleApplication::MessageType::InstanceMessage, 0, 0, 1, length };
+        const qint64 size = FrameCodec::frameSize( header );
+        const int count = qMax( 1, static_cast<int>( FrameCodec::MaxContentLength / size ));
+
+        // The capacity is kept across iterations, so only encoding is measured
+        QByteArray buffer;
+        buffer.reserve( static_cast<int>( size * count ));
+        qint64 frames = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            buffer.resize( 0 );
+            for( int i = 0; i < count; ++i )
+                FrameCodec::appendFrame( buffer, header, content.constData() );
+            frames += count;
+        }
+        const qint64 elapsed = qMax<qint64>( 1, timer.nsecsElapsed() );
+
+        QCOMPARE( buffer.size(), static_cast<int>( size * count ));
+        qInfo( "%.0f frames/s, %.1f MB/s", frames * 1e9 / elapsed, frames * double( size ) * 1e3 / elapsed );
+    }
+};
+
+QTEST_GUILESS_MAIN( BenchDecoder )
+#include "bench_decoder.moc"
@@ -0,0 +1,209 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Launches N instances of the basic example at once and reports how long
+// they took to decide whether they are the primary instance, how long the
+// secondary instances waited for the primary to acknowledge them, and how
+// many of them failed or ran into the initialization timeout.
+// Usage: bench_launchstorm [N...], by default 1 10 50 100 200 500
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QThread>
+
+namespace {
+    struct Instance {
+        pid_t pid;
+        int status;
+        bool running;
+        QByteArray log;
+    };
+
+    struct Result {
+        std::vector<double> decisions; // ms from the launch
+        std::vector<double> acknowledgements; // ms from the launch
+        int primaries = 0;
+        int failures = 0;
+        int timeouts = 0;
+    };
+
+    double percentile( std::vector<double> values, double fraction )
+    {
+        if( values.empty() ) return 0;
+        std::sort( values.begin(), values.end() );
+        const size_t index = static_cast<size_t>( fraction * ( values.size() - 1 ) + 0.5 );
+        return values[index];
+    }
+
+    QJsonArray readTrace( const QString &path )
+    {
+        QFile file( path );
+        if( ! file.open( QIODevice::ReadOnly )) return QJsonArray();
+        return QJsonDocument::fromJson( file.readAll() ).object().value( QStringLiteral( "traceEvents" )).toArray();
+    }
+
+    // Whether the startup trace an instance wrote names it the primary
+    bool isPrimary( const QJsonArray &events )
+    {
+        for( const QJsonValue &value : events ){
+            const QJsonObject event = value.toObject();
+            if( event.value( QStringLiteral( "name" )).toString() == QLatin1String( "process_name" ))
+                return event.value( QStringLiteral( "args" )).toObject().value( QStringLiteral( "name" )).toString().endsWith( QLatin1String( "(primary)" ));
+        }
+        return false;
+    }
+
+    // Records when an instance decided and was acknowledged, in ms from the launch
+    void recordPhases( const QJsonArray &events, qint64 launched, Result &result )
+    {
+        double decided = -1;
+        double acknowledged = -1;
+        for( const QJsonValue &value : events ){
+            const QJsonObject event = value.toObject();
+            const QString name = event.value( QStringLiteral( "name" )).toString();
+            // Trace events count in microseconds since the epoch
+            const double end = ( event.value( QStringLiteral( "ts" )).toDouble() + event.value( QStringLiteral( "dur" )).toDouble() ) / 1000 - launched;
+            if( name == QLatin1String( "startPrimary" ) || name == QLatin1String( "connectToPrimary" ))
+                decided = end;
+            else if( name == QLatin1String( "notifySecondaryStart" ))
+                acknowledged = end;
+        }
+
+        if( decided >= 0 ) result.decisions.push_back( decided );
+        if( acknowledged >= 0 ) result.acknowledgements.push_back( acknowledged );
+    }
+
+    Result launch( const QByteArray &program, int count )
+    {
+        Result result;
+        QTemporaryDir directory;
+        qputenv( "SINGLEAPPLICATION_TRACE", QFile::encodeName( directory.filePath( QStringLiteral( "%p.json" ))));
+
+        std::vector<Instance> instances( static_cast<size_t>( count ));
+        for( int i = 0; i < count; ++i )
+            instances[i].log = QFile::encodeName( directory.filePath( QStringLiteral( "%1.log" ).arg( i )));
+
+        const qint64 launched = QDateTime::currentMSecsSinceEpoch();
+        for( Instance &instance : instances ){
+            instance.running = true;
+            instance.pid = ::fork();
+            if( instance.pid == 0 ){
+                const int log = ::open( instance.log.constData(), O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+                ::dup2( log, STDOUT_FILENO );
+                ::dup2( log, STDERR_FILENO );
+                char *const arguments[] = { const_cast<char*>( program.constData() ), nullptr };
+                ::execv( program.constData(), arguments );
+                ::_exit( 127 );
+            }
+            if( instance.pid == -1 ){
+                instance.running = false;
+                ++result.failures;
+            }
+        }
+
+        // Every instance but the primary exits once it is done
+        const auto tracePath = [&directory]( const Instance &instance ){
+            return directory.filePath( QStringLiteral( "%1.json" ).arg( instance.pid ));
+        };
+        QElapsedTimer timer;
+        timer.start();
+        int running = static_cast<int>( std::count_if( instances.begin(), instances.end(), []( const Instance &instance ){ return instance.running; }));
+        while( running > 0 && timer.elapsed() < 30000 ){
+            for( Instance &instance : instances ){
+                if( instance.running && ::waitpid( instance.pid, &instance.status, WNOHANG ) == instance.pid ){
+                    instance.running = false;
+                    --running;
+                }
+            }
+            if( running == 1 ){
+                const auto last = std::find_if( instances.begin(), instances.end(), []( const Instance &instance ){ return instance.running; });
+                if( isPrimary( readTrace( tracePath( *last ))))
+                    break;
+            }
+            QThread::msleep( 1 );
+        }
+
+        for( Instance &instance : instances ){
+            const QJsonArray events = readTrace( tracePath( instance ));
+            recordPhases( events, launched, result );
+            if( instance.running ){
+                ::kill( instance.pid, SIGKILL );
+                ::waitpid( instance.pid, &instance.status, 0 );
+                if( isPrimary( events ))
+                    ++result.primaries;
+                else
+                    ++result.failures; // Hung
+                continue;
+            }
+
+            if( WIFEXITED( instance.status ) && WEXITSTATUS( instance.status ) == 0 )
+                continue;
+
+            QFile log( QFile::decodeName( instance.log ));
+            if( log.open( QIODevice::ReadOnly ) && log.readAll().contains( "Did not manage to initialize" ))
+                ++result.timeouts;
+            else
+                ++result.failures;
+        }
+
+        return result;
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication app( argc, argv );
+
+    QList<int> counts;
+    for( const QString &argument : app.arguments().mid( 1 ))
+        counts.append( argument.toInt() );
+    if( counts.isEmpty() )
+        counts = { 1, 10, 50, 100, 200, 500 };
+
+    std::printf( "%5s %28s %28s %9s %8s %8s\n", "N", "decision p50/p99/max ms", "ack p50/p99/max ms", "primaries", "failures", "timeouts" );
+    for( int count : counts ){
+        const Result result = launch( QByteArrayLiteral( LAUNCHSTORM_INSTANCE ), count );
+        std::printf( "%5d %10.1f %8.1f %8.1f %10.1f %8.1f %8.1f %9d %8d %8d\n", count,
+                     percentile( result.decisions, 0.5 ), percentile( result.decisions, 0.99 ), percentile( result.decisions, 1 ),
+                     percentile( result.acknowledgements, 0.5 ), percentile( result.acknowledgements, 0.99 ), percentile( result.acknowledgements, 1 ),
+                     result.primaries, result.failures, result.timeouts );
+        std::fflush( stdout );
+    }
+
+    return 0;
+}
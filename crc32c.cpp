@@ -0,0 +1,160 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cstring>
+
+#include <QtCore/QtEndian>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define CRC32C_SSE42 1
+    #include <cpuid.h>
+    #include <nmmintrin.h>
+    #define CRC32C_SSE42_TARGET __attribute__((target("sse4.2")))
+#elif defined(_M_X64) && defined(_MSC_VER)
+    #define CRC32C_SSE42 1
+    #include <intrin.h>
+    #include <nmmintrin.h>
+    #define CRC32C_SSE42_TARGET
+#elif defined(__ARM_FEATURE_CRC32)
+    #define CRC32C_ARMV8 1
+    #include <arm_acle.h>
+#endif
+
+namespace {
+    // Reflected Castagnoli polynomial
+    constexpr quint32 Polynomial = 0x82F63B78;
+
+    struct SlicingTables {
+        quint32 table[8][256];
+
+        SlicingTables()
+        {
+            for( quint32 i = 0; i < 256; ++i ){
+                quint32 crc = i;
+                for( int bit = 0; bit < 8; ++bit )
+                    crc = ( crc >> 1 ) ^ ( Polynomial & ( 0u - ( crc & 1 )));
+                table[0][i] = crc;
+            }
+            for( quint32 i = 0; i < 256; ++i )
+                for( int slice = 1; slice < 8; ++slice )
+                    table[slice][i] = ( table[slice - 1][i] >> 8 ) ^ table[0][table[slice - 1][i] & 0xFF];
+        }
+    };
+
+    quint32 crc32cSlicingBy8( quint32 crc, const uchar *data, qint64 length )
+    {
+        static const SlicingTables tables;
+        const auto &t = tables.table;
+
+        while( length >= 8 ){
+            const quint32 low = qFromLittleEndian<quint32>( data ) ^ crc;
+            const quint32 high = qFromLittleEndian<quint32>( data + 4 );
+            crc = t[7][low & 0xFF] ^ t[6][( low >> 8 ) & 0xFF] ^
+                  t[5][( low >> 16 ) & 0xFF] ^ t[4][low >> 24] ^
+                  t[3][high & 0xFF] ^ t[2][( high >> 8 ) & 0xFF] ^
+                  t[1][( high >> 16 ) & 0xFF] ^ t[0][high >> 24];
+            data += 8;
+            length -= 8;
+        }
+        while( length-- > 0 )
+            crc = t[0][( crc ^ *data++ ) & 0xFF] ^ ( crc >> 8 );
+
+        return crc;
+    }
+
+#ifdef CRC32C_SSE42
+    CRC32C_SSE42_TARGET quint32 crc32cSse42( quint32 crc, const uchar *data, qint64 length )
+    {
+        quint64 crc64 = crc;
+        while( length >= 8 ){
+            quint64 word;
+            memcpy( &word, data, sizeof( word ));
+            crc64 = _mm_crc32_u64( crc64, word );
+            data += 8;
+            length -= 8;
+        }
+        crc = static_cast<quint32>( crc64 );
+        while( length-- > 0 )
+            crc = _mm_crc32_u8( crc, *data++ );
+
+        return crc;
+    }
+
+    bool cpuHasSse42()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid( info, 1 );
+        return ( info[2] & ( 1 << 20 )) != 0;
+#else
+        unsigned int eax, ebx, ecx, edx;
+        if( ! __get_cpuid( 1, &eax, &ebx, &ecx, &edx ))
+            return false;
+        return ( ecx & bit_SSE4_2 ) != 0;
+#endif
+    }
+#endif
+
+#ifdef CRC32C_ARMV8
+    quint32 crc32cArmv8( quint32 crc, const uchar *data, qint64 length )
+    {
+        while( length >= 8 ){
+            quint64 word;
+            memcpy( &word, data, sizeof( word ));
+            crc = __crc32cd( crc, word );
+            data += 8;
+            length -= 8;
+        }
+        while( length-- > 0 )
+            crc = __crc32cb( crc, *data++ );
+
+        return crc;
+    }
+#endif
+
+    using Crc32cFunction = quint32 (*)( quint32, const uchar *, qint64 );
+
+    Crc32cFunction selectImplementation()
+    {
+#if defined(CRC32C_SSE42)
+        if( cpuHasSse42() )
+            return crc32cSse42;
+#elif defined(CRC32C_ARMV8)
+        return crc32cArmv8;
+#endif
+        return crc32cSlicingBy8;
+    }
+}
+
+quint32 crc32c( const void *data, qint64 length, quint32 crc )
+{
+    static const Crc32cFunction implementation = selectImplementation();
+    return ~implementation( ~crc, static_cast<const uchar *>( data ), length );
+}
+
+quint32 crc32cPortable( const void *data, qint64 length, quint32 crc )
+{
+    return ~crc32cSlicingBy8( ~crc, static_cast<const uchar *>( data ), length );
+}
@@ -21,27 +21,39 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
-#ifndef SINGLEAPPLICATIONMESSAGE_H
-#define SINGLEAPPLICATIONMESSAGE_H
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
 
-#include <QByteArray>
+#ifndef CRC32C_H
+#define CRC32C_H
 
-struct SingleApplicationMessage {
-    enum MessageType : quint8 {
-        Acknowledge,
-        NewInstance,
-        Message,
-    };
+#include <QtCore/QtGlobal>
 
-    MessageType type;
-    quint16 instanceId;
-    QByteArray content;
-    bool invalid;
+/**
+ * @brief Computes the CRC-32C (Castagnoli) checksum of a buffer
+ *
+ * Uses the SSE 4.2 or ARMv8 CRC32 instructions when the CPU supports them and
+ * falls back to a slicing-by-8 table implementation otherwise.
+ *
+ * @param data The buffer to checksum.
+ * @param length The length of the buffer in bytes.
+ * @param crc The checksum of the preceding data when checksumming a buffer in
+ * several parts, 0 otherwise.
+ * @return The checksum of the preceding data and the buffer.
+ */
+quint32 crc32c( const void *data, qint64 length, quint32 crc = 0 );
 
-    SingleApplicationMessage();
-    SingleApplicationMessage(MessageType type, quint16 instanceId, QByteArray content);
-    SingleApplicationMessage(QByteArray message);
-    operator QByteArray();
-};
+/**
+ * @brief Same as crc32c(), always computed with the slicing-by-8 tables
+ *
+ * The reference the CPU instructions are checked against.
+ */
+quint32 crc32cPortable( const void *data, qint64 length, quint32 crc = 0 );
 
-#endif // SINGLEAPPLICATIONMESSAGE_H
\ No newline at end of file
+#endif // CRC32C_H
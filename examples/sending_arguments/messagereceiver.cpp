@@ -28,7 +28,7 @@ MessageReceiver::MessageReceiver(QObject *parent) : QObject(parent)
 {
 }
 
-void MessageReceiver::receivedMessage(int instanceId, QByteArray message)
+void MessageReceiver::receivedMessage(quint64 instanceId, QByteArray message)
 {
     qDebug() << "Received message from instance: " << instanceId;
     qDebug() << "Message Text: " << message;
@@ -32,7 +32,7 @@ class MessageReceiver : public QObject
 public:
     explicit MessageReceiver(QObject *parent = 0);
 public slots:
-    void receivedMessage( int instanceId, QByteArray message );
+    void receivedMessage( quint64 instanceId, QByteArray message );
 };
 
 #endif // MESSAGERECEIVER_H
@@ -0,0 +1,501 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <cstring>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QtEndian>
+
+#include "singleapplication.h"
+#include "crc32c.h"
+
+/**
+ * @brief Encoding and decoding of the frames exchanged between instances
+ *
+ * Both the primary and the secondary instances use these functions, so there
+ * is exactly one definition of the wire format. A frame consists of a fixed
+ * size header, the content and a checksum trailer, all integers big-endian:
+ *
+ * | Field       | Version 1 | Version 2 |
+ * |-------------|-----------|-----------|
+ * | magic       | 4         | 4         |
+ * | version     | 4         | 4         |
+ * | type        | 1         | 1         |
+ * | flags       | -         | 1         |
+ * | sequence    | -         | 4         |
+ * | instance id | 2         | 8         |
+ * | length      | 8         | 8         |
+ * | content     | length    | length    |
+ * | checksum    | 2         | 4 or 0    |
+ *
+ * Version 1 frames are protected by a CRC-16 of the content. Version 2 frames
+ * are protected by a CRC-32C of the header and the content, which may be
+ * omitted on trusted transports.
+ */
+namespace FrameCodec {
+    /**
+     * @brief Number every frame starts with.
+     */
+    constexpr quint32 MagicNumber = 0x00010002;
+
+    /**
+     * @brief Highest protocol version supported by this implementation.
+     */
+    constexpr quint32 ProtocolVersion = 2;
+
+    /**
+     * @brief Flags carried in the header of protocol version 2 frames.
+     */
+    enum FrameFlag : quint8 {
+        /** The frame is not followed by a checksum */
+        NoChecksum = 1 << 0,
+        /** More frames of the same batch follow, only the last one is acknowledged */
+        Batched = 1 << 1,
+        /** The frame carries a sequence number and is acknowledged cumulatively */
+        Sequenced = 1 << 2,
+        /** The content is compressed with qCompress() */
+        Compressed = 1 << 3,
+        /** The content describes a sealed memfd holding the actual content */
+        SharedPayload = 1 << 4,
+        /** The content starts with an envelope holding its priority and deadline */
+        Enveloped = 1 << 5,
+        /** Acknowledges an `Enveloped` frame that expired instead of being delivered */
+        Expired = 1 << 6,
+    };
+
+    /**
+     * @brief Optional features announced in the handshake.
+     */
+    enum Capability : quint32 {
+        /** The peer accepts `Compressed` frames */
+        Decompression = 1 << 0,
+        /** The peer accepts `SharedPayload` frames */
+        SharedPayloads = 1 << 1,
+        /** The peer accepts `Enveloped` frames */
+        Envelopes = 1 << 2,
+        /** The peer answers `Ping` messages with a `Pong` */
+        Heartbeats = 1 << 3,
+        /** The peer accepts instance messages from the primary instance */
+        Pushes = 1 << 4,
+        /** The peer routes or accepts `Publish` messages */
+        Topics = 1 << 5,
+    };
+
+    /**
+     * @brief Flags understood by this build, frames with other flags are rejected.
+     */
+#ifndef QT_NO_COMPRESS
+    constexpr quint8 KnownFlags = NoChecksum | Batched | Sequenced | Compressed | SharedPayload | Enveloped | Expired;
+#else
+    constexpr quint8 KnownFlags = NoChecksum | Batched | Sequenced | SharedPayload | Enveloped | Expired;
+#endif
+
+    /**
+     * @brief Size of the fixed frame header of protocol version 1.
+     */
+    constexpr qint64 HeaderSizeV1 = 4 + 4 + 1 + 2 + 8;
+
+    /**
+     * @brief Size of the fixed frame header of protocol version 2, which adds
+     * the frame flags and a sequence number after the message type and
+     * carries the whole 64-bit instance id.
+     */
+    constexpr qint64 HeaderSizeV2 = HeaderSizeV1 + 1 + 4 + 6;
+
+    /**
+     * @brief Size of the largest header of any protocol version.
+     */
+    constexpr qint64 MaxHeaderSize = HeaderSizeV2;
+
+    /**
+     * @brief Size of the largest checksum trailer of any protocol version.
+     */
+    constexpr qint64 MaxTrailerSize = sizeof( quint32 );
+
+    /**
+     * @brief Maximum size of the content of a single frame.
+     */
+    constexpr qint64 MaxContentLength = 1024 * 1024;
+
+    /**
+     * @brief Maximum size of a complete frame of any protocol version.
+     */
+    constexpr qint64 MaxFrameSize = MaxHeaderSize + MaxContentLength + MaxTrailerSize;
+
+    /**
+     * @brief Maximum size of the content of a compressed frame once
+     * decompressed. Its compressed size is still limited by MaxContentLength.
+     */
+    constexpr qint64 MaxDecompressedLength = 64 * MaxContentLength;
+
+    /**
+     * @brief Frames up to this size, such as acknowledgements and handshakes,
+     * are consumed with a single read into a stack buffer.
+     */
+    constexpr qint64 SmallFrameSize = 64;
+
+    /**
+     * @brief Size of the envelope prefixing the content of `Enveloped` frames,
+     * a priority followed by a deadline.
+     */
+    constexpr qint64 EnvelopeSize = 1 + 8;
+
+    /**
+     * @brief The fields of a frame header.
+     */
+    struct Header {
+        quint32 version;
+        quint8 type;
+        quint8 flags;
+        quint32 sequence;
+        quint64 instanceId; ///< Truncated to 16 bits by version 1 frames
+        qint64 length;
+    };
+
+    /**
+     * @brief The fields of the envelope of an `Enveloped` frame.
+     */
+    struct Envelope {
+        quint8 priority;
+        qint64 deadline; ///< Milliseconds since the epoch, 0 if the message doesn't expire
+    };
+
+    /**
+     * @brief Outcome of parsing a header or reading a frame.
+     */
+    enum class Result {
+        /** More data is needed */
+        Incomplete,
+        /** The data does not start with a valid header or the frame failed its checksum */
+        Invalid,
+        /** A complete frame was decoded */
+        Complete,
+    };
+
+    inline qint64 headerSize( quint32 version )
+    {
+        return version == 1 ? HeaderSizeV1 : HeaderSizeV2;
+    }
+
+    inline qint64 trailerSize( quint32 version, quint8 flags )
+    {
+        if( version == 1 ) return sizeof( quint16 );
+        if( flags & NoChecksum ) return 0;
+        return sizeof( quint32 );
+    }
+
+    inline qint64 frameSize( const Header &header )
+    {
+        return headerSize( header.version ) + header.length + trailerSize( header.version, header.flags );
+    }
+
+    inline quint16 contentChecksum( const char *data, qint64 length )
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        return qChecksum( QByteArrayView( data, length ));
+#else
+        return qChecksum( data, static_cast<uint>( length ));
+#endif
+    }
+
+    /**
+     * @brief Parses and validates a frame header
+     * @param data The beginning of the frame.
+     * @param size The number of bytes available at data.
+     * @param header Receives the header fields if the result is `Complete`.
+     * @return `Incomplete` if size is too small to tell, `Invalid` if data
+     * does not start with a header this implementation accepts.
+     */
+    inline Result parseHeader( const uchar *data, qint64 size, Header &header )
+    {
+        if( size < HeaderSizeV1 ) return Result::Incomplete;
+
+        if( qFromBigEndian<quint32>( data ) != MagicNumber ) return Result::Invalid;
+
+        header.version = qFromBigEndian<quint32>( data + 4 );
+        if( header.version < 1 || header.version > ProtocolVersion ) return Result::Invalid;
+        if( size < headerSize( header.version )) return Result::Incomplete;
+
+        header.type = data[8];
+        header.flags = 0;
+        header.sequence = 0;
+        const uchar *fields = data + 9;
+        if( header.version != 1 ){
+            header.flags = data[9];
+            header.sequence = qFromBigEndian<quint32>( data + 10 );
+            fields = data + 14;
+        }
+        if( header.version == 1 ){
+            header.instanceId = qFromBigEndian<quint16>( fields );
+            fields += 2;
+        } else {
+            header.instanceId = qFromBigEndian<quint64>( fields );
+            fields += 8;
+        }
+        header.length = qFromBigEndian<qint64>( fields );
+
+        if( header.type >= SingleApplication::MessageType::MessageTypeCount ) return Result::Invalid;
+        if(( header.flags & ~KnownFlags ) != 0 ) return Result::Invalid;
+        if( header.length < 0 || header.length > MaxContentLength ) return Result::Invalid;
+
+        return Result::Complete;
+    }
+
+    /**
+     * @brief Validates the checksum trailer of a complete frame
+     * @param frame The header followed by the content.
+     * @param header The parsed header of the frame.
+     * @param trailer The trailer following the content.
+     */
+    inline bool verifyFrame( const uchar *frame, const Header &header, const uchar *trailer )
+    {
+        const qint64 offset = headerSize( header.version );
+        if( header.version == 1 )
+            return qFromBigEndian<quint16>( trailer ) == contentChecksum( reinterpret_cast<const char*>( frame + offset ), header.length );
+        if( header.flags & NoChecksum )
+            return true;
+        return qFromBigEndian<quint32>( trailer ) == crc32c( frame, offset + header.length );
+    }
+
+    /**
+     * @brief Same as above, for a frame whose content is stored apart from its header
+     */
+    inline bool verifyFrame( const uchar *headerData, const Header &header, const char *content, const uchar *trailer )
+    {
+        if( header.version == 1 )
+            return qFromBigEndian<quint16>( trailer ) == contentChecksum( content, header.length );
+        if( header.flags & NoChecksum )
+            return true;
+        return qFromBigEndian<quint32>( trailer ) == crc32c( content, header.length, crc32c( headerData, headerSize( header.version )));
+    }
+
+    /**
+     * @brief Appends a complete frame to a buffer
+     *
+     * The buffer grows once, the header, the content and the trailer are
+     * written in place. Flags are dropped with protocol version 1.
+     */
+    inline void appendFrame( QByteArray &buffer, const Header &header, const char *content )
+    {
+        const qint64 offset = buffer.size();
+        const qint64 size = headerSize( header.version );
+        buffer.resize( offset + frameSize( header ));
+        uchar *data = reinterpret_cast<uchar*>( buffer.data() ) + offset;
+
+        qToBigEndian<quint32>( MagicNumber, data );
+        qToBigEndian<quint32>( header.version, data + 4 );
+        data[8] = header.type;
+        uchar *fields = data + 9;
+        if( header.version != 1 ){
+            fields[0] = header.flags;
+            qToBigEndian<quint32>( header.sequence, fields + 1 );
+            fields += 5;
+        }
+        if( header.version == 1 ){
+            qToBigEndian<quint16>( static_cast<quint16>( header.instanceId ), fields );
+            fields += 2;
+        } else {
+            qToBigEndian<quint64>( header.instanceId, fields );
+            fields += 8;
+        }
+        qToBigEndian<qint64>( header.length, fields );
+        if( header.length > 0 )
+            memcpy( data + size, content, static_cast<size_t>( header.length ));
+
+        uchar *trailer = data + size + header.length;
+        if( header.version == 1 )
+            qToBigEndian<quint16>( contentChecksum( content, header.length ), trailer );
+        else if( ! ( header.flags & NoChecksum ))
+            qToBigEndian<quint32>( crc32c( data, size + header.length ), trailer );
+    }
+
+    /**
+     * @brief Finds where the next frame may start after an invalid header
+     * @param data Bytes peeked from the stream, starting at the invalid header.
+     * @param size The number of bytes at data.
+     * @return The number of bytes that can't start a frame and may be skipped,
+     * at least one. A magic number cut off at the end of data is kept.
+     */
+    inline qint64 synchronise( const uchar *data, qint64 size )
+    {
+        uchar magic[sizeof( MagicNumber )];
+        qToBigEndian<quint32>( MagicNumber, magic );
+
+        for( qint64 offset = 1; offset < size; ++offset ){
+            const qint64 compared = qMin<qint64>( sizeof( magic ), size - offset );
+            if( memcmp( data + offset, magic, static_cast<size_t>( compared )) == 0 )
+                return offset;
+        }
+        return qMax<qint64>( size, 1 );
+    }
+
+    /**
+     * @brief Waits for the next frame of a device to be complete
+     *
+     * The header is peeked in place and nothing is consumed but bytes that
+     * don't form a valid header, which are skipped up to the next candidate
+     * magic number until the stream is synchronised on a frame again, so
+     * any byte sequence is consumed in linear time.
+     *
+     * @param device The device to read from, a socket or any other QIODevice.
+     * @param header Receives the header of the frame.
+     * @return `Complete` once the whole frame is available, `Incomplete` if
+     * more data is needed.
+     */
+    inline Result peekFrame( QIODevice *device, Header &header )
+    {
+        uchar data[SmallFrameSize];
+
+        while( device->bytesAvailable() >= HeaderSizeV1 ){
+            const qint64 peeked = device->peek( reinterpret_cast<char*>( data ), MaxHeaderSize );
+            const Result result = parseHeader( data, peeked, header );
+            if( result == Result::Incomplete ) return Result::Incomplete;
+            if( result == Result::Invalid ){
+                const qint64 window = device->peek( reinterpret_cast<char*>( data ), SmallFrameSize );
+                if( device->skip( synchronise( data, window )) <= 0 )
+                    return Result::Incomplete;
+                continue;
+            }
+
+            return device->bytesAvailable() < frameSize( header ) ? Result::Incomplete : Result::Complete;
+        }
+
+        return Result::Incomplete;
+    }
+
+    /**
+     * @brief Consumes the frame found by peekFrame() and decodes its content
+     *
+     * Small frames are consumed with a single read, larger ones have their
+     * content read once, directly into the returned buffer. That buffer is
+     * the one allocation a non-empty frame costs: receivers may keep it
+     * indefinitely, so it cannot be a view into the socket's read buffer.
+     *
+     * @return `Complete` if the frame was decoded, `Invalid` if it failed
+     * its checksum and was dropped.
+     */
+    inline Result takeFrame( QIODevice *device, const Header &header, QByteArray &content )
+    {
+        uchar data[SmallFrameSize];
+        static_assert( SmallFrameSize >= MaxHeaderSize + MaxTrailerSize, "A small frame must fit a header and a trailer" );
+
+        const qint64 size = frameSize( header );
+        const qint64 offset = headerSize( header.version );
+        if( size <= SmallFrameSize ){
+            if( device->read( reinterpret_cast<char*>( data ), size ) != size )
+                return Result::Invalid;
+            if( ! verifyFrame( data, header, data + offset + header.length ))
+                return Result::Invalid;
+            content = QByteArray( reinterpret_cast<const char*>( data + offset ), static_cast<int>( header.length ));
+            return Result::Complete;
+        }
+
+        uchar trailer[MaxTrailerSize];
+        const qint64 trailerLength = trailerSize( header.version, header.flags );
+        content = QByteArray( static_cast<int>( header.length ), Qt::Uninitialized );
+        // A device may deliver less than it claimed to have available,
+        // whatever was consumed of such a frame is dropped
+        if( device->read( reinterpret_cast<char*>( data ), offset ) != offset ||
+            device->read( content.data(), header.length ) != header.length ||
+            device->read( reinterpret_cast<char*>( trailer ), trailerLength ) != trailerLength )
+            return Result::Invalid;
+        if( ! verifyFrame( data, header, content.constData(), trailer ))
+            return Result::Invalid;
+        return Result::Complete;
+    }
+
+    /**
+     * @brief Consumes the frame found by peekFrame() without decoding it
+     *
+     * The frame is read as a whole, its checksum is left to whoever decodes
+     * it, e.g. the peer it is forwarded to.
+     *
+     * @return `Complete` if the frame was read, `Invalid` if the device
+     * delivered less than it claimed to have available.
+     */
+    inline Result takeRawFrame( QIODevice *device, const Header &header, QByteArray &frame )
+    {
+        const qint64 size = frameSize( header );
+        frame = QByteArray( static_cast<int>( size ), Qt::Uninitialized );
+        return device->read( frame.data(), size ) == size ? Result::Complete : Result::Invalid;
+    }
+
+    /**
+     * @brief Reads the next frame from a device
+     *
+     * Decodes incrementally with peekFrame() and takeFrame(): partial frames
+     * cost neither allocations nor a rollback and coalesced frames are
+     * returned one per call.
+     *
+     * @param device The device to read from, a socket or any other QIODevice.
+     * @param header Receives the header of the frame.
+     * @param content Receives the content of the frame.
+     * @return `Complete` if a frame was decoded, `Invalid` if a complete frame
+     * failed its checksum and was dropped, `Incomplete` if more data is needed.
+     */
+    inline Result readFrame( QIODevice *device, Header &header, QByteArray &content )
+    {
+        if( peekFrame( device, header ) != Result::Complete )
+            return Result::Incomplete;
+        return takeFrame( device, header, content );
+    }
+
+    inline QByteArray encodeEnvelope( const Envelope &envelope )
+    {
+        QByteArray data( EnvelopeSize, Qt::Uninitialized );
+        data[0] = static_cast<char>( envelope.priority );
+        qToBigEndian<qint64>( envelope.deadline, data.data() + 1 );
+        return data;
+    }
+
+    /**
+     * @brief Removes the envelope from the content of an `Enveloped` frame
+     * @return false if the content is too short to hold one
+     */
+    inline bool takeEnvelope( QByteArray &content, Envelope &envelope )
+    {
+        if( content.size() < EnvelopeSize )
+            return false;
+
+        envelope.priority = static_cast<quint8>( content.at( 0 ));
+        envelope.deadline = qFromBigEndian<qint64>( content.constData() + 1 );
+        content.remove( 0, EnvelopeSize );
+        return true;
+    }
+}
+
+#endif // FRAME_CODEC_H
@@ -0,0 +1,65 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// libFuzzer target feeding arbitrary bytes to FrameCodec::readFrame().
+// The input arrives in fragments whose sizes are taken from its first byte,
+// so frames and garbage cut at any point are covered.
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <QtCore/QBuffer>
+
+#include "frame_codec.h"
+
+extern "C" int LLVMFuzzerTestOneInput( const uint8_t *data, size_t size )
+{
+    if( size == 0 ) return 0;
+    const qint64 fragment = data[0] + 1;
+    ++data;
+    --size;
+
+    QByteArray stream;
+    QBuffer buffer( &stream );
+    buffer.open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+
+    FrameCodec::Header header;
+    QByteArray content;
+    for( qint64 fed = 0; fed < static_cast<qint64>( size ); ){
+        const qint64 length = qMin<qint64>( fragment, static_cast<qint64>( size ) - fed );
+        stream.append( reinterpret_cast<const char*>( data + fed ), static_cast<int>( length ));
+        fed += length;
+
+        for( ;; ){
+            const qint64 position = buffer.pos();
+            const FrameCodec::Result result = FrameCodec::readFrame( &buffer, header, content );
+            // Complete or invalid frames are consumed, so decoding terminates
+            if( result == FrameCodec::Result::Incomplete ) break;
+            if( buffer.pos() <= position ) std::abort();
+            if( result == FrameCodec::Result::Complete && content.size() != header.length ) std::abort();
+        }
+        if( buffer.pos() > stream.size() ) std::abort();
+    }
+
+    return 0;
+}
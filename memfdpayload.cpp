@@ -0,0 +1,187 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QtEndian>
+
+#include "memfdpayload.h"
+
+#ifdef Q_OS_LINUX
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #if defined(MFD_ALLOW_SEALING) && defined(F_SEAL_WRITE)
+        #define SINGLEAPPLICATION_MEMFD 1
+    #endif
+#endif
+
+namespace {
+    constexpr int DescriptionSize = 8 + 4 + 8;
+#ifdef SINGLEAPPLICATION_MEMFD
+    constexpr int RequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+#endif
+}
+
+bool MemfdPayload::isSupported()
+{
+#ifdef SINGLEAPPLICATION_MEMFD
+    return true;
+#else
+    return false;
+#endif
+}
+
+int MemfdPayload::create( const QByteArray &content )
+{
+#ifdef SINGLEAPPLICATION_MEMFD
+    const int fd = ::memfd_create( "SingleApplication", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    if( fd == -1 )
+        return -1;
+
+    const char *data = content.constData();
+    qint64 remaining = content.size();
+    while( remaining > 0 ){
+        const ssize_t written = ::write( fd, data, static_cast<size_t>( remaining ));
+        if( written == -1 && errno == EINTR )
+            continue;
+        if( written <= 0 ){
+            ::close( fd );
+            return -1;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    // The receiver maps the content, so it must never change or shrink
+    if( ::fcntl( fd, F_ADD_SEALS, RequiredSeals | F_SEAL_SEAL ) == -1 ){
+        ::close( fd );
+        return -1;
+    }
+
+    return fd;
+#else
+    Q_UNUSED( content );
+    return -1;
+#endif
+}
+
+QByteArray MemfdPayload::describe( int fd, qint64 size )
+{
+    QByteArray description( DescriptionSize, Qt::Uninitialized );
+    qToBigEndian<qint64>( QCoreApplication::applicationPid(), description.data() );
+    qToBigEndian<qint32>( fd, description.data() + 8 );
+    qToBigEndian<qint64>( size, description.data() + 12 );
+    return description;
+}
+
+void MemfdPayload::release( int fd )
+{
+#ifdef SINGLEAPPLICATION_MEMFD
+    if( fd != -1 )
+        ::close( fd );
+#else
+    Q_UNUSED( fd );
+#endif
+}
+
+MemfdPayload::MemfdPayload()
+    : address( nullptr ), size( 0 )
+{
+}
+
+MemfdPayload::~MemfdPayload()
+{
+#ifdef SINGLEAPPLICATION_MEMFD
+    if( address != nullptr )
+        ::munmap( address, static_cast<size_t>( size ));
+#endif
+}
+
+bool MemfdPayload::map( const QByteArray &description, qint64 senderPid )
+{
+#ifdef SINGLEAPPLICATION_MEMFD
+    if( address != nullptr || description.size() != DescriptionSize )
+        return false;
+
+    const qint64 pid = qFromBigEndian<qint64>( description.constData() );
+    const qint32 descriptor = qFromBigEndian<qint32>( description.constData() + 8 );
+    const qint64 length = qFromBigEndian<qint64>( description.constData() + 12 );
+    if( pid != senderPid || descriptor < 0 || length <= 0 )
+        return false;
+
+    // The sender chooses the descriptor, so opening it must neither block,
+    // as a FIFO would, nor have side effects, as some devices would
+    const QByteArray path = "/proc/" + QByteArray::number( pid ) + "/fd/" + QByteArray::number( descriptor );
+    struct stat target;
+    if( ::stat( path.constData(), &target ) == -1 || ! S_ISREG( target.st_mode ))
+        return false;
+
+    const int fd = ::open( path.constData(), O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY );
+    if( fd == -1 )
+        return false;
+
+    // The descriptor may have been replaced since it was checked
+    struct stat status;
+    if( ::fstat( fd, &status ) == -1 || ! S_ISREG( status.st_mode ) ||
+        status.st_dev != target.st_dev || status.st_ino != target.st_ino || status.st_size != length ){
+        ::close( fd );
+        return false;
+    }
+
+    const int seals = ::fcntl( fd, F_GET_SEALS );
+    if( seals == -1 || ( seals & RequiredSeals ) != RequiredSeals ){
+        ::close( fd );
+        return false;
+    }
+
+    void *mapping = ::mmap( nullptr, static_cast<size_t>( length ), PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if( mapping == MAP_FAILED )
+        return false;
+
+    address = mapping;
+    size = length;
+    return true;
+#else
+    Q_UNUSED( description );
+    Q_UNUSED( senderPid );
+    return false;
+#endif
+}
+
+QByteArray MemfdPayload::view() const
+{
+    return QByteArray::fromRawData( static_cast<const char *>( address ), size );
+}
+
+qint64 MemfdPayload::length() const
+{
+    return size;
+}
+
+QByteArray MemfdPayload::copy() const
+{
+    return QByteArray( static_cast<const char *>( address ), size );
+}
@@ -0,0 +1,112 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#ifndef MEMFDPAYLOAD_H
+#define MEMFDPAYLOAD_H
+
+#include <QtCore/QtGlobal>
+#include <QtCore/QByteArray>
+
+/**
+ * @brief Large message content handed over in a sealed Linux memfd
+ *
+ * The sender copies the content into a memfd once and seals it, so it can no
+ * longer change. Only a small description of the descriptor travels over the
+ * socket. The receiver opens the descriptor through the sender's /proc entry,
+ * which only works between processes of the same user, and maps it.
+ */
+class MemfdPayload {
+public:
+    /**
+     * @brief Content size from which the memfd is cheaper than the socket
+     */
+    static constexpr qint64 Threshold = 256 * 1024;
+
+    /**
+     * @brief Returns whether memfd payloads are supported on this platform
+     */
+    static bool isSupported();
+
+    /**
+     * @brief Creates a sealed memfd holding a copy of the content
+     * @return The descriptor, or -1 on failure
+     */
+    static int create( const QByteArray &content );
+
+    /**
+     * @brief Describes a memfd of the current process to the receiver
+     */
+    static QByteArray describe( int fd, qint64 size );
+
+    /**
+     * @brief Closes a memfd created with create() once the receiver mapped it
+     */
+    static void release( int fd );
+
+    MemfdPayload();
+    ~MemfdPayload();
+    MemfdPayload( const MemfdPayload & ) = delete;
+    MemfdPayload &operator=( const MemfdPayload & ) = delete;
+
+    /**
+     * @brief Maps a memfd described by the sender read-only
+     * @param description The description received from the sender
+     * @param senderPid The process id of the connected peer. The
+     * description has to refer to a descriptor of that process.
+     * @return false if the descriptor could not be opened, is not a regular
+     * file sealed against modifications or doesn't have the described size
+     */
+    bool map( const QByteArray &description, qint64 senderPid );
+
+    /**
+     * @brief Returns the content without copying it
+     *
+     * The returned array is only valid as long as this object exists.
+     */
+    QByteArray view() const;
+
+    /**
+     * @brief Returns the size of the content
+     */
+    qint64 length() const;
+
+    /**
+     * @brief Returns a copy of the content
+     */
+    QByteArray copy() const;
+
+private:
+    void *address; ///< Address of the mapping.
+    qint64 size; ///< Size of the mapping.
+};
+
+#endif // MEMFDPAYLOAD_H
@@ -21,199 +21,509 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <QtCore/QDebug>
+#include <QtCore/QtEndian>
+
 #include "message_coder.h"
-#include <QDebug>
-#include <QIODevice>
+#include "memfdpayload.h"
+
+using namespace FrameCodec;
+
+namespace {
+#ifndef QT_NO_COMPRESS
+    constexpr quint32 CompressionCapabilities = Decompression;
+#else
+    constexpr quint32 CompressionCapabilities = 0;
+#endif
+    // Fast compression, the transport is local so CPU time matters more than size
+    constexpr int CompressionLevel = 1;
+}
 
 // Constructor for MessageCoder
 // Initializes the QLocalSocket and sets up connections for readyRead and aboutToClose signals
 MessageCoder::MessageCoder(QLocalSocket *socket)
-    : socket(socket), dataStream(socket)
+    : socket(socket), protocolVersion(1), checksumEnabled(true), peerCapabilities(0), compressionThreshold(-1), paused(false),
+      throttled(false), idleRequested(false), inFlight(0), inFlightLimit(-1), budget(nullptr), decodeQuantum(-1), unwritten(0), received(0),
+      decompressionOffloaded(false), decompressing(false), compressedHeader{},
+      forwardedType(SingleApplication::MessageType::MessageTypeCount)
 {
     connect(socket, &QLocalSocket::readyRead, this, &MessageCoder::slotDataAvailable);
+    connect(socket, &QLocalSocket::bytesWritten, this, [this](qint64 bytes) { unwritten -= bytes; });
     connect(socket, &QLocalSocket::aboutToClose, this, [socket, this]() {
         if (socket->bytesAvailable() > 0)
             slotDataAvailable();
     });
+
+    // A socket handed over from another thread may have buffered data whose
+    // readyRead() was emitted before anything was connected to it. Decode it
+    // once the caller had a chance to connect to messageReceived().
+    if (socket->bytesAvailable() > 0)
+        QMetaObject::invokeMethod(this, [this]() { slotDataAvailable(); }, Qt::QueuedConnection);
+}
+
+MessageCoder::~MessageCoder()
+{
+    if (budget)
+        budget->cancel(this);
+}
+
+void MessageCoder::setProtocolVersion(quint32 version)
+{
+    protocolVersion = qBound<quint32>(1, version, quint32(ProtocolVersion));
+}
+
+void MessageCoder::setChecksumEnabled(bool enabled)
+{
+    checksumEnabled = enabled;
+}
+
+void MessageCoder::setCompressionThreshold(qint64 threshold)
+{
+    compressionThreshold = threshold;
+}
+
+QByteArray MessageCoder::handshake()
+{
+    QByteArray content(2 * sizeof(quint32), Qt::Uninitialized);
+    qToBigEndian<quint32>(ProtocolVersion, content.data());
+    const quint32 capabilities = CompressionCapabilities | Envelopes | Heartbeats | Pushes | Topics | (MemfdPayload::isSupported() ? SharedPayloads : 0);
+    qToBigEndian<quint32>(capabilities, content.data() + sizeof(quint32));
+    return content;
+}
+
+void MessageCoder::negotiate(const QByteArray &handshake)
+{
+    if (handshake.size() < static_cast<int>(sizeof(quint32))) {
+        setProtocolVersion(1);
+        peerCapabilities = 0;
+        return;
+    }
+    setProtocolVersion(qFromBigEndian<quint32>(handshake.constData()));
+
+    peerCapabilities = handshakeCapabilities(handshake);
+}
+
+quint32 MessageCoder::handshakeCapabilities(const QByteArray &handshake)
+{
+    // Peers announcing no capabilities send the version only
+    if (handshake.size() < static_cast<int>(2 * sizeof(quint32)))
+        return 0;
+    return qFromBigEndian<quint32>(handshake.constData() + sizeof(quint32));
+}
+
+void MessageCoder::pause()
+{
+    paused = true;
+}
+
+void MessageCoder::resume()
+{
+    if (!paused.exchange(false))
+        return;
+
+    // Directly when called from the thread of the coder, queued otherwise
+    QMetaObject::invokeMethod(this, [this]() { slotDataAvailable(); });
+}
+
+bool MessageCoder::isPaused() const
+{
+    return paused;
+}
+
+void MessageCoder::setFlowControl(qint64 limit, FlowBudget *budget)
+{
+    inFlightLimit = limit;
+    this->budget = budget;
+}
+
+void MessageCoder::setDecodeQuantum(qint64 quantum)
+{
+    decodeQuantum = quantum;
+}
+
+void MessageCoder::acquire(qint64 bytes)
+{
+    inFlight += bytes;
+    if (budget)
+        budget->acquire(bytes);
+}
+
+void MessageCoder::release(qint64 bytes)
+{
+    inFlight -= bytes;
+    if (budget)
+        budget->release(bytes);
+    wakeUp();
+}
+
+bool MessageCoder::isThrottled() const
+{
+    return throttled;
+}
+
+qint64 MessageCoder::footprint(const SingleApplication::Message &message)
+{
+    // Empty messages still cost their bookkeeping
+    return message.content.size() + MaxHeaderSize;
+}
+
+void MessageCoder::notifyWhenIdle()
+{
+    idleRequested = true;
+    QMetaObject::invokeMethod(this, [this]() { slotDataAvailable(); }, Qt::QueuedConnection);
+}
+
+bool MessageCoder::isOverLimit() const
+{
+    const qint64 limit = inFlightLimit;
+    return (limit >= 0 && inFlight >= limit) || (budget && budget->isExhausted());
+}
+
+bool MessageCoder::throttle()
+{
+    throttled = true;
+    if (budget)
+        budget->wait(this);
+
+    // Bytes released before the flag was set found nothing to wake up
+    return !(!isOverLimit() && throttled.exchange(false));
+}
+
+bool MessageCoder::wakeUp()
+{
+    if (!throttled)
+        return true;
+    if (isOverLimit())
+        return false;
+    if (throttled.exchange(false))
+        QMetaObject::invokeMethod(this, [this]() { slotDataAvailable(); }, Qt::QueuedConnection);
+    return true;
 }
 
 // Slot to handle data availability
-// Reads data from the socket and processes it according to the protocol
+// Frames are decoded straight out of the socket's read buffer, see
+// FrameCodec::peekFrame(). Partial frames stay in the socket until the rest
+// has arrived.
 void MessageCoder::slotDataAvailable()
 {
-    qDebug() << "slotDataAvailable()";
-    struct {
-        quint8 magicNumber0;
-        quint8 magicNumber1;
-        quint8 magicNumber2;
-        quint8 magicNumber3;
-        quint32 protocolVersion;
-        SingleApplication::MessageType type;
-        quint16 instanceId;
-        qsizetype length;
-        QByteArray content;
-        quint16 checksum;
-    } msg;
-
-    while (socket->bytesAvailable() > 0) {
-        dataStream.startTransaction();
-
-        // Read and validate magic numbers
-        dataStream >> msg.magicNumber0;
-        if (msg.magicNumber0 != 0x00) {
-            dataStream.abortTransaction();
-            continue;
-        }
-        dataStream >> msg.magicNumber1;
-        if (msg.magicNumber1 != 0x01) {
-            dataStream.abortTransaction();
-            continue;
-        }
-        dataStream >> msg.magicNumber2;
-        if (msg.magicNumber2 != 0x00) {
-            dataStream.abortTransaction();
-            continue;
-        }
-        dataStream >> msg.magicNumber3;
-        if (msg.magicNumber3 != 0x02) {
-            dataStream.abortTransaction();
-            continue;
+    Header header;
+    QByteArray content;
+    qint64 decoded = 0;
+
+    // Queued calls may still run once the socket was deleted
+    if (!socket)
+        return;
+
+    while (!paused && !throttled && !decompressing) {
+        if (isOverLimit() && throttle())
+            return;
+
+        // Give the other connections served by this thread a turn
+        if (decodeQuantum >= 0 && decoded >= decodeQuantum) {
+            QMetaObject::invokeMethod(this, [this]() { slotDataAvailable(); }, Qt::QueuedConnection);
+            return;
         }
 
-        // Read and validate protocol version
-        dataStream >> msg.protocolVersion;
-        if (msg.protocolVersion > 0x00000001) {
-            dataStream.abortTransaction();
-            continue;
+        if (peekFrame(socket, header) != Result::Complete) {
+            if (idleRequested.exchange(false))
+                Q_EMIT idle();
+            return;
         }
+        received.fetch_add(frameSize(header), std::memory_order_relaxed);
 
-        // Read and validate message type
-        dataStream >> msg.type;
-        switch (msg.type) {
-            case SingleApplication::MessageType::Acknowledge:
-            case SingleApplication::MessageType::NewInstance:
-            case SingleApplication::MessageType::InstanceMessage:
-                break;
-            default:
-                dataStream.abortTransaction();
+        // Plain frames to forward are passed on as they arrived, without
+        // a pass over their content
+        const bool forwarded = header.type == forwardedType;
+        if (forwarded && header.version == ProtocolVersion && (header.flags & ~NoChecksum) == 0) {
+            if (takeRawFrame(socket, header, content) != Result::Complete)
                 continue;
+            protocolVersion = ProtocolVersion;
+            emitMessage(header, std::move(content), decoded);
+            continue;
         }
 
-        // Read instance ID and message length
-        dataStream >> msg.instanceId;
-        dataStream >> msg.length;
-        if (msg.length > 1024 * 1024) { // Validate message length
-            dataStream.abortTransaction();
+        const Result result = takeFrame(socket, header, content);
+
+        if (result == Result::Invalid) {
+            qWarning() << "SingleApplication: Dropping message with an invalid checksum";
             continue;
         }
 
-        // Read message content
-        msg.content = QByteArray(msg.length, Qt::Uninitialized);
-        int bytesRead = dataStream.readRawData(msg.content.data(), msg.length);
-        if (bytesRead == -1) {
-            switch (dataStream.status()) {
-                case QDataStream::ReadPastEnd:
-                    dataStream.rollbackTransaction();
-                    break;
-                case QDataStream::ReadCorruptData:
-                    dataStream.abortTransaction();
-                    break;
-                default:
-                    qWarning() << "Unexpected QDataStream status after readRawData:" << dataStream.status();
-                    dataStream.abortTransaction();
-                    break;
+        if (header.flags & Compressed) {
+            // qCompress() prefixes the data with its decompressed size
+            if (header.length < static_cast<qint64>(sizeof(quint32)) ||
+                qFromBigEndian<quint32>(content.constData()) > MaxDecompressedLength) {
+                qWarning() << "SingleApplication: Dropping compressed message exceeding the maximum size";
+                continue;
             }
-            continue;
-        } else if (bytesRead != msg.length) {
-            switch (dataStream.status()) {
-                case QDataStream::Ok:
-                    dataStream.abortTransaction();
-                    break;
-                case QDataStream::ReadPastEnd:
-                    dataStream.rollbackTransaction();
-                    break;
-                case QDataStream::ReadCorruptData:
-                    dataStream.abortTransaction();
-                    break;
-                default:
-                    qWarning() << "Unexpected QDataStream status in message length validation:" << dataStream.status();
-                    dataStream.abortTransaction();
-                    break;
+#ifndef QT_NO_COMPRESS
+            // Decoding of this connection stops until the content is back
+            if (decompressionOffloaded) {
+                decompressing = true;
+                compressedHeader = header;
+                Q_EMIT compressedContentReceived(std::move(content));
+                return;
+            }
+            content = qUncompress(content);
+#endif
+            if (content.isEmpty()) {
+                qWarning() << "SingleApplication: Dropping message that failed to decompress";
+                continue;
             }
-            continue;
         }
 
-        // Read and validate checksum
-        dataStream >> msg.checksum;
-        switch (dataStream.status()) {
-            case QDataStream::Ok:
-                break;
-            case QDataStream::ReadPastEnd:
-                dataStream.rollbackTransaction();
-                break;
-            case QDataStream::ReadCorruptData:
-                dataStream.abortTransaction();
-                break;
-            default:
-                qWarning() << "Unexpected QDataStream status:" << dataStream.status();
-                dataStream.abortTransaction();
-                break;
-        }
+        emitDecoded(header, std::move(content), decoded);
+    }
+}
 
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-        const quint16 computedChecksum = qChecksum(QByteArray(msg.content.constData(), static_cast<quint32>(msg.content.length())));
-#else
-        const quint16 computedChecksum = qChecksum(msg.content.constData(), static_cast<quint32>(msg.content.length()));
-#endif
+void MessageCoder::setDecompressionOffloaded(bool offloaded)
+{
+    decompressionOffloaded = offloaded;
+}
 
-        if (msg.checksum != computedChecksum) {
-            dataStream.abortTransaction();
-            continue;
-        }
+void MessageCoder::completeDecompression(QByteArray content)
+{
+    if (!decompressing)
+        return;
+    decompressing = false;
+
+    qint64 decoded = 0;
+    if (content.isEmpty())
+        qWarning() << "SingleApplication: Dropping message that failed to decompress";
+    else
+        emitDecoded(compressedHeader, std::move(content), decoded);
+
+    slotDataAvailable();
+}
 
-        // Commit the transaction and emit the messageReceived signal
-        if (dataStream.commitTransaction()) {
-            qDebug() << "Message received:" << msg.type << msg.instanceId << msg.content;
-            emit messageReceived(SingleApplication::Message{
-                .type = msg.type,
-                .instanceId = msg.instanceId,
-                .content = QByteArray(msg.content)
-            });
+void MessageCoder::emitDecoded(Header header, QByteArray content, qint64 &decoded)
+{
+    // A peer sending a newer version understands it, even if the
+    // connection was established without a handshake
+    if (header.version > protocolVersion)
+        protocolVersion = header.version;
+
+    // Frames to forward are encoded again as a plain frame
+    if (header.type == forwardedType) {
+        if (content.size() > MaxContentLength) {
+            qWarning() << "SingleApplication: Dropping message too large to forward";
+            return;
         }
+        QByteArray frame;
+        const Header plain{ProtocolVersion, header.type, static_cast<quint8>(header.flags & NoChecksum), 0, header.instanceId, content.size()};
+        FrameCodec::appendFrame(frame, plain, content.constData());
+        content = std::move(frame);
+        header = plain;
+    }
+
+    emitMessage(header, std::move(content), decoded);
+}
+
+void MessageCoder::emitMessage(const Header &header, QByteArray content, qint64 &decoded)
+{
+    SingleApplication::Message message{
+        static_cast<SingleApplication::MessageType>(header.type),
+        header.instanceId,
+        std::move(content),
+        header.flags,
+        header.sequence
+    };
+
+    // Accounted before it is emitted, the receiver may release it at once
+    const qint64 size = footprint(message);
+    decoded += size;
+    if (inFlightLimit >= 0 || budget) {
+        inFlight += size;
+        if (budget)
+            budget->acquire(size);
+    }
+
+    Q_EMIT messageReceived(std::move(message));
+}
+
+void MessageCoder::setForwardedType(SingleApplication::MessageType type)
+{
+    forwardedType = type;
+}
+
+void FlowBudget::setLimit(qint64 bytes)
+{
+    limit = bytes;
+    release(0);
+}
+
+bool FlowBudget::isExhausted() const
+{
+    const qint64 bytes = limit;
+    return bytes >= 0 && used >= bytes;
+}
+
+void FlowBudget::acquire(qint64 bytes)
+{
+    used += bytes;
+}
+
+bool FlowBudget::tryAcquire(qint64 bytes)
+{
+    qint64 current = used;
+    do {
+        const qint64 bytesLimit = limit;
+        if (bytesLimit >= 0 && current + bytes > bytesLimit)
+            return false;
+    } while (!used.compare_exchange_weak(current, current + bytes));
+    return true;
+}
+
+void FlowBudget::release(qint64 bytes)
+{
+    used -= bytes;
+    if (isExhausted())
+        return;
+
+    // Under the lock, so none of the coders is destroyed meanwhile
+    QMutexLocker locker(&mutex);
+    for (auto it = waiting.begin(); it != waiting.end();) {
+        if ((*it)->wakeUp())
+            it = waiting.erase(it);
+        else
+            ++it;
     }
 }
 
+void FlowBudget::wait(MessageCoder *coder)
+{
+    QMutexLocker locker(&mutex);
+    if (!waiting.contains(coder))
+        waiting.append(coder);
+}
+
+void FlowBudget::cancel(MessageCoder *coder)
+{
+    QMutexLocker locker(&mutex);
+    waiting.removeAll(coder);
+}
+
+quint32 MessageCoder::negotiatedVersion() const
+{
+    return protocolVersion;
+}
+
+quint32 MessageCoder::capabilities() const
+{
+    return peerCapabilities;
+}
+
 // Function to send a message
-// Constructs and sends a message according to the protocol
-bool MessageCoder::sendMessage(SingleApplication::MessageType type, quint16 instanceId, QByteArray content)
+// Constructs the frame in a single buffer and writes it to the socket at once
+bool MessageCoder::sendMessage(SingleApplication::MessageType type, quint64 instanceId, QByteArray content, quint8 flags, quint32 sequence)
 {
-    qDebug() << "sendMessage()";
-    if (content.size() > 1024 * 1024) { // Validate message content size
-        qWarning() << "Message content size exceeds maximum allowed size of 1MiB";
+    QByteArray frame;
+    if (!appendFrame(frame, type, instanceId, content, flags, sequence))
         return false;
+
+    return write(frame);
+}
+
+// Function to send a batch of messages
+// All frames are packed into one buffer and written to the socket at once
+bool MessageCoder::sendMessages(SingleApplication::MessageType type, quint64 instanceId, const QList<QByteArray> &contents, quint8 flags)
+{
+    qint64 size = 0;
+    for (const QByteArray &content : contents)
+        size += MaxFrameSize - MaxContentLength + content.size();
+
+    QByteArray frames;
+    frames.reserve(size);
+    for (int i = 0; i < contents.size(); ++i) {
+        const quint8 frameFlags = i + 1 < contents.size() ? flags | Batched : flags;
+        if (!appendFrame(frames, type, instanceId, contents.at(i), frameFlags, 0))
+            return false;
     }
 
-#if (QT_VERSION >= QT_VERSION_CHECK(6, 6, 0))
-    dataStream.setVersion(QDataStream::Qt_6_6);
-#elif (QT_VERSION >= QT_VERSION_CHECK(6, 0, 0))
-    dataStream.setVersion(QDataStream::Qt_6_0);
-#else
-    dataStream.setVersion(QDataStream::QDataStream::Qt_5_15);
-#endif
+    return write(frames);
+}
 
-    // Write message components to the data stream
-    dataStream << 0x00010002; // Magic number
-    dataStream << (quint32)0x00000001; // Protocol version
-    dataStream << static_cast<quint8>(type); // Message type
-    dataStream << instanceId; // Instance ID
-    dataStream << (qsizetype)content.size();
-    dataStream.writeRawData(content.constData(), content.length());
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    quint16 checksum = qChecksum(QByteArray(content.constData(), static_cast<quint32>(content.length())));
-#else
-    quint16 checksum = qChecksum(content.constData(), static_cast<quint32>(content.length()));
+bool MessageCoder::writeFrames(const QByteArray &frames)
+{
+    return write(frames);
+}
+
+// Function to write frames from another thread
+// The bytes are reserved before the write is queued, so every caller sees
+// the frames that are still on their way to the socket
+bool MessageCoder::postFrames(const QByteArray &frames, qint64 limit)
+{
+    qint64 current = unwritten.load();
+    do {
+        if (current + frames.size() > limit)
+            return false;
+    } while (!unwritten.compare_exchange_weak(current, current + frames.size()));
+
+    // The socket may be gone by the time the write runs, e.g. once its
+    // connection was dropped, and its reservation is rolled back
+    QMetaObject::invokeMethod(this, [this, frames]() {
+        if (!socket || socket->write(frames) != frames.size())
+            unwritten -= frames.size();
+    });
+    return true;
+}
+
+qint64 MessageCoder::bytesToWrite() const
+{
+    return unwritten.load();
+}
+
+qint64 MessageCoder::bytesReceived() const
+{
+    return received.load(std::memory_order_relaxed);
+}
+
+bool MessageCoder::write(const QByteArray &data)
+{
+    unwritten += data.size();
+    if (socket && socket->write(data) == data.size())
+        return true;
+
+    unwritten -= data.size();
+    return false;
+}
+
+bool MessageCoder::appendFrame(QByteArray &buffer, SingleApplication::MessageType type, quint64 instanceId, const QByteArray &content, quint8 flags, quint32 sequence) const
+{
+    const QByteArray *payload = &content;
+
+#ifndef QT_NO_COMPRESS
+    QByteArray compressed;
+    if (protocolVersion != 1 && (peerCapabilities & Decompression) &&
+        compressionThreshold >= 0 && content.size() >= compressionThreshold &&
+        content.size() <= MaxDecompressedLength) {
+        compressed = qCompress(content, CompressionLevel);
+        if (compressed.size() < content.size()) {
+            payload = &compressed;
+            flags |= Compressed;
+        }
+    }
 #endif
-    dataStream << checksum;
 
-    return dataStream.status() == QDataStream::Ok;
-}
\ No newline at end of file
+    if (payload->size() > MaxContentLength) { // Validate message content size
+        qWarning() << "Message content size exceeds maximum allowed size of 1MiB";
+        return false;
+    }
+
+    if (protocolVersion != 1 && !checksumEnabled)
+        flags |= NoChecksum;
+
+    // Version 1 headers only have room for the low bits of the id, the
+    // primary identifies instances by their connection either way
+    const Header header{
+        protocolVersion,
+        static_cast<quint8>(type),
+        protocolVersion == 1 ? quint8(0) : flags,
+        protocolVersion == 1 ? quint32(0) : sequence,
+        instanceId,
+        payload->size()
+    };
+    FrameCodec::appendFrame(buffer, header, payload->constData());
+
+    return true;
+}
@@ -24,11 +24,62 @@
 #ifndef MESSAGE_CODER_H
 #define MESSAGE_CODER_H
 
+#include <atomic>
+
 #include <QByteArray>
-#include <QException>
+#include <QList>
 #include <QLocalSocket>
-#include <QDataStream>
+#include <QMutex>
+#include <QPointer>
 #include "singleapplication.h"
+#include "frame_codec.h"
+
+class MessageCoder;
+
+/**
+ * @brief Limit on the bytes several coders decoded that the receivers of
+ * their messages haven't released yet.
+ *
+ * Coders stop decoding while the budget is exhausted and are resumed once
+ * enough bytes were released. All functions are thread-safe.
+ */
+class FlowBudget {
+public:
+    /**
+     * @brief Sets the number of bytes that may be in flight, negative for no limit
+     */
+    void setLimit( qint64 bytes );
+
+    /**
+     * @brief Returns whether no more bytes may be decoded
+     */
+    bool isExhausted() const;
+
+    void acquire( qint64 bytes );
+    void release( qint64 bytes );
+
+    /**
+     * @brief Acquires bytes unless that exceeds the limit
+     * @return false if the bytes were not acquired
+     */
+    bool tryAcquire( qint64 bytes );
+
+    /**
+     * @brief Registers a coder to resume once bytes are released
+     */
+    void wait( MessageCoder *coder );
+
+    /**
+     * @brief Unregisters a coder, called before it is destroyed
+     */
+    void cancel( MessageCoder *coder );
+
+private:
+    std::atomic<qint64> used{ 0 };
+    std::atomic<qint64> limit{ -1 };
+    QMutex mutex;
+    QList<MessageCoder*> waiting;
+};
 
 class MessageCoder : public QObject {
 Q_OBJECT
@@ -41,18 +92,240 @@ public:
      * @param socket The QLocalSocket to be used for communication.
      */
     MessageCoder( QLocalSocket *socket );
+    ~MessageCoder() override;
+
+    /**
+     * @brief Number of bytes the primary instance's coders decode before
+     * giving the other connections served by their thread a turn.
+     */
+    static constexpr qint64 DecodeQuantum = FrameCodec::MaxContentLength;
 
     /**
-     * @brief Send a message on a QDataStream
+     * @brief Send a message on the socket
      * 
-     * Constructs and sends a message according to the protocol.
+     * Constructs the whole frame in a single buffer and writes it at once.
      * 
      * @param type The type of the message to be sent.
      * @param instanceId The ID of the instance sending the message.
      * @param content The content of the message to be sent.
+     * @param flags Frame flags, ignored with protocol version 1.
+     * @param sequence Sequence number of a `Sequenced` frame.
      * @return true if the message was sent successfully, false otherwise.
      */
-    bool sendMessage( SingleApplication::MessageType type, quint16 instanceId, QByteArray content );
+    bool sendMessage( SingleApplication::MessageType type, quint64 instanceId, QByteArray content, quint8 flags = 0, quint32 sequence = 0 );
+
+    /**
+     * @brief Send several messages on the socket in a single write
+     *
+     * With protocol version 2 all frames but the last are flagged as
+     * `Batched`, so the batch is acknowledged once.
+     *
+     * @param type The type of the messages to be sent.
+     * @param instanceId The ID of the instance sending the messages.
+     * @param contents The contents of the messages, in the order they should be delivered.
+     * @param flags Flags set on every frame.
+     * @return true if the messages were sent successfully, false otherwise.
+     */
+    bool sendMessages( SingleApplication::MessageType type, quint64 instanceId, const QList<QByteArray> &contents, quint8 flags = 0 );
+
+    /**
+     * @brief Writes frames encoded beforehand, such as a frame shared by
+     * several connections
+     * @return true if the frames were written successfully, false otherwise.
+     */
+    bool writeFrames( const QByteArray &frames );
+
+    /**
+     * @brief Writes frames encoded beforehand from any thread, unless the
+     * socket has too many bytes left to write
+     *
+     * The frames are written in the thread of the coder. Bytes posted count
+     * as unwritten from the call on, so concurrent calls share the limit.
+     *
+     * @param frames The frames to write.
+     * @param limit Bytes that may be left to write, the frames included.
+     * @return false if the limit would be exceeded and nothing was posted.
+     */
+    bool postFrames( const QByteArray &frames, qint64 limit );
+
+    /**
+     * @brief Returns the bytes written or posted that the socket didn't
+     * hand to the kernel yet. May be called from any thread.
+     */
+    qint64 bytesToWrite() const;
+
+    /**
+     * @brief Returns the bytes of the frames consumed from the socket, as
+     * they arrived. May be called from any thread.
+     */
+    qint64 bytesReceived() const;
+
+    /**
+     * @brief Emits the messages of a type as the whole frame they arrived in
+     *
+     * The content of such messages is a frame of the current protocol
+     * version, ready to be forwarded with writeFrames() or postFrames().
+     * Frames without other flags than `NoChecksum` are passed on verbatim,
+     * their checksum is left to the receiver. Others are decoded and
+     * encoded again without flags.
+     */
+    void setForwardedType( SingleApplication::MessageType type );
+
+    /**
+     * @brief Returns the protocol version used for sending frames.
+     */
+    quint32 negotiatedVersion() const;
+
+    /**
+     * @brief Returns the capabilities the peer announced in its handshake.
+     */
+    quint32 capabilities() const;
+
+    /**
+     * @brief Sets the protocol version used for sending frames.
+     *
+     * Frames of any supported version are always accepted when receiving.
+     * Defaults to 1 until the peers have negotiated a version.
+     */
+    void setProtocolVersion( quint32 version );
+
+    /**
+     * @brief Enables or disables checksums on sent frames.
+     *
+     * Only has an effect with protocol version 2 or higher. Received frames
+     * are validated whenever the sender included a checksum.
+     */
+    void setChecksumEnabled( bool enabled );
+
+    /**
+     * @brief Sets the content size from which sent frames are compressed.
+     *
+     * Compression is only used once the peer announced that it accepts
+     * compressed frames and only if it makes the frame smaller. It also
+     * allows sending content larger than FrameCodec::MaxContentLength as long as it
+     * compresses below it. A negative threshold disables compression.
+     */
+    void setCompressionThreshold( qint64 threshold );
+
+    /**
+     * @brief Content of the handshake frames announcing the highest protocol
+     * version and the capabilities supported by this peer.
+     */
+    static QByteArray handshake();
+
+    /**
+     * @brief Returns the capabilities announced in a handshake
+     */
+    static quint32 handshakeCapabilities( const QByteArray &handshake );
+
+    /**
+     * @brief Switches to the highest protocol version supported by both peers
+     * and enables the capabilities announced by the peer.
+     *
+     * @param handshake The handshake content received from the peer. Peers
+     * that send no handshake are assumed to only support version 1.
+     */
+    void negotiate( const QByteArray &handshake );
+
+    /**
+     * @brief Stops decoding frames until resume() is called.
+     *
+     * Undecoded data stays in the socket, so once its read buffer is full
+     * the sender is slowed down by the kernel. May be called from a slot
+     * connected to messageReceived() and from any thread.
+     */
+    void pause();
+
+    /**
+     * @brief Resumes decoding and processes the frames received meanwhile.
+     *
+     * Decodes synchronously when called from the thread of the coder, which
+     * must then not be from a slot connected to messageReceived(). Called
+     * from another thread, decoding resumes in the thread of the coder.
+     */
+    void resume();
+
+    /**
+     * @brief Returns whether decoding is paused.
+     */
+    bool isPaused() const;
+
+    /**
+     * @brief Limits the bytes of decoded messages not released yet
+     *
+     * Once a limit is reached decoding stops, undecoded data stays in the
+     * socket and the sender is slowed down by the kernel. It resumes once
+     * the receiver released enough bytes with release(). Messages still
+     * held once the coder is gone are released on the budget directly.
+     *
+     * @param limit Bytes this coder may have in flight, negative for no limit.
+     * @param budget Budget shared with other coders, or nullptr.
+     */
+    void setFlowControl( qint64 limit, FlowBudget *budget );
+
+    /**
+     * @brief Limits the bytes decoded before the other connections served
+     * by the same thread get a turn
+     *
+     * Only for coders whose thread runs an event loop, the rest of the data
+     * is decoded from a queued call. A coder read from blocking waits must
+     * decode everything the socket delivered, so it has no quantum by default.
+     *
+     * @param quantum Bytes decoded at once, negative for no limit.
+     */
+    void setDecodeQuantum( qint64 quantum );
+
+    /**
+     * @brief Hands compressed contents to compressedContentReceived()
+     * instead of decompressing them in the thread of the coder
+     *
+     * Decoding stops until completeDecompression() returned the content, so
+     * the messages of the connection keep their order.
+     */
+    void setDecompressionOffloaded( bool offloaded );
+
+    /**
+     * @brief Emits the message of the compressed content handed out last
+     * and resumes decoding. Called in the thread of the coder.
+     *
+     * @param content The decompressed content, empty if decompression failed.
+     */
+    void completeDecompression( QByteArray content );
+
+    /**
+     * @brief Accounts the bytes of a message held on behalf of the
+     * connection as if it was decoded, until they are released.
+     *
+     * May be called from any thread.
+     */
+    void acquire( qint64 bytes );
+
+    /**
+     * @brief Releases the bytes of messages the receiver is done with.
+     *
+     * May be called from any thread.
+     */
+    void release( qint64 bytes );
+
+    /**
+     * @brief Returns whether decoding is stopped by flow control.
+     */
+    bool isThrottled() const;
+
+    /**
+     * @brief Emits idle() once every complete frame received so far was
+     * decoded
+     *
+     * Frames held back because decoding is paused or throttled, or because
+     * the coder gave other connections a turn, are decoded first. May be
+     * called from any thread.
+     */
+    void notifyWhenIdle();
+
+    /**
+     * @brief Returns the bytes a message accounts for in flow control.
+     */
+    static qint64 footprint( const SingleApplication::Message &message );
 
 Q_SIGNALS:
     /**
@@ -62,17 +335,87 @@ Q_SIGNALS:
      */
     void messageReceived( SingleApplication::Message message );
 
+    /**
+     * @brief Signal emitted once no complete frame is left to decode after
+     * notifyWhenIdle() was called.
+     */
+    void idle();
+
+    /**
+     * @brief Signal emitted with the content of a compressed frame, which
+     * was validated but not decompressed, if decompression is offloaded.
+     */
+    void compressedContentReceived( QByteArray content );
+
 private Q_SLOTS:
     /**
      * @brief Slot to handle data availability.
      * 
-     * Reads data from the socket and processes it according to the protocol.
+     * Reads every complete frame from the socket with FrameCodec::peekFrame()
+     * and emits it once decompressed, or as a whole if it is forwarded.
      */
     void slotDataAvailable();
 
 private:
-    QLocalSocket *socket; ///< The QLocalSocket used for communication.
-    QDataStream dataStream; ///< The QDataStream used for reading and writing data.
+    /**
+     * @brief Appends a complete frame to a buffer
+     * @return false if the content exceeds the maximum size of a frame.
+     */
+    bool appendFrame( QByteArray &buffer, SingleApplication::MessageType type, quint64 instanceId, const QByteArray &content, quint8 flags, quint32 sequence ) const;
+
+    /**
+     * @brief Accounts a frame in flow control and emits its message
+     */
+    void emitMessage( const FrameCodec::Header &header, QByteArray content, qint64 &decoded );
+
+    /**
+     * @brief Encodes a decoded frame to forward again and emits its message
+     */
+    void emitDecoded( FrameCodec::Header header, QByteArray content, qint64 &decoded );
+
+    /**
+     * @brief Writes data to the socket, counting it as unwritten until the
+     * socket reports it written
+     */
+    bool write( const QByteArray &data );
+
+    /**
+     * @brief Returns whether a flow control limit is reached
+     */
+    bool isOverLimit() const;
+
+    /**
+     * @brief Stops decoding until bytes are released
+     * @return false if bytes were released meanwhile and decoding may go on
+     */
+    bool throttle();
+
+    /**
+     * @brief Resumes decoding stopped by flow control, if the limits allow it
+     * @return false if the coder is still throttled
+     */
+    bool wakeUp();
+
+    friend class FlowBudget;
+
+    QPointer<QLocalSocket> socket; ///< The QLocalSocket used for communication, null once it was deleted.
+    quint32 protocolVersion; ///< The protocol version used for sending frames.
+    bool checksumEnabled; ///< Whether sent frames carry a checksum.
+    quint32 peerCapabilities; ///< Capabilities announced by the peer.
+    qint64 compressionThreshold; ///< Content size from which sent frames are compressed.
+    std::atomic<bool> paused; ///< Whether decoding is paused.
+    std::atomic<bool> throttled; ///< Whether decoding is stopped by flow control.
+    std::atomic<bool> idleRequested; ///< Whether idle() is awaited.
+    std::atomic<qint64> inFlight; ///< Bytes decoded and not released yet.
+    std::atomic<qint64> inFlightLimit; ///< Bytes that may be in flight, negative for no limit.
+    FlowBudget *budget; ///< Budget shared with other coders.
+    std::atomic<qint64> decodeQuantum; ///< Bytes decoded at once, negative for no limit.
+    std::atomic<qint64> unwritten; ///< Bytes written or posted and not handed to the kernel yet.
+    std::atomic<qint64> received; ///< Bytes of the frames consumed from the socket.
+    bool decompressionOffloaded; ///< Whether compressed contents are decompressed elsewhere.
+    bool decompressing; ///< Whether a compressed content was handed out and not returned yet.
+    FrameCodec::Header compressedHeader; ///< Header of the content being decompressed elsewhere.
+    SingleApplication::MessageType forwardedType; ///< Type of the messages emitted as whole frames.
 };
 
 
@@ -0,0 +1,168 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/**
+ * @brief Unbounded lock-free queue with many producers and a single consumer
+ *
+ * Producers only exchange the head pointer, so pushing never blocks and
+ * never waits for the consumer. A push that is still in progress may not be
+ * visible to pop() yet, the producer is expected to notify the consumer after
+ * push() returns.
+ *
+ * Nodes freed by pop() are kept in a bounded ring of spare nodes which push()
+ * takes from, so a queue that never holds more than SpareNodes values stops
+ * allocating once it is warm. Only values beyond that cost a node allocation.
+ */
+template<typename T>
+class MpscQueue {
+public:
+    static constexpr std::size_t SpareNodes = 256; ///< Must be a power of two
+
+    MpscQueue() : head( new Node ), tail( head.load() ), spareIn( 0 ), spareOut( 0 )
+    {
+        static_assert(( SpareNodes & ( SpareNodes - 1 )) == 0, "SpareNodes must be a power of two" );
+        for( std::size_t i = 0; i < SpareNodes; ++i )
+            spares[i].sequence.store( i, std::memory_order_relaxed );
+    }
+
+    ~MpscQueue()
+    {
+        T value;
+        while( pop( value ));
+        delete tail;
+        while( Node *node = takeSpare() )
+            delete node;
+    }
+
+    MpscQueue( const MpscQueue & ) = delete;
+    MpscQueue &operator=( const MpscQueue & ) = delete;
+
+    /**
+     * @brief Appends a value, may be called from any thread
+     */
+    void push( T value )
+    {
+        Node *node = takeSpare();
+        if( node == nullptr )
+            node = new Node;
+        node->value = std::move( value );
+        node->next.store( nullptr, std::memory_order_relaxed );
+        Node *previous = head.exchange( node, std::memory_order_acq_rel );
+        previous->next.store( node, std::memory_order_release );
+    }
+
+    /**
+     * @brief Removes the oldest value, must only be called from the consumer
+     * @return false if the queue is empty
+     */
+    bool pop( T &value )
+    {
+        Node *next = tail->next.load( std::memory_order_acquire );
+        if( next == nullptr )
+            return false;
+
+        // The popped node becomes the new sentinel. The producer that linked
+        // it was done with the old one once its next pointer was visible.
+        value = std::move( next->value );
+        next->value = T();
+        recycle( tail );
+        tail = next;
+        return true;
+    }
+
+private:
+    struct Node {
+        Node() : next( nullptr ) {}
+
+        T value;
+        std::atomic<Node*> next;
+    };
+
+    // A slot of the spare ring, its sequence tells whose turn it is
+    struct Spare {
+        std::atomic<std::size_t> sequence;
+        Node *node;
+    };
+
+    // Returns a node to the ring or frees it when the ring is full. Only the
+    // consumer fills the ring, so the slot cannot be claimed meanwhile.
+    void recycle( Node *node )
+    {
+        const std::size_t position = spareIn.load( std::memory_order_relaxed );
+        Spare &spare = spares[position & ( SpareNodes - 1 )];
+        if( spare.sequence.load( std::memory_order_acquire ) != position ){
+            delete node;
+            return;
+        }
+        spare.node = node;
+        spareIn.store( position + 1, std::memory_order_relaxed );
+        spare.sequence.store( position + 1, std::memory_order_release );
+    }
+
+    // Takes a node out of the ring, may be called from any thread. Positions
+    // only ever grow, which rules out ABA between competing producers.
+    Node *takeSpare()
+    {
+        std::size_t position = spareOut.load( std::memory_order_relaxed );
+        for( ;; ){
+            Spare &spare = spares[position & ( SpareNodes - 1 )];
+            const std::size_t sequence = spare.sequence.load( std::memory_order_acquire );
+            if( sequence == position + 1 ){
+                if( spareOut.compare_exchange_weak( position, position + 1, std::memory_order_relaxed )){
+                    Node *node = spare.node;
+                    spare.sequence.store( position + SpareNodes, std::memory_order_release );
+                    return node;
+                }
+            } else if( sequence < position + 1 ){
+                return nullptr;
+            } else {
+                position = spareOut.load( std::memory_order_relaxed );
+            }
+        }
+    }
+
+    std::atomic<Node*> head;
+    Node *tail;
+    Spare spares[SpareNodes];
+    std::atomic<std::size_t> spareIn;
+    std::atomic<std::size_t> spareOut;
+};
+
+#endif // MPSCQUEUE_H
@@ -1,8 +1,32 @@
-// serverthread.cpp
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QElapsedTimer>
+
 #include "serverthread.h"
 
 ServerThread::ServerThread(const QString &serverName, QObject *parent)
-    : QThread(parent), m_serverName(serverName), m_server(nullptr), m_quit(false)
+    : QThread(parent), m_serverName(serverName), m_server(nullptr), m_worker(nullptr), m_socketOptions(QLocalServer::NoOptions), m_quit(false), m_started(false), m_listening(false)
 {
 }
 
@@ -14,48 +38,83 @@ ServerThread::~ServerThread()
 
 void ServerThread::run()
 {
-    m_server = new QLocalServer(nullptr);
-    
-    if (!m_server->listen(m_serverName)) {
-        emit error(m_server->errorString());
-        delete m_server;
-        return;
-    }
-    while (!m_quit) {
-        if (m_server->waitForNewConnection(100)) {
-            QLocalSocket *socket = m_server->nextPendingConnection();
-            if (socket) {
-                emit newConnection(socket);
-            } else {
-                emit error(m_server->errorString());
-            }
-        } else if (m_server->hasPendingConnections()) {
-            QLocalSocket *socket = m_server->nextPendingConnection();
-            if (socket) {
-                emit newConnection(socket);
-            } else {
-                emit error(m_server->errorString());
-            }
-        }
-
-        m_mutex.lock();
-        if (m_quit) {
-            m_mutex.unlock();
-            break;
-        }
-        m_mutex.unlock();
+    QLocalServer server;
+    server.setSocketOptions(m_socketOptions);
+    m_server = &server;
+
+    // Invoked in this thread, the server lives here
+    connect(&server, &QLocalServer::newConnection, &server, [this]() { acceptConnections(); });
+
+    const bool listening = server.listen(m_serverName);
+    QObject worker;
+
+    m_mutex.lock();
+    m_started = true;
+    m_listening = listening;
+    if (listening)
+        m_worker = &worker;
+    const bool quit = m_quit;
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    if (!listening) {
+        Q_EMIT error(server.errorString());
+    } else if (!quit) {
+        // Sleeps until a connection arrives or stop() quits the loop
+        exec();
     }
 
-    m_server->close();
-    delete m_server;
+    m_mutex.lock();
+    m_worker = nullptr;
+    m_mutex.unlock();
+
+    server.close();
+    m_server = nullptr;
 }
-    m_server->close();
-    delete m_server;
+
+void ServerThread::acceptConnections()
+{
+    while (QLocalSocket *socket = m_server->nextPendingConnection()) {
+        // Sockets can only be moved by the thread they live in, and they must
+        // live in the thread that reads them
+        socket->setParent(nullptr);
+        socket->moveToThread(thread());
+        Q_EMIT newConnection(socket);
+    }
 }
 
 void ServerThread::stop()
 {
     QMutexLocker locker(&m_mutex);
     m_quit = true;
-    m_condition.wakeOne();
-}
\ No newline at end of file
+    m_condition.wakeAll();
+
+    // Thread-safe, wakes the event loop of the thread through its dispatcher
+    quit();
+}
+
+void ServerThread::setSocketOptions(QLocalServer::SocketOptions options)
+{
+    m_socketOptions = options;
+}
+
+bool ServerThread::post(std::function<void()> work)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_worker == nullptr)
+        return false;
+    QMetaObject::invokeMethod(m_worker, std::move(work), Qt::QueuedConnection);
+    return true;
+}
+
+bool ServerThread::waitForListening(unsigned long timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker(&m_mutex);
+    while (!m_started && !m_quit && static_cast<unsigned long>(timer.elapsed()) < timeout)
+        m_condition.wait(&m_mutex, timeout - static_cast<unsigned long>(timer.elapsed()));
+
+    return m_listening;
+}
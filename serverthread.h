@@ -1,12 +1,40 @@
-// serverthread.h
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
 #ifndef SERVERTHREAD_H
 #define SERVERTHREAD_H
 
+#include <functional>
+
 #include <QThread>
 #include <QLocalServer>
+#include <QLocalSocket>
 #include <QMutex>
 #include <QWaitCondition>
 
+// Runs the QLocalServer of the primary instance in its own event loop, so it
+// sleeps until a secondary connects. Accepted sockets are handed over to the
+// thread the ServerThread object lives in.
 class ServerThread : public QThread
 {
     Q_OBJECT
@@ -16,18 +44,36 @@ public:
     ~ServerThread() override;
 
     void run() override;
+
+    // Quits the event loop, returns immediately
     void stop();
 
-signals:
+    // Must be called before start()
+    void setSocketOptions(QLocalServer::SocketOptions options);
+
+    // Blocks until the server either listens or failed to, returns whether it listens
+    bool waitForListening(unsigned long timeout);
+
+    // Runs work in this thread's event loop, returns false once it stopped
+    bool post(std::function<void()> work);
+
+Q_SIGNALS:
+    // The socket already lives in the thread of the ServerThread object
     void newConnection(QLocalSocket *socket);
     void error(const QString &errorString);
 
 private:
+    void acceptConnections();
+
     QString m_serverName;
     QLocalServer *m_server;
+    QObject *m_worker; // Context of the work posted, while the event loop runs
+    QLocalServer::SocketOptions m_socketOptions;
     QMutex m_mutex;
     QWaitCondition m_condition;
     bool m_quit;
+    bool m_started;
+    bool m_listening;
 };
 
-#endif // SERVERTHREAD_H
\ No newline at end of file
+#endif // SERVERTHREAD_H
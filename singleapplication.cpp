@@ -21,10 +21,14 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <QtCore/QDateTime>
 #include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
 #include <QtCore/QByteArray>
 #include <QtCore/QSharedMemory>
 #include <QtCore/QDebug>
+#include <QtCore/QtEndian>
+#include <QtCore/QThread>
 
 #include <error.h>
 
@@ -46,8 +50,9 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
     Q_D( SingleApplication );
 
     // Keep track of the initialization time of SingleApplication
-    QElapsedTimer time;
+    QElapsedTimer &time = d->startupTimer;
     time.start();
+    d->startupEpoch = QDateTime::currentMSecsSinceEpoch();
 
     // Store the current mode of the program
     d->options = options;
@@ -60,38 +65,46 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
     // block and QLocalServer
     d->genBlockServerName();
 
-//<<<<<<< v4.0
     while( time.elapsed() < timeout ){
+        // The instance holding the election lock is the primary. The lock is
+        // released by the kernel when the primary exits or crashes, so there
+        // is no need to wait for a dead primary to time out.
+        qint64 start = time.nsecsElapsed();
+        const bool locked = d->acquirePrimaryLock();
+        d->recordStartupPhase( "acquirePrimaryLock", start );
+
+        start = time.nsecsElapsed();
+        if( locked ){
+            const bool started = d->startPrimary( qMax<qint64>( timeout - time.elapsed(), 0 ));
+            d->recordStartupPhase( "startPrimary", start );
+            if( started ){
+                d->writeStartupTrace();
+                return;
+            }
+            d->releasePrimaryLock();
+
+            // A primary instance that doesn't take part in the election may
+            // still be listening, connect to it instead
+            start = time.nsecsElapsed();
+        }
+
         if( d->connectToPrimary( (timeout - time.elapsed()) * 2 / 3 )){
-            if( ! allowSecondary ) // If we are operating in single instance mode - terminate the program
+            d->recordStartupPhase( "connectToPrimary", start );
+            d->releasePrimaryLock();
+
+            if( ! allowSecondary ){ // If we are operating in single instance mode - terminate the program
+                d->writeStartupTrace();
                 ::exit( EXIT_SUCCESS );
-/*=======
-    // To mitigate QSharedMemory issues with large amount of processes
-    // attempting to attach at the same time
-    SingleApplicationPrivate::randomSleep();
-
-#ifdef Q_OS_UNIX
-    // By explicitly attaching it and then deleting it we make sure that the
-    // memory is deleted even after the process has crashed on Unix.
-#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
-    d->memory = new QSharedMemory( QNativeIpcKey( d->blockServerName ) );
-#else
-    d->memory = new QSharedMemory( d->blockServerName );
-#endif
-    d->memory->attach();
-    delete d->memory;
-#endif
-    // Guarantee thread safe behaviour with a shared memory block.
-#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
-    d->memory = new QSharedMemory( QNativeIpcKey( d->blockServerName ) );
-#else
-    d->memory = new QSharedMemory( d->blockServerName );
-#endif
->>>>>> master */
+            }
 
+            start = time.nsecsElapsed();
             d->notifySecondaryStart( timeout );
+            d->recordStartupPhase( "notifySecondaryStart", start );
+            d->writeStartupTrace();
             return;
         } else {
+            d->recordStartupPhase( "connectToPrimary", start );
+
             // Report unexpected errors
             switch( d->socket->error() ){
             case QLocalSocket::SocketAccessError:
@@ -101,18 +114,19 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
             case QLocalSocket::OperationError:
             case QLocalSocket::UnknownSocketError:
                 qCritical() << "SingleApplication:" << d->socket->errorString();
-                qDebug() << "SingleApplication:" << "Falling back to primary instance";
                 break;
             default:
                 break;
             }
-            // If No server is listening then this is a promoted to a primary instance.
-            if( d->startPrimary( timeout ))
-                return;
         }
+
+        // The primary instance holds the lock but doesn't listen yet. Only
+        // the lock holder may listen, so polling again soon can't contend.
+        QThread::msleep( 1 );
     }
 
-    qFatal( "SingleApplication: Did not manage to initialize within the allocated time1out." );
+    d->writeStartupTrace();
+    qFatal( "SingleApplication: Did not manage to initialize within the allocated timeout." );
 }
 
 SingleApplication::~SingleApplication()
@@ -121,6 +135,48 @@ SingleApplication::~SingleApplication()
     delete d;
 }
 
+/**
+ * Forwards a message to the primary instance without constructing the
+ * application, see SingleApplicationPrivate::forwardToPrimary().
+ * @param argc
+ * @param argv
+ * @param options The options the primary instance was started with
+ * @param message The message to send.
+ * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @param userData The user data the primary instance was started with
+ * @return true if the primary instance received the message, false otherwise.
+ */
+bool SingleApplication::forwardIfRunning( int &argc, char *argv[], Options options, const QByteArray &message, int timeout, const QString &userData )
+{
+#ifdef Q_OS_LINUX
+    if( argc < 1 ) return false;
+
+    // Without an application object its defaults are derived the way Qt does
+    QString applicationName = app_t::applicationName();
+    if( applicationName.isEmpty() ){
+        const char *separator = strrchr( argv[0], '/' );
+        applicationName = QString::fromLocal8Bit( separator ? separator + 1 : argv[0] );
+    }
+    const QString applicationFilePath = QFileInfo( QStringLiteral( "/proc/self/exe" )).canonicalFilePath();
+
+    QStringList appData;
+    if( ! userData.isEmpty() )
+        appData << userData;
+
+    const QString username = ( options & Mode::User ) ? SingleApplicationPrivate::getUsername() : QString();
+    const QString blockServerName = SingleApplicationPrivate::blockServerNameFor( options, appData, applicationName, applicationFilePath, username );
+    return SingleApplicationPrivate::forwardToPrimary( blockServerName, options, message, timeout );
+#else
+    Q_UNUSED( argc );
+    Q_UNUSED( argv );
+    Q_UNUSED( options );
+    Q_UNUSED( message );
+    Q_UNUSED( timeout );
+    Q_UNUSED( userData );
+    return false;
+#endif
+}
+
 /**
  * Checks if the current application instance is primary.
  * @return Returns true if the instance is primary, false otherwise.
@@ -128,7 +184,7 @@ SingleApplication::~SingleApplication()
 bool SingleApplication::isPrimary() const
 {
     Q_D( const SingleApplication );
-    return d->server != nullptr;
+    return d->serverThread != nullptr;
 }
 
 /**
@@ -138,7 +194,7 @@ bool SingleApplication::isPrimary() const
 bool SingleApplication::isSecondary() const
 {
     Q_D( const SingleApplication );
-    return d->server == nullptr;
+    return d->serverThread == nullptr;
 }
 
 /**
@@ -147,12 +203,23 @@ bool SingleApplication::isSecondary() const
  * only incremented afterwards.
  * @return Returns a unique instance id.
  */
-quint32 SingleApplication::instanceId() const
+quint64 SingleApplication::instanceId() const
 {
     Q_D( const SingleApplication );
     return d->instanceNumber;
 }
 
+/**
+ * Returns the instances known to the primary instance.
+ * @return Returns the primary instance first, then the secondary instances.
+ */
+QList<SingleApplication::InstanceInfo> SingleApplication::instances() const
+{
+    // Secondary instances ask the primary over the connection
+    Q_D( const SingleApplication );
+    return const_cast<SingleApplicationPrivate *>( d )->instances();
+}
+
 /**
  * Returns the OS PID (Process Identifier) of the process running the primary
  * instance. Especially useful when SingleApplication is coupled with OS.
@@ -161,8 +228,9 @@ quint32 SingleApplication::instanceId() const
  */
 qint64 SingleApplication::primaryPid() const
 {
+    // Querying the primary instance reads from the connection
     Q_D( const SingleApplication );
-    return d->primaryPid();
+    return const_cast<SingleApplicationPrivate *>( d )->primaryPid();
 }
 
 /**
@@ -172,7 +240,7 @@ qint64 SingleApplication::primaryPid() const
 QString SingleApplication::primaryUser() const
 {
     Q_D( const SingleApplication );
-    return d->primaryUser();
+    return const_cast<SingleApplicationPrivate *>( d )->primaryUser();
 }
 
 /**
@@ -184,25 +252,251 @@ QString SingleApplication::currentUser() const
     return SingleApplicationPrivate::getUsername();
 }
 
+/**
+ * Returns how long each phase of the constructor took.
+ * @return Returns the phases in the order they ran.
+ */
+QList<SingleApplication::StartupPhase> SingleApplication::startupTimings() const
+{
+    Q_D( const SingleApplication );
+    return d->startupPhases;
+}
+
 /**
  * Sends message to the Primary Instance.
  * @param message The message to send.
  * @param timeout the maximum timeout in milliseconds for blocking functions.
- * @param sendMode mode of operation
+ * @param priority The order of delivery among concurrent messages.
+ * @param timeToLive The milliseconds before the message expires, negative for never.
  * @return true if the message was received successfuly, false otherwise.
  */
-bool SingleApplication::sendMessage( const QByteArray &messageBody, int timeout )
+bool SingleApplication::sendMessage( const QByteArray &messageBody, int timeout, MessagePriority priority, int timeToLive )
+{
+    Q_D( SingleApplication );
+
+    // Nobody to connect to
+    if( isPrimary() ) return false;
+
+    return d->sendApplicationMessage( SingleApplication::MessageType::InstanceMessage, messageBody, timeout, priority, timeToLive );
+}
+
+/**
+ * Sends several messages to the Primary Instance with a single round trip.
+ * @param messages The messages to send.
+ * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @return true if the messages were received successfuly, false otherwise.
+ */
+bool SingleApplication::sendMessages( const QList<QByteArray> &messages, int timeout )
+{
+    Q_D( SingleApplication );
+
+    // Nobody to connect to
+    if( isPrimary() ) return false;
+
+    return d->sendApplicationMessages( SingleApplication::MessageType::InstanceMessage, messages, timeout );
+}
+
+bool SingleApplication::sendTypedMessage( quint32 typeId, const QByteArray &content, int timeout )
+{
+    Q_D( SingleApplication );
+
+    // Nobody to connect to
+    if( isPrimary() ) return false;
+
+    // Typed messages are prefixed with the id of their type
+    QByteArray message( sizeof( quint32 ) + content.size(), Qt::Uninitialized );
+    qToBigEndian<quint32>( typeId, message.data() );
+    memcpy( message.data() + sizeof( quint32 ), content.constData(), static_cast<size_t>( content.size() ));
+
+    return d->sendApplicationMessage( SingleApplication::MessageType::TypedMessage, message, timeout );
+}
+
+void SingleApplication::setTypedMessageHandler( quint32 typeId, std::function<void( quint64, const QByteArray & )> handler )
+{
+    Q_D( SingleApplication );
+    d->typedMessageHandlers.insert( typeId, std::move( handler ));
+}
+
+/**
+ * Sends a message to a Secondary Instance.
+ * @param instanceId The id of the secondary instance.
+ * @param message The message to send.
+ * @return true if the message was queued for sending, false otherwise.
+ */
+bool SingleApplication::sendToInstance( quint64 instanceId, const QByteArray &message )
+{
+    Q_D( SingleApplication );
+
+    // Only the primary instance is connected to the others
+    if( isSecondary() ) return false;
+
+    return d->sendToInstance( instanceId, message );
+}
+
+/**
+ * Sends a message to every Secondary Instance.
+ * @param message The message to send.
+ * @return The number of secondary instances the message was queued for.
+ */
+int SingleApplication::broadcast( const QByteArray &message )
+{
+    Q_D( SingleApplication );
+
+    if( isSecondary() ) return 0;
+
+    return d->broadcast( message );
+}
+
+/**
+ * Subscribes to the messages published on a topic.
+ * @param topic The name of the topic.
+ * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @return true if the subscription was sent or recorded, false otherwise.
+ */
+bool SingleApplication::subscribe( const QString &topic, int timeout )
+{
+    Q_D( SingleApplication );
+    return d->setSubscribed( topic, true, timeout );
+}
+
+/**
+ * Cancels the subscription to a topic.
+ * @param topic The name of the topic.
+ * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @return true if the cancellation was sent or recorded, false otherwise.
+ */
+bool SingleApplication::unsubscribe( const QString &topic, int timeout )
+{
+    Q_D( SingleApplication );
+    return d->setSubscribed( topic, false, timeout );
+}
+
+/**
+ * Publishes a message on a topic.
+ * @param topic The name of the topic.
+ * @param message The message to publish.
+ * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @return true if the message was sent or routed, false otherwise.
+ */
+bool SingleApplication::publish( const QString &topic, const QByteArray &message, int timeout )
+{
+    Q_D( SingleApplication );
+    return d->publish( topic, message, timeout );
+}
+
+/**
+ * Posts a message to the Primary Instance without waiting for a round trip.
+ * @param message The message to send.
+ * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @return true if the message was queued for sending, false otherwise.
+ */
+bool SingleApplication::postMessage( const QByteArray &message, int timeout )
 {
     Q_D( SingleApplication );
 
     // Nobody to connect to
     if( isPrimary() ) return false;
 
-//    SingleApplicationMessage message( SingleApplicationMessage::NewInstance, 0, messageBody );
-//    return d->sendApplicationMessage( message , timeout );
+    return d->postApplicationMessage( message, timeout );
+}
+
+/**
+ * Waits for the acknowledgement of all messages posted to the Primary Instance.
+ * @param timeout the maximum timeout in milliseconds.
+ * @return true if all posted messages were acknowledged, false otherwise.
+ */
+bool SingleApplication::flushMessages( int timeout )
+{
+    Q_D( SingleApplication );
+
+    if( isPrimary() ) return false;
+
+    return d->waitForPostedMessages( 0, timeout );
+}
+
+void SingleApplication::setMessageWindow( int messages )
+{
+    Q_D( SingleApplication );
+    d->messageWindow = qMax( messages, 1 );
+}
+
+int SingleApplication::messageWindow() const
+{
+    Q_D( const SingleApplication );
+    return d->messageWindow;
+}
+
+void SingleApplication::setCompressionThreshold( qint64 bytes )
+{
+    Q_D( SingleApplication );
+    d->setCompressionThreshold( bytes );
+}
+
+/**
+ * Sets how many threads decode the messages of secondary instances.
+ * @param threads The number of I/O threads, 0 to decode on the main thread.
+ */
+void SingleApplication::setIoThreadCount( int threads )
+{
+    Q_D( SingleApplication );
+    d->setIoThreadCount( threads );
+}
+
+/**
+ * Limits the memory held by messages received and not yet dispatched.
+ * @param connectionBytes The limit of each connection, negative for none.
+ * @param totalBytes The limit of all connections together, negative for none.
+ */
+void SingleApplication::setFlowControlLimits( qint64 connectionBytes, qint64 totalBytes )
+{
+    Q_D( SingleApplication );
+    d->setFlowControlLimits( connectionBytes, totalBytes );
+}
+
+/**
+ * Pings secondary instances that were silent for the given time.
+ * @param msecs The interval of the checks, 0 to disable them.
+ */
+void SingleApplication::setHeartbeatInterval( int msecs )
+{
+    Q_D( SingleApplication );
+    d->setHeartbeatInterval( msecs );
+}
+
+/**
+ * Returns the interval of the checks of secondary instances.
+ */
+int SingleApplication::heartbeatInterval() const
+{
+    Q_D( const SingleApplication );
+    return d->heartbeatInterval;
+}
+
+/**
+ * Returns how many threads decode the messages of secondary instances.
+ */
+int SingleApplication::ioThreadCount() const
+{
+    Q_D( const SingleApplication );
+    return d->ioThreadCount;
+}
+
+/**
+ * Streams data of arbitrary size to the Primary Instance.
+ * @param device The device to read the data from.
+ * @param timeout the maximum timeout in milliseconds for each blocking step.
+ * @return true if the primary instance received the whole stream, false otherwise.
+ */
+bool SingleApplication::sendStream( QIODevice *device, int timeout )
+{
+    Q_D( SingleApplication );
+
+    // Nobody to connect to
+    if( isPrimary() ) return false;
 
+    if( device == nullptr || ! device->isReadable() ) return false;
 
-    return d->sendApplicationMessage( SingleApplication::MessageType::InstanceMessage, messageBody, timeout );
+    return d->sendApplicationStream( device, timeout );
 }
 
 QStringList SingleApplication::userData() const
@@ -24,6 +24,10 @@
 #ifndef SINGLE_APPLICATION_H
 #define SINGLE_APPLICATION_H
 
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
 #include <QtCore/QtGlobal>
 #include <QtNetwork/QLocalSocket>
 
@@ -35,6 +39,51 @@
 
 class SingleApplicationPrivate;
 
+/**
+ * @brief Registry of the types sent with `SingleApplication::sendTyped()`
+ *
+ * Each type has to be registered with a unique id, which identifies it on
+ * the wire, using `SINGLEAPPLICATION_MESSAGE_TYPE( Type, id )`.
+ */
+template<typename T>
+struct SingleApplicationMessageType;
+
+/**
+ * @brief Registers a type for typed messages under a unique id
+ * @note Use it at global scope, like `Q_DECLARE_METATYPE()`
+ */
+#define SINGLEAPPLICATION_MESSAGE_TYPE( Type, Id ) \
+    template<> \
+    struct SingleApplicationMessageType<Type> { \
+        static constexpr quint32 id = Id; \
+    };
+
+/**
+ * @brief Serializer of the types sent with `SingleApplication::sendTyped()`
+ *
+ * Trivially copyable types are copied as they are. Both instances usually
+ * run the same executable, so they share the memory layout of these types.
+ * Other types need a specialization providing the same two functions.
+ */
+template<typename T>
+struct SingleApplicationMessageCodec {
+    static_assert( std::is_trivially_copyable<T>::value,
+        "Typed messages need to be trivially copyable or have a SingleApplicationMessageCodec specialization" );
+
+    static QByteArray encode( const T &value )
+    {
+        return QByteArray( reinterpret_cast<const char *>( &value ), sizeof( T ));
+    }
+
+    static bool decode( const QByteArray &content, T &value )
+    {
+        if( content.size() != static_cast<int>( sizeof( T )))
+            return false;
+        memcpy( static_cast<void *>( &value ), content.constData(), sizeof( T ));
+        return true;
+    }
+};
+
 /**
  * @brief Handles multiple instances of the same
  * Application
@@ -47,18 +96,44 @@ class SingleApplication : public QAPPLICATION_CLASS
     using app_t = QAPPLICATION_CLASS;
 
 public:
-    // If you change this enum, make sure to update read validation code in message_decoder.cpp
+    // New message types have to be added before MessageTypeCount
     enum MessageType : quint8 {
         Acknowledge,
         NewInstance,
         InstanceMessage,
+        StreamData,
+        StreamEnd,
+        TypedMessage,
+        PrimaryPidRequest,
+        PrimaryUserRequest,
+        Ping,
+        Pong,
+        InstancesRequest,
+        Subscribe,
+        Unsubscribe,
+        Publish,
+        MessageTypeCount
     };
     Q_ENUM( MessageType )
 
+    /**
+     * @brief Order in which the primary instance delivers messages that
+     * arrived at the same time. Replies to the instances, such as
+     * acknowledgements, always take precedence.
+     */
+    enum class MessagePriority : quint8 {
+        Low,
+        Normal,
+        High
+    };
+    Q_ENUM( MessagePriority )
+
     struct Message {
         MessageType type;
-        quint16 instanceId;
+        quint64 instanceId;
         QByteArray content;
+        quint8 flags;
+        quint32 sequence;
     };
 
     /**
@@ -86,7 +161,21 @@ public:
         /**
          * Excludes the application path from the server name (and memory block) hash
          */
-        ExcludeAppPath = 1 << 4
+        ExcludeAppPath = 1 << 4,
+        /**
+         * Omits the checksum of messages once both instances support protocol
+         * version 2. Local sockets are a reliable transport, so this only
+         * gives up protection against buggy peers. Has no effect outside Unix.
+         */
+        SkipChecksum = 1 << 5,
+        /**
+         * Binds the server in the Linux abstract socket namespace instead of
+         * the file system, so it disappears with the process and never goes
+         * stale. Such sockets have no file permissions, in `User` mode
+         * connections from other users are rejected. Requires Qt 6.2 and has
+         * no effect on other systems.
+         */
+        AbstractNamespace = 1 << 6
     };
     Q_DECLARE_FLAGS(Options, Mode)
 
@@ -113,6 +202,65 @@ public:
     explicit SingleApplication( int &argc, char *argv[], bool allowSecondary = false, Options options = Mode::User, int timeout = 1000, const QString &userData = {} );
     ~SingleApplication() override;
 
+    /**
+     * @brief Time spent in one phase of the constructor
+     */
+    struct StartupPhase {
+        /** Name of the phase, such as `connectToPrimary` */
+        QString name;
+        /** Start of the phase in nanoseconds since the constructor was entered */
+        qint64 start;
+        /** Duration of the phase in nanoseconds */
+        qint64 duration;
+    };
+
+    /**
+     * @brief An instance known to the primary instance
+     */
+    struct InstanceInfo {
+        /** Id of the instance, 0 for the primary instance */
+        quint64 id;
+        /** Process id of the instance, -1 if unknown */
+        qint64 pid;
+        /** User running the instance, empty if unknown */
+        QString user;
+        /** Time the instance started or connected, in milliseconds since the epoch */
+        qint64 startTime;
+        /** Bytes of the frames the instance sent to the primary instance, as they arrived */
+        qint64 bytesSent;
+        /** Time of the last message of the instance, in milliseconds since the epoch */
+        qint64 lastSeen;
+    };
+
+    /**
+     * @brief Forwards a message to a running primary instance before the
+     * application object is constructed
+     * @arg argc - Number of arguments in argv
+     * @arg argv - Supplied command line arguments
+     * @arg options - The options the primary instance was started with
+     * @arg message - Data to deliver to the primary instance, which receives
+     * it with `receivedMessage()` after emitting `instanceStarted()`
+     * @arg timeout - Timeout to wait in milliseconds.
+     * @arg userData - The user data the primary instance was started with
+     * @returns `true` if the primary instance received the message, in which
+     * case the process can exit without constructing `QAPPLICATION_CLASS`
+     * @note Call it first thing in `main()`, after setting the application
+     * and organization names and the application version if they are used.
+     * @note Only implemented on Linux, returns `false` on other systems and
+     * whenever the fast path fails, the constructor then proceeds as usual.
+     */
+    static bool forwardIfRunning( int &argc, char *argv[], Options options = Mode::User, const QByteArray &message = QByteArray(), int timeout = 1000, const QString &userData = {} );
+
+    /**
+     * @brief Returns how long each phase of the constructor took
+     * @returns The phases in the order they ran, phases that are retried
+     * while waiting for the primary instance appear several times
+     * @note Set the `SINGLEAPPLICATION_TRACE` environment variable to a file
+     * name to also have them written as a Chrome trace, viewable in Perfetto.
+     * `%p` in the file name is replaced with the process id.
+     */
+    QList<StartupPhase> startupTimings() const;
+
     /**
      * @brief Checks if the instance is primary instance
      * @returns `true` if the instance is primary
@@ -127,19 +275,30 @@ public:
 
     /**
      * @brief Returns a unique identifier for the current instance
-     * @returns instance id
+     * @returns instance id, 0 for the primary instance
+     * @note Ids are assigned by the primary instance as secondary instances
+     * connect and are never reused while it runs.
+     */
+    quint64 instanceId() const;
+
+    /**
+     * @brief Returns the primary instance and the secondary instances
+     * connected to it
+     * @note Secondary instances ask the primary instance, which takes a
+     * round trip and returns an empty list if it didn't reply within a second.
      */
-    quint32 instanceId() const;
+    QList<InstanceInfo> instances() const;
 
     /**
      * @brief Returns the process ID (PID) of the primary instance
-     * @returns pid
+     * @returns pid, or -1 if the primary instance didn't reply within a second
      */
     qint64 primaryPid() const;
 
     /**
      * @brief Returns the username of the user running the primary instance
-     * @returns user name
+     * @returns user name, or an empty string if the primary instance didn't
+     * reply within a second
      */
     QString primaryUser() const;
 
@@ -153,11 +312,218 @@ public:
      * @brief Sends a message to the primary instance
      * @param message data to send
      * @param timeout timeout for connecting
-     * @param sendMode - Mode of operation
-     * @returns `true` on success
+     * @param priority order of delivery among the messages the primary
+     * instance received at the same time
+     * @param timeToLive milliseconds after which the primary instance drops
+     * the message instead of delivering it, or a negative value if it never
+     * expires
+     * @returns `true` on success, `false` if the message expired, which the
+     * primary instance reports as soon as it dropped the message
+     * @note The priority and the expiry are ignored by primary instances of
+     * older versions, which deliver the message normally.
      * @note sendMessage() will return false if invoked from the primary instance
      */
-    bool sendMessage( const QByteArray &message, int timeout = 100 );
+    bool sendMessage( const QByteArray &message, int timeout = 100, MessagePriority priority = MessagePriority::Normal, int timeToLive = -1 );
+
+    /**
+     * @brief Sends several messages to the primary instance at once
+     * @param messages data to send, in the order it should be received
+     * @param timeout timeout for connecting and for the acknowledgement
+     * @returns `true` on success
+     * @note The messages are written together and acknowledged once, so
+     * sending a batch takes a single round trip. The primary instance emits
+     * `receivedMessage()` for each of them in order.
+     * @note sendMessages() will return false if invoked from the primary instance
+     */
+    bool sendMessages( const QList<QByteArray> &messages, int timeout = 100 );
+
+    /**
+     * @brief Sends a typed message to the primary instance
+     * @param value the value to send. Its type has to be registered with
+     * `SINGLEAPPLICATION_MESSAGE_TYPE()`.
+     * @param timeout timeout for connecting
+     * @returns `true` on success
+     * @note The primary instance delivers the value to the handler
+     * registered for its type with `onMessage()`, not to `receivedMessage()`.
+     * @note sendTyped() will return false if invoked from the primary instance
+     */
+    template<typename T>
+    bool sendTyped( const T &value, int timeout = 100 )
+    {
+        return sendTypedMessage( SingleApplicationMessageType<T>::id, SingleApplicationMessageCodec<T>::encode( value ), timeout );
+    }
+
+    /**
+     * @brief Sets the handler of the typed messages of type `T` sent by
+     * secondary instances with `sendTyped()`
+     * @param handler callable invoked as `handler( quint64 instanceId, const T &value )`
+     * @note Handlers are looked up by the id of the type in constant time.
+     * Setting a handler replaces the previous handler of the same type.
+     */
+    template<typename T, typename Handler>
+    void onMessage( Handler handler )
+    {
+        setTypedMessageHandler( SingleApplicationMessageType<T>::id,
+            [handler]( quint64 instanceId, const QByteArray &content ){
+                T value;
+                if( SingleApplicationMessageCodec<T>::decode( content, value ))
+                    handler( instanceId, value );
+            }
+        );
+    }
+
+    /**
+     * @brief Sends a message from the primary instance to a secondary instance
+     * @param instanceId id of the secondary instance, see `instances()`
+     * @param message data to send, up to 1 MiB
+     * @returns `true` if the message was queued for sending, `false` if the
+     * instance isn't connected, doesn't accept messages or has too many
+     * messages left to read, or if invoked from a secondary instance
+     * @note The secondary instance receives it with `receivedMessage()`
+     * once its event loop runs. Messages are not acknowledged.
+     */
+    bool sendToInstance( quint64 instanceId, const QByteArray &message );
+
+    /**
+     * @brief Sends a message from the primary instance to every connected
+     * secondary instance
+     * @param message data to send, up to 1 MiB
+     * @returns the number of secondary instances the message was queued for
+     * @note The message is encoded once and the same buffer is written to
+     * every connection. Secondary instances with too many messages left to
+     * read are skipped.
+     */
+    int broadcast( const QByteArray &message );
+
+    /**
+     * @brief Subscribes this instance to the messages published on a topic
+     * @param topic name of the topic
+     * @param timeout timeout for connecting and sending, in milliseconds
+     * @returns `true` on success, `false` if the primary instance doesn't
+     * support topics
+     * @note Messages of the topic are received with `receivedTopicMessage()`.
+     */
+    bool subscribe( const QString &topic, int timeout = 100 );
+
+    /**
+     * @brief Stops receiving the messages published on a topic
+     */
+    bool unsubscribe( const QString &topic, int timeout = 100 );
+
+    /**
+     * @brief Publishes a message to every instance subscribed to a topic
+     * @param topic name of the topic
+     * @param message data to send, the topic and the data together up to 1 MiB
+     * @param timeout timeout for connecting and sending, in milliseconds
+     * @returns `true` if the message was handed to the primary instance, or
+     * routed if invoked from it
+     * @note The primary instance routes the message to the subscribers,
+     * including the publisher if it subscribed, without looking at the data.
+     * Messages are not acknowledged, and dropped for subscribers with too
+     * many messages left to read.
+     */
+    bool publish( const QString &topic, const QByteArray &message, int timeout = 100 );
+
+    /**
+     * @brief Posts a message to the primary instance without waiting for it
+     * to be acknowledged
+     * @param message data to send
+     * @param timeout timeout for connecting and for waiting while the
+     * message window is full
+     * @returns `true` if the message was queued for sending
+     * @note Posted messages are numbered and acknowledged cumulatively by the
+     * primary instance, so many of them can be in flight at once. Messages
+     * the primary instance reports as lost are sent again, which is the only
+     * case in which they may be received out of order.
+     * @note If the primary instance only supports protocol version 1 this
+     * behaves like sendMessage().
+     * @see setMessageWindow(), flushMessages()
+     */
+    bool postMessage( const QByteArray &message, int timeout = 100 );
+
+    /**
+     * @brief Blocks until all posted messages have been acknowledged
+     * @param timeout maximum time to wait in milliseconds
+     * @returns `true` if no posted message awaits an acknowledgement
+     */
+    bool flushMessages( int timeout = 100 );
+
+    /**
+     * @brief Sets how many posted messages may await an acknowledgement
+     * before postMessage() blocks. Defaults to 64.
+     */
+    void setMessageWindow( int messages );
+
+    /**
+     * @brief Returns how many posted messages may await an acknowledgement
+     */
+    int messageWindow() const;
+
+    /**
+     * @brief Compresses messages of at least the given size before sending them
+     * @param bytes minimum size of a message to be compressed, or a negative
+     * value to disable compression, which is the default
+     * @note Messages are only compressed if the receiving instance supports
+     * it, and only if that makes them smaller. A message that compresses
+     * below 1 MiB may be larger than 1 MiB, up to 64 MiB. The primary
+     * instance never decompresses them on the main thread.
+     */
+    void setCompressionThreshold( qint64 bytes );
+
+    /**
+     * @brief Sets how many threads decode the messages of secondary instances
+     * @param threads number of I/O threads, 0 by default
+     * @note With 0 the messages are decoded on the main thread, compressed
+     * messages are decompressed on the thread of the server. Otherwise
+     * connections are distributed over the I/O threads, which read, decode
+     * and validate the frames, and only complete messages are delivered to
+     * the main thread. Signals are still emitted on the main thread.
+     * @note Applies to connections accepted afterwards.
+     */
+    void setIoThreadCount( int threads );
+
+    /**
+     * @brief Returns how many threads decode the messages of secondary instances
+     */
+    int ioThreadCount() const;
+
+    /**
+     * @brief Limits the memory held by messages received and not yet dispatched
+     * @param connectionBytes bytes each connection may hold, 8 MiB by default
+     * @param totalBytes bytes all connections may hold together, 64 MiB by default
+     * @note Once a limit is reached the primary instance stops reading from
+     * the affected connections until the event loop dispatched their
+     * messages, and the senders block in the kernel meanwhile. A negative
+     * value disables the limit.
+     */
+    void setFlowControlLimits( qint64 connectionBytes, qint64 totalBytes );
+
+    /**
+     * @brief Checks that secondary instances connected to the primary are alive
+     * @param msecs time after which a silent secondary instance is pinged,
+     * or 0 to disable the checks, which is the default
+     * @note A secondary instance that doesn't answer within the same time
+     * again, because it exited or its event loop hangs, is disconnected.
+     * Only secondary instances of this version or later are checked.
+     */
+    void setHeartbeatInterval( int msecs );
+
+    /**
+     * @brief Returns the time after which a silent secondary instance is pinged
+     */
+    int heartbeatInterval() const;
+
+    /**
+     * @brief Streams the contents of a device to the primary instance
+     * @param device device to read the data from, until its end
+     * @param timeout maximum time in milliseconds any single step may block
+     * while connecting, reading from the device or writing to the primary
+     * @returns `true` once the primary instance acknowledged the end of the stream
+     * @note Unlike sendMessage() the size of the data is not limited. At most
+     * a few chunks of it are held in memory at any time on either side.
+     * @note sendStream() will return false if invoked from the primary instance
+     */
+    bool sendStream( QIODevice *device, int timeout = 1000 );
 
     /**
      * @brief Get the set user data.
@@ -174,14 +540,63 @@ Q_SIGNALS:
 
     /**
      * @brief Triggered whenever there is a message received from a secondary instance
+     * @note Secondary instances receive the messages of the primary instance,
+     * sent with `sendToInstance()` or `broadcast()`, with the id 0.
+     */
+    void receivedMessage( quint64 instanceId, QByteArray message );
+
+    /**
+     * @brief Triggered with every message received from secondary instances
+     * since the last emission, in the order they were received
+     * @note Emitted after `receivedMessage()` was emitted for each of them,
+     * connect to only one of the two. Costs nothing while not connected.
+     */
+    void receivedMessages( QList<SingleApplication::Message> messages );
+
+    /**
+     * @brief Triggered instead of `receivedMessage()` for large messages
+     * that a secondary instance handed over in shared memory
+     *
+     * Only available on Linux. `message` refers directly to memory mapped
+     * from the secondary instance and is only valid until the slot returns,
+     * so it must be connected with a direct connection and copied with
+     * `QByteArray( message.constData(), message.size() )` to be kept.
+     * If nothing is connected to this signal, large messages are copied once
+     * and delivered with `receivedMessage()`. The copy counts against the
+     * flow control limits until it was delivered, see `setFlowControlLimits()`.
+     * While they are reached, content small enough to be sent inline is
+     * rejected and the secondary instance sends it inline instead.
      */
-    void receivedMessage( quint32 instanceId, QByteArray message );
+    void receivedSharedMessage( quint64 instanceId, QByteArray message );
+
+    /**
+     * @brief Triggered when a secondary instance starts streaming data with
+     * `sendStream()`
+     *
+     * The data can be read incrementally from `stream` as it arrives, which
+     * emits `readyRead()` and finally `readChannelFinished()`. The sender is
+     * held back while the data is not read. The device is deleted
+     * automatically once it has been read to the end. It may also be deleted
+     * earlier to discard the rest of the stream. Streams that start while
+     * nothing is connected to this signal are discarded.
+     */
+    void receivedStream( quint64 instanceId, QIODevice *stream );
+
+    /**
+     * @brief Triggered with every message published on a topic this instance
+     * subscribed to
+     */
+    void receivedTopicMessage( QString topic, QByteArray message );
 
 private:
+    bool sendTypedMessage( quint32 typeId, const QByteArray &content, int timeout );
+    void setTypedMessageHandler( quint32 typeId, std::function<void( quint64, const QByteArray & )> handler );
+
     SingleApplicationPrivate *d_ptr;
     Q_DECLARE_PRIVATE(SingleApplication)
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(SingleApplication::Options)
+Q_DECLARE_METATYPE(SingleApplication::Message)
 
 #endif // SINGLE_APPLICATION_H
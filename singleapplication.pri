@@ -4,10 +4,22 @@ CONFIG += c++11
 HEADERS += $$PWD/SingleApplication \
     $$PWD/singleapplication.h \
     $$PWD/singleapplication_p.h \
-    $$PWD/singleapplicationmessage.h
+    $$PWD/message_coder.h \
+    $$PWD/frame_codec.h \
+    $$PWD/serverthread.h \
+    $$PWD/crc32c.h \
+    $$PWD/streamdevice.h \
+    $$PWD/memfdpayload.h \
+    $$PWD/mpscqueue.h \
+    $$PWD/slabtable.h \
+    $$PWD/timerwheel.h
 SOURCES += $$PWD/singleapplication.cpp \
     $$PWD/singleapplication_p.cpp \
-    $$PWD/singleapplicationmessage.cpp
+    $$PWD/message_coder.cpp \
+    $$PWD/serverthread.cpp \
+    $$PWD/crc32c.cpp \
+    $$PWD/streamdevice.cpp \
+    $$PWD/memfdpayload.cpp
 
 INCLUDEPATH += $$PWD
 
@@ -32,30 +32,40 @@
 
 #include <cstdlib>
 #include <cstddef>
+#include <algorithm>
+#include <limits>
 
 #include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
 #include <QtCore/QThread>
 #include <QtCore/QByteArray>
 #include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
 #include <QtCore/QElapsedTimer>
+#include <QtCore/QMetaMethod>
+#include <QtCore/QtEndian>
 #include <QtCore/QCryptographicHash>
 #include <QtNetwork/QLocalServer>
 #include <QtNetwork/QLocalSocket>
 
 #include "message_coder.h"
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
-#include <QtCore/QRandomGenerator>
-#else
-#include <QtCore/QDateTime>
-#endif
-
 #include "singleapplication.h"
 #include "singleapplication_p.h"
 
 #ifdef Q_OS_UNIX
+    #include <fcntl.h>
     #include <unistd.h>
+    #include <sys/file.h>
     #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
+    #include <cerrno>
     #include <pwd.h>
 #endif
 
@@ -67,8 +77,11 @@
 #endif
 
 SingleApplicationPrivate::SingleApplicationPrivate( SingleApplication *q_ptr )
-    : q_ptr( q_ptr ), server( nullptr ), socket( nullptr ), instanceNumber( 0 ), connectionMap(), serverThread( nullptr )
+    : q_ptr( q_ptr ), socket( nullptr ), coder( nullptr ), server( nullptr ), serverThread( nullptr ), instanceNumber( 0 )
 {
+    // Messages decoded by I/O threads are queued to the main thread
+    qRegisterMetaType<SingleApplication::Message>();
+    flowBudget.setLimit( totalFlowLimit );
 }
 
 SingleApplicationPrivate::~SingleApplicationPrivate()
@@ -79,6 +92,31 @@ SingleApplicationPrivate::~SingleApplicationPrivate()
         delete serverThread;
     }
 
+    // Connections owned by I/O threads are deleted by them before they
+    // finish, the others right away
+    std::vector<ConnectionHandle> handles;
+    connections.forEach( [this, &handles]( ConnectionHandle connection, ConnectionInfo &info ){
+        if( info.socket->thread() == thread() ){
+            handles.push_back( connection );
+            return;
+        }
+        info.socket->deleteLater();
+        info.coder->deleteLater();
+    });
+    for( ConnectionHandle connection : handles ){
+        QLocalSocket *connectionSocket = connections.find( connection )->socket;
+        removeConnection( connection );
+        delete connectionSocket;
+    }
+    for( QThread *ioThread : ioThreads ){
+        ioThread->quit();
+        ioThread->wait();
+        delete ioThread;
+    }
+
+    delete coder;
+    releasePrimaryLock();
+
     if( socket != nullptr ){
         socket->close();
         delete socket;
@@ -117,6 +155,27 @@ QString SingleApplicationPrivate::getUsername()
 }
 
 void SingleApplicationPrivate::genBlockServerName()
+{
+    // Resolving the user name may query NSS, which is worth its own phase
+    qint64 start = startupTimer.nsecsElapsed();
+    QString username;
+    if( options & SingleApplication::Mode::User ){
+        username = getUsername();
+        recordStartupPhase( "getUsername", start );
+    }
+
+    start = startupTimer.nsecsElapsed();
+    blockServerName = blockServerNameFor( options, appDataList, SingleApplication::app_t::applicationName(), SingleApplication::app_t::applicationFilePath(), username );
+    recordStartupPhase( "genBlockServerName", start );
+}
+
+/**
+ * @brief Computes the name of the server of the primary instance
+ *
+ * Doesn't need the application object, the values it derives from the
+ * process are passed in. The user name is only used in `User` mode.
+ */
+QString SingleApplicationPrivate::blockServerNameFor( SingleApplication::Options options, const QStringList &appDataList, const QString &applicationName, const QString &applicationFilePath, const QString &username )
 {
 #ifdef Q_OS_MACOS
     // Maximum key size on macOS is PSHMNAMLEN (31).
@@ -129,7 +188,7 @@ void SingleApplicationPrivate::genBlockServerName()
 #else
     appData.addData( QByteArrayView{"SingleApplication"} );
 #endif
-    appData.addData( SingleApplication::app_t::applicationName().toUtf8() );
+    appData.addData( applicationName.toUtf8() );
     appData.addData( SingleApplication::app_t::organizationName().toUtf8() );
     appData.addData( SingleApplication::app_t::organizationDomain().toUtf8() );
 
@@ -142,54 +201,344 @@ void SingleApplicationPrivate::genBlockServerName()
 
     if( ! (options & SingleApplication::Mode::ExcludeAppPath) ){
 #if defined(Q_OS_WIN)
-        appData.addData( SingleApplication::app_t::applicationFilePath().toLower().toUtf8() );
+        appData.addData( applicationFilePath.toLower().toUtf8() );
 #elif defined(Q_OS_LINUX)
         // If the application is running as an AppImage then the APPIMAGE env var should be used
         // instead of applicationPath() as each instance is launched with its own executable path
         const QByteArray appImagePath = qgetenv( "APPIMAGE" );
         if( appImagePath.isEmpty() ){ // Not running as AppImage: use path to executable file
-            appData.addData( SingleApplication::app_t::applicationFilePath().toUtf8() );
+            appData.addData( applicationFilePath.toUtf8() );
         } else { // Running as AppImage: Use absolute path to AppImage file
             appData.addData( appImagePath );
         };
 #else
-        appData.addData( SingleApplication::app_t::applicationFilePath().toUtf8() );
+        appData.addData( applicationFilePath.toUtf8() );
 #endif
     }
 
     // User level block requires a user specific data in the hash
     if( options & SingleApplication::Mode::User ){
-        appData.addData( getUsername().toUtf8() );
+        appData.addData( username.toUtf8() );
     }
 
     // Replace the backslash in RFC 2045 Base64 [a-zA-Z0-9+/=] to comply with
     // server naming requirements.
-    blockServerName = QString::fromUtf8(appData.result().toBase64().replace("/", "_"));
+    return QString::fromUtf8(appData.result().toBase64().replace("/", "_"));
 }
 
 bool SingleApplicationPrivate::startPrimary( uint timeout )
 {
-    QLocalServer::removeServer(blockServerName);
-    serverThread = new ServerThread(blockServerName, this);
+    // Only the holder of the election lock gets here. Still, a primary
+    // instance of an older version, or one whose lock file is on a file
+    // system without flock(), may listen without holding it. The server is
+    // only removed once connecting to it was refused, a busy one is left
+    // alone. Abstract sockets vanish with their process and leave nothing
+    // behind.
+    if( ! useAbstractNamespace() ){
+        QLocalSocket probe;
+        probe.connectToServer( blockServerName );
+        if( probe.waitForConnected( static_cast<int>( qMin( timeout, uint( ProbeTimeout ))))){
+            probe.abort();
+            return false;
+        }
+        if( probe.error() == QLocalSocket::ConnectionRefusedError )
+            QLocalServer::removeServer( blockServerName );
+        else if( probe.error() != QLocalSocket::ServerNotFoundError )
+            return false;
+    }
+
+    serverThread = new ServerThread( blockServerName, this );
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+    if( useAbstractNamespace() )
+        serverThread->setSocketOptions( QLocalServer::AbstractNamespaceOption );
+#endif
 
-    connect(serverThread, &ServerThread::newConnection,
-            this, &SingleApplicationPrivate::slotConnectionEstablished);
+    connect( serverThread, &ServerThread::newConnection,
+             this, &SingleApplicationPrivate::slotConnectionEstablished );
 
     serverThread->start();
 
-    // Wait for the server to start (with timeout)
-    QElapsedTimer timer;
-    timer.start();
-    while (!serverThread->isRunning() && timer.elapsed() < timeout) {
-        QThread::msleep(10);
+    if( serverThread->waitForListening( timeout ))
+        return true;
+
+    delete serverThread;
+    serverThread = nullptr;
+    return false;
+}
+
+bool SingleApplicationPrivate::useAbstractNamespace() const
+{
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+    return options.testFlag( SingleApplication::Mode::AbstractNamespace );
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Checks whether the peer of a socket runs as the same user
+ */
+bool SingleApplicationPrivate::isCurrentUser( QLocalSocket *socket )
+{
+#ifdef Q_OS_LINUX
+    struct ucred credentials;
+    socklen_t length = sizeof( credentials );
+    if( ::getsockopt( static_cast<int>( socket->socketDescriptor() ), SOL_SOCKET, SO_PEERCRED, &credentials, &length ) == 0 )
+        return credentials.uid == ::geteuid();
+    return false;
+#else
+    Q_UNUSED( socket );
+    return true;
+#endif
+}
+
+QString SingleApplicationPrivate::lockFilePath( const QString &blockServerName )
+{
+    return QDir( QDir::tempPath() ).absoluteFilePath( blockServerName + QStringLiteral( ".lock" ));
+}
+
+/**
+ * @brief Tries to take the lock deciding which instance is the primary
+ *
+ * The lock is held for as long as the primary instance runs. The lock file
+ * itself is never removed, since another instance could lock the removed
+ * file while a third one creates and locks a new one.
+ * @return Returns true if this instance holds the lock.
+ */
+bool SingleApplicationPrivate::acquirePrimaryLock()
+{
+    const QString path = lockFilePath( blockServerName );
+
+#ifdef Q_OS_UNIX
+    if( lockDescriptor == -1 ){
+        // System wide blocks need a lock file other users can open as well
+        const bool userWide = options.testFlag( SingleApplication::Mode::User );
+        const mode_t mode = userWide ? 0600 : 0666;
+        const QByteArray name = QFile::encodeName( path );
+
+        // The temporary directory is shared, so links planted there are
+        // never followed and a file found there must be a regular one, which
+        // the current user owns unless the block is system wide
+        bool created = true;
+        lockDescriptor = ::open( name.constData(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode );
+        if( lockDescriptor == -1 && errno == EEXIST ){
+            created = false;
+            lockDescriptor = ::open( name.constData(), O_RDWR | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC );
+        }
+        if( lockDescriptor == -1 ){
+            qWarning() << "SingleApplication: Failed to open the lock file" << path;
+            return false;
+        }
+
+        struct stat status;
+        if( ::fstat( lockDescriptor, &status ) == -1 || ! S_ISREG( status.st_mode ) ||
+            ( userWide && status.st_uid != ::geteuid() )){
+            qWarning() << "SingleApplication: Refusing to use the lock file" << path;
+            releasePrimaryLock();
+            return false;
+        }
+
+        // Widen the permissions the umask may have narrowed, only on the
+        // file this process created
+        if( created && mode != 0600 )
+            ::fchmod( lockDescriptor, mode );
+    }
+
+    // flock() locks are released by the kernel when the process exits
+    return ::flock( lockDescriptor, LOCK_EX | LOCK_NB ) == 0;
+#else
+    if( lockFile == nullptr ){
+        lockFile = new QLockFile( path );
+        // The lock is only stale once the process holding it is gone,
+        // however long the primary instance has been running
+        lockFile->setStaleLockTime( 0 );
+    }
+
+    return lockFile->tryLock( 0 );
+#endif
+}
+
+void SingleApplicationPrivate::releasePrimaryLock()
+{
+#ifdef Q_OS_UNIX
+    if( lockDescriptor != -1 ){
+        ::close( lockDescriptor );
+        lockDescriptor = -1;
+    }
+#else
+    delete lockFile;
+    lockFile = nullptr;
+#endif
+}
+
+/**
+ * @brief Delivers a message to the primary instance before the application
+ * object exists
+ *
+ * Uses neither QLocalSocket nor an event loop. The election lock tells
+ * whether a primary instance runs at all, then a blocking socket carries the
+ * handshake and the message in a single write and both acknowledgements are
+ * parsed from a stack buffer. Other frames the primary sends meanwhile are
+ * skipped.
+ * @return Returns true if the primary instance acknowledged the message.
+ */
+bool SingleApplicationPrivate::forwardToPrimary( const QString &blockServerName, SingleApplication::Options options, const QByteArray &message, int timeout )
+{
+#ifdef Q_OS_LINUX
+    if( message.size() > FrameCodec::MaxContentLength )
+        return false;
+
+    // The lock can only be taken when there is no primary instance
+    const int lock = ::open( QFile::encodeName( lockFilePath( blockServerName )).constData(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC );
+    if( lock == -1 )
+        return false;
+    struct stat status;
+    const bool running = ::fstat( lock, &status ) == 0 && S_ISREG( status.st_mode ) &&
+                         ::flock( lock, LOCK_SH | LOCK_NB ) == -1 && errno == EWOULDBLOCK;
+    ::close( lock );
+    if( ! running )
+        return false;
+
+    // Addressed the same way QLocalSocket addresses a server name
+    const QByteArray path = QFile::encodeName( QDir::tempPath() + QLatin1Char( '/' ) + blockServerName );
+    struct sockaddr_un address;
+    memset( &address, 0, sizeof( address ));
+    address.sun_family = AF_UNIX;
+    if( static_cast<size_t>( path.size() ) + 1 >= sizeof( address.sun_path ))
+        return false;
+
+    socklen_t addressLength = sizeof( address );
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+    if( options & SingleApplication::Mode::AbstractNamespace ){
+        memcpy( address.sun_path + 1, path.constData(), static_cast<size_t>( path.size() ));
+        addressLength = static_cast<socklen_t>( offsetof( struct sockaddr_un, sun_path ) + 1 + path.size() );
+    } else
+#else
+    Q_UNUSED( options );
+#endif
+    {
+        memcpy( address.sun_path, path.constData(), static_cast<size_t>( path.size() ));
+    }
+
+    const int descriptor = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( descriptor == -1 )
+        return false;
+
+    // Bound every blocking call, connecting blocks while the backlog is full
+    struct timeval interval;
+    interval.tv_sec = timeout / 1000;
+    interval.tv_usec = ( timeout % 1000 ) * 1000;
+    ::setsockopt( descriptor, SOL_SOCKET, SO_SNDTIMEO, &interval, sizeof( interval ));
+    ::setsockopt( descriptor, SOL_SOCKET, SO_RCVTIMEO, &interval, sizeof( interval ));
+
+    if( ::connect( descriptor, reinterpret_cast<struct sockaddr*>( &address ), addressLength ) == -1 ){
+        ::close( descriptor );
+        return false;
+    }
+
+    // Version 1 frames, the handshake only negotiates the version of later
+    // ones. It announces no capabilities, the primary has nothing to push to
+    // this connection.
+    QByteArray frames;
+    QByteArray handshake( sizeof( quint32 ), Qt::Uninitialized );
+    qToBigEndian<quint32>( FrameCodec::ProtocolVersion, handshake.data() );
+    FrameCodec::appendFrame( frames, FrameCodec::Header{ 1, SingleApplication::MessageType::NewInstance, 0, 0, 0, handshake.size() }, handshake.constData() );
+    int acknowledgements = 1;
+    if( ! message.isEmpty() ){
+        FrameCodec::appendFrame( frames, FrameCodec::Header{ 1, SingleApplication::MessageType::InstanceMessage, 0, 0, 0, message.size() }, message.constData() );
+        ++acknowledgements;
+    }
+
+    const char *data = frames.constData();
+    qint64 remaining = frames.size();
+    while( remaining > 0 ){
+        const ssize_t written = ::send( descriptor, data, static_cast<size_t>( remaining ), MSG_NOSIGNAL );
+        if( written == -1 && errno == EINTR )
+            continue;
+        if( written <= 0 )
+            break;
+        data += written;
+        remaining -= written;
     }
 
-    return serverThread->isRunning();
+    uchar buffer[4 * FrameCodec::SmallFrameSize];
+    qint64 received = 0;
+    qint64 skipped = 0; // Bytes of a frame that isn't an acknowledgement left to discard
+    bool failed = remaining > 0;
+    while( ! failed && acknowledgements > 0 ){
+        const ssize_t count = ::recv( descriptor, buffer + received, sizeof( buffer ) - static_cast<size_t>( received ), 0 );
+        if( count == -1 && errno == EINTR )
+            continue;
+        if( count <= 0 )
+            break;
+        received += count;
+
+        qint64 offset = 0;
+        FrameCodec::Header header;
+        while( acknowledgements > 0 ){
+            if( skipped > 0 ){
+                const qint64 discarded = qMin( skipped, received - offset );
+                offset += discarded;
+                skipped -= discarded;
+                if( skipped > 0 )
+                    break;
+            }
+
+            const FrameCodec::Result result = FrameCodec::parseHeader( buffer + offset, received - offset, header );
+            if( result == FrameCodec::Result::Invalid ){
+                failed = true;
+                break;
+            }
+            if( result == FrameCodec::Result::Incomplete )
+                break;
+
+            // Anything else the primary sends meanwhile is not an answer
+            if( header.type != SingleApplication::MessageType::Acknowledge ){
+                skipped = FrameCodec::frameSize( header );
+                continue;
+            }
+            if( FrameCodec::frameSize( header ) > received - offset )
+                break;
+
+            const uchar *trailer = buffer + offset + FrameCodec::frameSize( header ) - FrameCodec::trailerSize( header.version, header.flags );
+            if( header.instanceId != 0 || ! FrameCodec::verifyFrame( buffer + offset, header, trailer )){
+                failed = true;
+                break;
+            }
+
+            offset += FrameCodec::frameSize( header );
+            --acknowledgements;
+        }
+
+        memmove( buffer, buffer + offset, static_cast<size_t>( received - offset ));
+        received -= offset;
+
+        // Acknowledgements are small, anything filling the buffer is not one
+        if( received == static_cast<qint64>( sizeof( buffer )))
+            failed = true;
+    }
+
+    ::close( descriptor );
+    return ! failed && acknowledgements == 0;
+#else
+    Q_UNUSED( blockServerName );
+    Q_UNUSED( options );
+    Q_UNUSED( message );
+    Q_UNUSED( timeout );
+    return false;
+#endif
 }
 
 bool SingleApplicationPrivate::connectToPrimary(uint timeout) {
-    if (socket == nullptr)
+    if (socket == nullptr) {
         socket = new QLocalSocket(this);
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        if (useAbstractNamespace())
+            socket->setSocketOptions(QLocalSocket::AbstractNamespaceOption);
+#endif
+        coder = createCoder(socket);
+        connect(coder, &MessageCoder::messageReceived, this, &SingleApplicationPrivate::slotReplyReceived);
+    }
 
     if (socket->state() == QLocalSocket::ConnectedState)
         return true;
@@ -200,119 +549,1487 @@ bool SingleApplicationPrivate::connectToPrimary(uint timeout) {
     return socket->waitForConnected(timeout);
 }
 
+MessageCoder *SingleApplicationPrivate::createCoder( QLocalSocket *socket ) const
+{
+    MessageCoder *messageCoder = new MessageCoder( socket );
+#ifdef Q_OS_UNIX
+    messageCoder->setChecksumEnabled( ! ( options & SingleApplication::Mode::SkipChecksum ));
+#endif
+    messageCoder->setCompressionThreshold( compressionThreshold );
+    return messageCoder;
+}
+
+void SingleApplicationPrivate::setCompressionThreshold( qint64 threshold )
+{
+    compressionThreshold = threshold;
+
+    if( coder != nullptr )
+        coder->setCompressionThreshold( threshold );
+    connections.forEach( [threshold]( ConnectionHandle, ConnectionInfo &info ){
+        MessageCoder *connectionCoder = info.coder;
+        QMetaObject::invokeMethod( connectionCoder, [connectionCoder, threshold](){ connectionCoder->setCompressionThreshold( threshold ); });
+    });
+}
+
+/**
+ * @brief Limits the bytes of messages decoded and not yet dispatched
+ */
+void SingleApplicationPrivate::setFlowControlLimits( qint64 connectionBytes, qint64 totalBytes )
+{
+    connectionFlowLimit = connectionBytes;
+    totalFlowLimit = totalBytes;
+    flowBudget.setLimit( totalBytes );
+
+    FlowBudget *budget = &flowBudget;
+    connections.forEach( [connectionBytes, budget]( ConnectionHandle, ConnectionInfo &info ){
+        MessageCoder *connectionCoder = info.coder;
+        QMetaObject::invokeMethod( connectionCoder, [connectionCoder, connectionBytes, budget](){
+            connectionCoder->setFlowControl( connectionBytes, budget );
+            connectionCoder->release( 0 );
+        });
+    });
+}
+
+void SingleApplicationPrivate::setIoThreadCount( int threads )
+{
+    ioThreadCount = qMax( threads, 0 );
+}
+
+/**
+ * @brief Picks the I/O thread owning the next connection
+ *
+ * Threads are started as they are first needed and kept until the instance
+ * is destroyed, as they may still own connections after the count shrank.
+ * @return Returns nullptr if connections are handled on the main thread.
+ */
+QThread *SingleApplicationPrivate::nextIoThread()
+{
+    if( ioThreadCount == 0 )
+        return nullptr;
+
+    const int index = nextIoThreadIndex % ioThreadCount;
+    nextIoThreadIndex = index + 1;
+    if( index < ioThreads.size() )
+        return ioThreads.at( index );
+
+    QThread *ioThread = new QThread();
+    ioThread->setObjectName( QStringLiteral( "SingleApplication I/O %1" ).arg( ioThreads.size() ));
+    ioThread->start();
+    ioThreads.append( ioThread );
+    return ioThread;
+}
+
+/**
+ * @brief Acknowledges a message on a connection of the primary instance
+ *
+ * Sent from the thread owning the connection, directly if that is the
+ * calling thread.
+ */
+void SingleApplicationPrivate::sendAcknowledgement( MessageCoder *connectionCoder, const QByteArray &content, quint8 flags, quint32 sequence )
+{
+    QMetaObject::invokeMethod( connectionCoder, [connectionCoder, content, flags, sequence](){
+        connectionCoder->sendMessage( SingleApplication::MessageType::Acknowledge, 0, content, flags, sequence );
+    });
+}
+
 void SingleApplicationPrivate::notifySecondaryStart(uint timeout)
 {
-    sendApplicationMessage(SingleApplication::MessageType::NewInstance, QByteArray(), timeout);
+    // The handshake announces the protocol versions this instance understands
+    sendApplicationMessage(SingleApplication::MessageType::NewInstance, handshake(0), timeout);
+}
+
+/**
+ * @brief Returns the handshake of this instance, followed by its identity
+ *
+ * The identity is made of the id of the instance, assigned by the primary
+ * instance, the process id, the start time and the user name. Instances
+ * without it only send the handshake.
+ */
+QByteArray SingleApplicationPrivate::handshake( quint64 instanceId ) const
+{
+    QByteArray identity( 3 * sizeof( quint64 ), Qt::Uninitialized );
+    qToBigEndian<quint64>( instanceId, identity.data() );
+    qToBigEndian<qint64>( QCoreApplication::applicationPid(), identity.data() + sizeof( quint64 ));
+    qToBigEndian<qint64>( startupEpoch, identity.data() + 2 * sizeof( quint64 ));
+    return MessageCoder::handshake() + identity + getUsername().toUtf8();
+}
+
+/**
+ * @brief Reads the identity following a handshake into a connection
+ *
+ * The process id is taken from the handshake only if the socket didn't
+ * provide the peer's credentials.
+ */
+void SingleApplicationPrivate::readIdentity( const QByteArray &handshake, ConnectionInfo &info )
+{
+    const int offset = 2 * sizeof( quint32 );
+    if( handshake.size() < offset + static_cast<int>( 3 * sizeof( quint64 )))
+        return;
+
+    const char *data = handshake.constData() + offset;
+    // Unlike the handshake, the peer's credentials can't be forged
+    if( info.pid == -1 )
+        info.pid = qFromBigEndian<qint64>( data + sizeof( quint64 ));
+    info.startTime = qFromBigEndian<qint64>( data + 2 * sizeof( quint64 ));
+    info.user = QString::fromUtf8( data + 3 * sizeof( quint64 ), handshake.size() - offset - static_cast<int>( 3 * sizeof( quint64 )));
+}
+
+bool SingleApplicationPrivate::sendApplicationMessage( SingleApplication::MessageType messageType, QByteArray content, uint timeout,
+                                                       SingleApplication::MessagePriority priority, int timeToLive )
+{
+    // The priority and the deadline travel in an envelope ahead of the
+    // content, if the primary supports it
+    QByteArray envelope;
+    if(( priority != SingleApplication::MessagePriority::Normal || timeToLive >= 0 ) &&
+        connectToPrimary( timeout * 2 / 3 ) &&
+        ( coder->capabilities() & FrameCodec::Envelopes )){
+        const qint64 deadline = timeToLive >= 0 ? QDateTime::currentMSecsSinceEpoch() + timeToLive : 0;
+        envelope = FrameCodec::encodeEnvelope( FrameCodec::Envelope{ static_cast<quint8>( priority ), deadline } );
+    }
+
+    // Large messages are handed over in shared memory if the primary supports it
+    if( messageType == SingleApplication::MessageType::InstanceMessage &&
+        content.size() >= MemfdPayload::Threshold &&
+        connectToPrimary( timeout * 2 / 3 ) &&
+        ( coder->capabilities() & FrameCodec::SharedPayloads )){
+        bool rejected = false;
+        if( sendSharedMessage( content, timeout, rejected, envelope ))
+            return true;
+        if( ! rejected )
+            return false;
+    }
+
+    if( envelope.isEmpty() )
+        return sendApplicationMessages( messageType, QList<QByteArray>{ content }, timeout );
+    return sendApplicationMessages( messageType, QList<QByteArray>{ envelope + content }, timeout, FrameCodec::Enveloped );
+}
+
+/**
+ * @brief Sends the content in a sealed memfd instead of through the socket
+ * @param rejected Set if the memfd could not be created or the primary could
+ * not map it, in which case the content can still be sent inline
+ */
+bool SingleApplicationPrivate::sendSharedMessage( const QByteArray &content, uint timeout, bool &rejected, const QByteArray &envelope )
+{
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+
+    rejected = true;
+    const int fd = MemfdPayload::create( content );
+    if( fd == -1 )
+        return false;
+
+    rejected = false;
+    replies.clear();
+    SingleApplication::Message response;
+    const quint8 flags = envelope.isEmpty() ? FrameCodec::SharedPayload : FrameCodec::SharedPayload | FrameCodec::Enveloped;
+    bool sent = coder->sendMessage( SingleApplication::MessageType::InstanceMessage, instanceNumber, envelope + MemfdPayload::describe( fd, content.size() ), flags );
+
+    socket->flush();
+    if( sent && socket->bytesToWrite() > 0 )
+        sent = socket->waitForBytesWritten( static_cast<int>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 )));
+
+    // The memfd has to stay open until the primary mapped it
+    if( sent )
+        sent = waitForReply( SingleApplication::MessageType::Acknowledge, static_cast<uint>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 )), response );
+
+    MemfdPayload::release( fd );
+
+    if( ! sent || ( response.flags & FrameCodec::Expired ))
+        return false;
+
+    // The primary reports whether it could map the memfd
+    rejected = response.content != QByteArray( 1, '\1' );
+    return ! rejected;
 }
 
-bool SingleApplicationPrivate::sendApplicationMessage( SingleApplication::MessageType messageType, QByteArray content, uint timeout )
+bool SingleApplicationPrivate::sendApplicationMessages( SingleApplication::MessageType messageType, const QList<QByteArray> &contents, uint timeout, quint8 flags )
 {
     QElapsedTimer elapsedTime;
     elapsedTime.start();
 
+    if( contents.isEmpty() )
+        return true;
+
     if( ! connectToPrimary( timeout * 2 / 3 ))
         return false;
 
-    MessageCoder coder( socket );
-    coder.sendMessage( messageType, instanceNumber, content );
+    replies.clear();
+    if( ! coder->sendMessages( messageType, instanceNumber, contents, flags ))
+        return false;
 
     socket->flush();
-    if (!socket->waitForBytesWritten( qMax(timeout - elapsedTime.elapsed(), 1) ))
+    if( socket->bytesToWrite() > 0 &&
+        ! socket->waitForBytesWritten( static_cast<int>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 ))))
         return false;
 
-    // Wait for an ACK message
-    if( socket->waitForReadyRead( timeout )){
-        QByteArray responseBytes = socket->readAll();
-        SingleApplicationMessage response = SingleApplicationMessage( responseBytes );
+    // Version 1 primaries acknowledge every message of a batch separately
+    const int acknowledgements = coder->negotiatedVersion() == 1 ? contents.size() : 1;
 
-        // The response message is invalid
-        if( response.invalid )
+    for( int i = 0; i < acknowledgements; ++i ){
+        SingleApplication::Message response;
+        if( ! waitForReply( SingleApplication::MessageType::Acknowledge, static_cast<uint>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 )), response ))
             return false;
 
         // The response message didn't contain the primary instance id
         if( response.instanceId != 0 )
             return false;
 
-        // This isn't an acknowledge message
-        if( response.type != SingleApplication::MessageType::Acknowledge )
+        // The message expired before the primary instance delivered it
+        if( response.flags & FrameCodec::Expired )
             return false;
 
-        return true;
+        // The primary acknowledges the handshake with its own, followed by
+        // the id it assigned to this instance
+        if( messageType == SingleApplication::MessageType::NewInstance ){
+            coder->negotiate( response.content );
+            if( response.content.size() >= static_cast<int>( 2 * sizeof( quint32 ) + sizeof( quint64 )))
+                instanceNumber = qFromBigEndian<quint64>( response.content.constData() + 2 * sizeof( quint32 ));
+        }
     }
 
-    return false;
+    return true;
 }
 
-qint64 SingleApplicationPrivate::primaryPid() const
+/**
+ * @brief Blocks until the primary instance replies with a message of the
+ * given type
+ */
+bool SingleApplicationPrivate::waitForReply( SingleApplication::MessageType type, uint timeout, SingleApplication::Message &reply )
 {
-    if (!connectToPrimary(1000)) {
-        return -1;
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+
+    while( true ){
+        for( int i = 0; i < replies.size(); ++i ){
+            if( replies.at( i ).type == type ){
+                reply = replies.takeAt( i );
+                return true;
+            }
+        }
+
+        const qint64 remaining = timeout - elapsedTime.elapsed();
+        if( remaining <= 0 )
+            return false;
+
+        // Decoded replies are delivered to slotReplyReceived() from readyRead
+        if( ! socket->waitForReadyRead( static_cast<int>( remaining )))
+            return false;
     }
+}
 
-    MessageCoder coder(socket);
-    coder.sendMessage(SingleApplication::MessageType::PrimaryPidRequest, instanceNumber, QByteArray());
+void SingleApplicationPrivate::slotReplyReceived( SingleApplication::Message message )
+{
+    // Pings are answered at once, also while blocked waiting for a reply
+    if( message.type == SingleApplication::MessageType::Ping ){
+        coder->sendMessage( SingleApplication::MessageType::Pong, instanceNumber, QByteArray() );
+        socket->flush();
+        return;
+    }
 
-    if (!socket->waitForReadyRead(1000)) {
-        return -1;
+    // Messages of the primary are delivered from the event loop, not from
+    // within a call waiting for a reply
+    if( message.type == SingleApplication::MessageType::InstanceMessage ){
+        const QByteArray content = message.content;
+        QMetaObject::invokeMethod( this, [this, content](){ deliverMessage( 0, content ); }, Qt::QueuedConnection );
+        return;
+    }
+    if( message.type == SingleApplication::MessageType::Publish ){
+        const QByteArray content = message.content;
+        QMetaObject::invokeMethod( this, [this, content](){ deliverPublication( content ); }, Qt::QueuedConnection );
+        return;
     }
 
-    QByteArray response = socket->readAll();
-    QDataStream stream(response);
-    qint64 pid;
-    stream >> pid;
+    // Acknowledgements of posted messages are handled as they arrive
+    if( message.type == SingleApplication::MessageType::Acknowledge && ( message.flags & FrameCodec::Sequenced )){
+        acknowledgePostedMessages( message.sequence, message.content );
+        return;
+    }
 
-    return pid;
+    replies.append( std::move( message ));
 }
 
-QString SingleApplicationPrivate::primaryUser() const
+bool SingleApplicationPrivate::postApplicationMessage( QByteArray content, uint timeout )
 {
-    if (!connectToPrimary(1000)) {
-        return QString();
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+
+    if( ! connectToPrimary( timeout * 2 / 3 ))
+        return false;
+
+    // Sequence numbers were introduced with protocol version 2
+    if( coder->negotiatedVersion() == 1 )
+        return sendApplicationMessage( SingleApplication::MessageType::InstanceMessage, content, timeout );
+
+    if( ! waitForPostedMessages( messageWindow - 1, static_cast<uint>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 ))))
+        return false;
+
+    const quint32 sequence = nextSequence++;
+    if( ! coder->sendMessage( SingleApplication::MessageType::InstanceMessage, instanceNumber, content, FrameCodec::Sequenced, sequence ))
+        return false;
+
+    // Kept until acknowledged, in case it has to be sent again
+    postedMessages.insert( sequence, PostedMessage{ content, 0 } );
+    return true;
+}
+
+/**
+ * @brief Blocks until no more than the given number of posted messages await
+ * an acknowledgement
+ */
+bool SingleApplicationPrivate::waitForPostedMessages( int maxInFlight, uint timeout )
+{
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+
+    while( postedMessages.size() > maxInFlight ){
+        const qint64 remaining = timeout - elapsedTime.elapsed();
+        if( remaining <= 0 )
+            return false;
+
+        // Acknowledgements are delivered to slotReplyReceived() from readyRead
+        socket->flush();
+        if( ! socket->waitForReadyRead( static_cast<int>( remaining )))
+            return false;
     }
 
-    MessageCoder coder(socket);
-    coder.sendMessage(SingleApplication::MessageType::PrimaryUserRequest, instanceNumber, QByteArray());
+    return true;
+}
 
-    if (!socket->waitForReadyRead(1000)) {
-        return QString();
+/**
+ * @brief Releases the posted messages acknowledged by the primary and sends
+ * the ones it reported missing again
+ * @param sequence Sequence number up to which all messages were received
+ * @param selective Sequence numbers received after a missing message
+ */
+void SingleApplicationPrivate::acknowledgePostedMessages( quint32 sequence, const QByteArray &selective )
+{
+    // Once the sequence numbers wrapped, the order of the keys is not the
+    // order the messages were posted in
+    for( auto it = postedMessages.begin(); it != postedMessages.end(); ){
+        if( isSequenceBefore( sequence, it.key() ))
+            ++it;
+        else
+            it = postedMessages.erase( it );
     }
 
-    QByteArray response = socket->readAll();
-    QDataStream stream(response);
-    QString user;
-    stream >> user;
+    quint32 highestSelective = sequence;
+    for( int offset = 0; offset + 4 <= selective.size(); offset += 4 ){
+        const quint32 received = qFromBigEndian<quint32>( selective.constData() + offset );
+        postedMessages.remove( received );
+        if( isSequenceBefore( highestSelective, received ))
+            highestSelective = received;
+    }
 
-    return user;
+    // Anything older than a selectively acknowledged message was lost. The
+    // acknowledgements that follow keep reporting the gap until the copy
+    // arrived, so it is sent again at most once per interval.
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for( auto it = postedMessages.begin(); it != postedMessages.end(); ++it ){
+        if( ! isSequenceBefore( it.key(), highestSelective ) || now - it->resent < RetransmitInterval )
+            continue;
+        coder->sendMessage( SingleApplication::MessageType::InstanceMessage, instanceNumber, it->content, FrameCodec::Sequenced, it.key() );
+        it->resent = now;
+    }
 }
 
 /**
- * @brief Executed when a connection has been made to the LocalServer
+ * @brief Compares sequence numbers with serial number arithmetic
+ *
+ * Sequence numbers wrap around, a number is before the numbers up to half
+ * the range ahead of it.
  */
-void SingleApplicationPrivate::slotConnectionEstablished()
+bool SingleApplicationPrivate::isSequenceBefore( quint32 sequence, quint32 other )
 {
-    QLocalSocket *nextConnSocket = serverThread->nextPendingConnection();
-    if (!nextConnSocket) {
-        qWarning() << "Failed to get next pending connection";
-        return;
-    }
+    return static_cast<qint32>( sequence - other ) < 0;
+}
 
-    connectionMap.insert(nextConnSocket, ConnectionInfo());
-    connectionMap[nextConnSocket].coder = new MessageCoder(nextConnSocket);
+bool SingleApplicationPrivate::sendApplicationStream( QIODevice *device, uint timeout )
+{
+    if( ! connectToPrimary( timeout ))
+        return false;
 
-    QObject::connect(nextConnSocket, &QLocalSocket::disconnected, nextConnSocket, &QLocalSocket::deleteLater);
+    tuneSocketBuffers( socket );
 
-    QObject::connect(nextConnSocket, &QLocalSocket::destroyed, this,
-        [nextConnSocket, this]() {
-            connectionMap.remove(nextConnSocket);
+    // A single chunk buffer is reused for the whole stream
+    QByteArray chunk( StreamChunkSize, Qt::Uninitialized );
+    while( true ){
+        const qint64 read = device->read( chunk.data(), StreamChunkSize );
+        if( read == 0 && device->atEnd() )
+            break;
+
+        if( read == 0 ){
+            if( device->waitForReadyRead( static_cast<int>( timeout )) || device->atEnd() )
+                continue;
         }
-    );
 
-    // Handle incoming messages
-    QObject::connect(nextConnSocket, &QLocalSocket::readyRead, this,
-        [nextConnSocket, this]() {
-            connectionMap[nextConnSocket].coder->receiveMessage();
+        // Abandoning the connection lets the primary know the stream is incomplete
+        if( read <= 0 || ! coder->sendMessage( SingleApplication::MessageType::StreamData, instanceNumber, QByteArray::fromRawData( chunk.constData(), read ))){
+            socket->abort();
+            return false;
         }
-    );
+
+        // Keep no more than a chunk queued in the socket, the rest of the
+        // stream waits in the device until the primary catches up
+        while( socket->bytesToWrite() > StreamChunkSize ){
+            if( ! socket->waitForBytesWritten( static_cast<int>( timeout ))){
+                socket->abort();
+                return false;
+            }
+        }
+    }
+
+    return sendApplicationMessage( SingleApplication::MessageType::StreamEnd, QByteArray(), timeout );
+}
+
+/**
+ * @brief Enlarges the kernel socket buffers for bulk transfers
+ */
+void SingleApplicationPrivate::tuneSocketBuffers( QLocalSocket *socket )
+{
+#ifdef Q_OS_UNIX
+    const qintptr descriptor = socket->socketDescriptor();
+    if( descriptor == -1 )
+        return;
+
+    const int size = SocketBufferSize;
+    ::setsockopt( static_cast<int>( descriptor ), SOL_SOCKET, SO_SNDBUF, &size, sizeof( size ));
+    ::setsockopt( static_cast<int>( descriptor ), SOL_SOCKET, SO_RCVBUF, &size, sizeof( size ));
+#else
+    Q_UNUSED( socket );
+#endif
+}
+
+qint64 SingleApplicationPrivate::primaryPid()
+{
+    if( serverThread != nullptr )
+        return QCoreApplication::applicationPid();
+
+    QByteArray reply;
+    if( ! queryPrimary( SingleApplication::MessageType::PrimaryPidRequest, reply ) || reply.size() != static_cast<int>( sizeof( qint64 )))
+        return -1;
+
+    return qFromBigEndian<qint64>( reply.constData() );
+}
+
+QString SingleApplicationPrivate::primaryUser()
+{
+    if( serverThread != nullptr )
+        return getUsername();
+
+    QByteArray reply;
+    if( ! queryPrimary( SingleApplication::MessageType::PrimaryUserRequest, reply ))
+        return QString();
+
+    return QString::fromUtf8( reply );
+}
+
+/**
+ * @brief Returns this primary instance followed by the connected secondaries,
+ * or asks the primary instance for them
+ */
+QList<SingleApplication::InstanceInfo> SingleApplicationPrivate::instances()
+{
+    QList<SingleApplication::InstanceInfo> list;
+
+    if( serverThread == nullptr ){
+        QByteArray reply;
+        if( queryPrimary( SingleApplication::MessageType::InstancesRequest, reply ))
+            list = decodeInstances( reply );
+        return list;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    list.reserve( connections.size() + 1 );
+    list.append( SingleApplication::InstanceInfo{ 0, QCoreApplication::applicationPid(), getUsername(), startupEpoch, 0, now } );
+    connections.forEach( [&list]( ConnectionHandle, ConnectionInfo &info ){
+        list.append( SingleApplication::InstanceInfo{ info.instanceId, info.pid, info.user, info.startTime, info.coder->bytesReceived(), info.lastSeen } );
+    });
+    return list;
+}
+
+QByteArray SingleApplicationPrivate::encodeInstances( const QList<SingleApplication::InstanceInfo> &instances )
+{
+    QByteArray data;
+    QDataStream stream( &data, QIODevice::WriteOnly );
+    stream.setVersion( QDataStream::Qt_5_0 );
+    stream << static_cast<quint32>( instances.size() );
+    for( const SingleApplication::InstanceInfo &instance : instances )
+        stream << instance.id << instance.pid << instance.user << instance.startTime << instance.bytesSent << instance.lastSeen;
+    return data;
+}
+
+QList<SingleApplication::InstanceInfo> SingleApplicationPrivate::decodeInstances( const QByteArray &data )
+{
+    QList<SingleApplication::InstanceInfo> instances;
+    QDataStream stream( data );
+    stream.setVersion( QDataStream::Qt_5_0 );
+
+    quint32 count = 0;
+    stream >> count;
+    for( quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i ){
+        SingleApplication::InstanceInfo instance;
+        stream >> instance.id >> instance.pid >> instance.user >> instance.startTime >> instance.bytesSent >> instance.lastSeen;
+        if( stream.status() == QDataStream::Ok )
+            instances.append( instance );
+    }
+    return instances;
+}
+
+/**
+ * @brief Asks the primary instance about itself
+ *
+ * Requests are control messages, the primary answers them ahead of any
+ * instance messages waiting to be delivered.
+ */
+bool SingleApplicationPrivate::queryPrimary( SingleApplication::MessageType request, QByteArray &reply )
+{
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+
+    const uint timeout = 1000;
+    if( ! connectToPrimary( timeout * 2 / 3 ))
+        return false;
+
+    replies.clear();
+    if( ! coder->sendMessage( request, instanceNumber, QByteArray() ))
+        return false;
+
+    socket->flush();
+    if( socket->bytesToWrite() > 0 &&
+        ! socket->waitForBytesWritten( static_cast<int>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 ))))
+        return false;
+
+    SingleApplication::Message response;
+    if( ! waitForReply( SingleApplication::MessageType::Acknowledge, static_cast<uint>( qMax<qint64>( timeout - elapsedTime.elapsed(), 1 )), response ))
+        return false;
+
+    reply = response.content;
+    return true;
+}
+
+/**
+ * @brief Executed when a connection has been made to the LocalServer
+ */
+void SingleApplicationPrivate::slotConnectionEstablished( QLocalSocket *nextConnSocket )
+{
+    if( ! nextConnSocket ){
+        qWarning() << "Failed to get next pending connection";
+        return;
+    }
+
+    // Abstract sockets have no file permissions to keep other users out
+    if( useAbstractNamespace() && ( options & SingleApplication::Mode::User ) && ! isCurrentUser( nextConnSocket )){
+        qWarning() << "SingleApplication: Rejecting a connection from another user";
+        nextConnSocket->abort();
+        nextConnSocket->deleteLater();
+        return;
+    }
+
+    // Ids are assigned in order of connection and never reused
+    ConnectionInfo info;
+    info.instanceId = ++instanceCounter;
+    info.pid = peerPid( nextConnSocket );
+    info.startTime = QDateTime::currentMSecsSinceEpoch();
+    info.lastSeen = info.startTime;
+    info.socket = nextConnSocket;
+    info.coder = createCoder( nextConnSocket );
+    info.coder->setFlowControl( connectionFlowLimit, &flowBudget );
+    info.coder->setDecodeQuantum( MessageCoder::DecodeQuantum );
+    // Publications are routed as the frames they arrived in
+    info.coder->setForwardedType( SingleApplication::MessageType::Publish );
+    MessageCoder *connectionCoder = info.coder;
+    const quint64 instanceId = info.instanceId;
+    const ConnectionHandle connection = connections.insert( std::move( info ));
+    instanceConnections.insert( instanceId, connection );
+
+    // Stop reading from the kernel once a couple of frames are buffered, so
+    // a paused connection holds back its sender instead of growing unbounded
+    nextConnSocket->setReadBufferSize( 2 * FrameCodec::MaxFrameSize );
+
+    QObject::connect( nextConnSocket, &QLocalSocket::disconnected, this,
+        [connection, this](){
+            slotConnectionDisconnected( connection );
+        }
+    );
+
+    QObject::connect( nextConnSocket, &QLocalSocket::destroyed, this,
+        [connection, this](){
+            removeConnection( connection );
+        }
+    );
+
+    // A disconnected socket is deleted once its frames were decoded. The
+    // connection and its coder go first, so nothing is left pointing at
+    // the socket. Queued, as the coder emits idle() from its own decoding.
+    QObject::connect( connectionCoder, &MessageCoder::idle, this,
+        [connection, this](){
+            ConnectionInfo *info = connections.find( connection );
+            if( info == nullptr || ! info->disconnected )
+                return;
+            QLocalSocket *connectionSocket = info->socket;
+            removeConnection( connection );
+            connectionSocket->deleteLater();
+        },
+        Qt::QueuedConnection
+    );
+
+    // Handle incoming messages. They are queued from the thread decoding
+    // them and delivered in batches, with one posted event per batch.
+    QObject::connect( connectionCoder, &MessageCoder::messageReceived, connectionCoder,
+        [connection, this]( SingleApplication::Message message ){
+            incomingMessages.push( IncomingMessage{ connection, std::move( message ), 0, 0 } );
+            if( ! drainScheduled.exchange( true ))
+                QMetaObject::invokeMethod( this, [this](){ drainIncomingMessages(); }, Qt::QueuedConnection );
+        },
+        Qt::DirectConnection
+    );
+
+    // Frames are decoded and validated by an I/O thread, only complete
+    // messages are queued to this thread
+    if( QThread *ioThread = nextIoThread() ){
+        nextConnSocket->moveToThread( ioThread );
+        connectionCoder->moveToThread( ioThread );
+        return;
+    }
+
+    // Decoded on this thread, but compressed contents are left to the
+    // server thread, decompressing them is the costly part
+    connectionCoder->setDecompressionOffloaded( true );
+    QObject::connect( connectionCoder, &MessageCoder::compressedContentReceived, this,
+        [connection, this]( const QByteArray &content ){
+            decompress( connection, content );
+        }
+    );
+}
+
+/**
+ * @brief Decompresses the content of a connection decoded on the main
+ * thread on the server thread, and hands it back to the connection's coder
+ */
+void SingleApplicationPrivate::decompress( ConnectionHandle connection, const QByteArray &content )
+{
+#ifndef QT_NO_COMPRESS
+    const auto complete = [this, connection]( const QByteArray &decompressed ){
+        QMetaObject::invokeMethod( this, [this, connection, decompressed](){
+            if( ConnectionInfo *info = connections.find( connection ))
+                info->coder->completeDecompression( decompressed );
+        }, Qt::QueuedConnection );
+    };
+
+    // The server thread only stops with this instance
+    if( ! serverThread->post( [content, complete](){ complete( qUncompress( content )); }))
+        complete( qUncompress( content ));
+#else
+    Q_UNUSED( connection );
+    Q_UNUSED( content );
+#endif
+}
+
+/**
+ * @brief Pings silent secondaries every interval and disconnects those
+ * that missed an interval to answer
+ *
+ * Every connection has a single entry in a timer wheel, which ticks
+ * HeartbeatTicks times per interval. An entry that expires is checked
+ * against the last message of its connection and scheduled again.
+ */
+void SingleApplicationPrivate::setHeartbeatInterval( int msecs )
+{
+    heartbeatInterval = qMax( msecs, 0 );
+    heartbeatWheel.clear();
+
+    if( heartbeatInterval == 0 ){
+        delete heartbeatTimer;
+        heartbeatTimer = nullptr;
+        return;
+    }
+
+    if( heartbeatTimer == nullptr ){
+        heartbeatTimer = new QTimer( this );
+        QObject::connect( heartbeatTimer, &QTimer::timeout, this, &SingleApplicationPrivate::pingSecondaryInstances );
+    }
+    heartbeatTimer->start( qMax( heartbeatInterval / HeartbeatTicks, 1 ));
+
+    connections.forEach( [this]( ConnectionHandle connection, ConnectionInfo &info ){
+        scheduleHeartbeat( connection, info );
+    });
+}
+
+void SingleApplicationPrivate::scheduleHeartbeat( ConnectionHandle connection, ConnectionInfo &info )
+{
+    if( heartbeatInterval == 0 || ! info.heartbeat )
+        return;
+
+    info.lastActivity = heartbeatWheel.currentTick();
+    info.pingSent = false;
+    heartbeatWheel.schedule( HeartbeatTicks, connection );
+}
+
+/**
+ * @brief Advances the heartbeat wheel, only the connections due are checked
+ */
+void SingleApplicationPrivate::pingSecondaryInstances()
+{
+    heartbeatWheel.tick( [this]( ConnectionHandle connection ){ checkHeartbeat( connection ); });
+}
+
+void SingleApplicationPrivate::checkHeartbeat( ConnectionHandle connection )
+{
+    ConnectionInfo *info = connections.find( connection );
+    if( info == nullptr )
+        return;
+
+    // A connection the primary doesn't read from can't deliver the answer
+    if( info->coder->isPaused() || info->coder->isThrottled() )
+        info->lastActivity = heartbeatWheel.currentTick();
+
+    const quint64 silence = heartbeatWheel.currentTick() - info->lastActivity;
+    if( silence < static_cast<quint64>( HeartbeatTicks )){
+        heartbeatWheel.schedule( HeartbeatTicks - silence, connection );
+        return;
+    }
+
+    if( ! info->pingSent ){
+        info->pingSent = true;
+        MessageCoder *connectionCoder = info->coder;
+        QMetaObject::invokeMethod( connectionCoder, [connectionCoder](){
+            connectionCoder->sendMessage( SingleApplication::MessageType::Ping, 0, QByteArray() );
+        });
+        heartbeatWheel.schedule( HeartbeatTicks, connection );
+        return;
+    }
+
+    qWarning() << "SingleApplication: Disconnecting secondary instance" << info->instanceId << "which stopped responding";
+    QLocalSocket *connectionSocket = info->socket;
+    removeConnection( connection );
+    QMetaObject::invokeMethod( connectionSocket, [connectionSocket](){
+        connectionSocket->abort();
+        connectionSocket->deleteLater();
+    });
+}
+
+/**
+ * @brief Encodes a message of the primary instance to its secondaries
+ *
+ * Secondaries accepting pushes or publications speak protocol version 2, so
+ * a single frame suits all of them.
+ * @return An empty array if the content is too large.
+ */
+QByteArray SingleApplicationPrivate::encodePush( SingleApplication::MessageType type, const QByteArray &content ) const
+{
+    if( content.size() > FrameCodec::MaxContentLength ){
+        qWarning() << "Message content size exceeds maximum allowed size of 1MiB";
+        return QByteArray();
+    }
+
+    quint8 flags = 0;
+#ifdef Q_OS_UNIX
+    if( options & SingleApplication::Mode::SkipChecksum )
+        flags |= FrameCodec::NoChecksum;
+#endif
+
+    QByteArray frame;
+    FrameCodec::appendFrame( frame, FrameCodec::Header{ FrameCodec::ProtocolVersion, type, flags, 0, 0, content.size() }, content.constData() );
+    return frame;
+}
+
+bool SingleApplicationPrivate::sendToInstance( quint64 instanceId, const QByteArray &content )
+{
+    const ConnectionInfo *info = connections.find( instanceConnections.value( instanceId, ConnectionTable::InvalidHandle ));
+    if( info == nullptr || ! ( info->capabilities & FrameCodec::Pushes ))
+        return false;
+
+    const QByteArray frame = encodePush( SingleApplication::MessageType::InstanceMessage, content );
+    if( frame.isEmpty() )
+        return false;
+
+    return info->coder->postFrames( frame, PushBufferSize );
+}
+
+/**
+ * @brief Writes the same implicitly shared frame to every secondary that
+ * accepts pushes
+ *
+ * Secondaries that don't read what they were sent already are skipped
+ * instead of buffering without bound.
+ */
+int SingleApplicationPrivate::broadcast( const QByteArray &content )
+{
+    const QByteArray frame = encodePush( SingleApplication::MessageType::InstanceMessage, content );
+    if( frame.isEmpty() )
+        return 0;
+
+    int recipients = 0;
+    connections.forEach( [&frame, &recipients]( ConnectionHandle, ConnectionInfo &info ){
+        if( ! ( info.capabilities & FrameCodec::Pushes ))
+            return;
+
+        if( info.coder->postFrames( frame, PushBufferSize ))
+            ++recipients;
+    });
+    return recipients;
+}
+
+/**
+ * @brief Subscribes to a topic or cancels the subscription
+ *
+ * Secondaries ask the primary instance to route the topic to them and keep
+ * their own list too, to drop publications still on the way after they
+ * unsubscribed.
+ */
+bool SingleApplicationPrivate::setSubscribed( const QString &topic, bool subscribed, int timeout )
+{
+    const QByteArray name = topic.toUtf8();
+    if( name.isEmpty() || name.size() > std::numeric_limits<quint16>::max() )
+        return false;
+
+    if( serverThread == nullptr &&
+        ! sendTopicMessage( subscribed ? SingleApplication::MessageType::Subscribe : SingleApplication::MessageType::Unsubscribe, name, static_cast<uint>( timeout )))
+        return false;
+
+    if( subscribed )
+        localTopics.insert( name );
+    else
+        localTopics.remove( name );
+    return true;
+}
+
+/**
+ * @brief Publishes a message on a topic
+ *
+ * The topic leads the payload with its length, so the primary instance can
+ * route the content without looking at the payload.
+ */
+bool SingleApplicationPrivate::publish( const QString &topic, const QByteArray &payload, int timeout )
+{
+    const QByteArray name = topic.toUtf8();
+    if( name.isEmpty() || name.size() > std::numeric_limits<quint16>::max() )
+        return false;
+
+    if( static_cast<qint64>( sizeof( quint16 )) + name.size() + payload.size() > FrameCodec::MaxContentLength ){
+        qWarning() << "Message content size exceeds maximum allowed size of 1MiB";
+        return false;
+    }
+
+    QByteArray content;
+    content.reserve( static_cast<int>( sizeof( quint16 )) + name.size() + payload.size() );
+    content.resize( sizeof( quint16 ));
+    qToBigEndian<quint16>( static_cast<quint16>( name.size() ), content.data() );
+    content.append( name ).append( payload );
+
+    if( serverThread != nullptr ){
+        const QByteArray frame = encodePush( SingleApplication::MessageType::Publish, content );
+        if( frame.isEmpty() )
+            return false;
+        routePublication( frame );
+        return true;
+    }
+
+    return sendTopicMessage( SingleApplication::MessageType::Publish, content, static_cast<uint>( timeout ));
+}
+
+/**
+ * @brief Sends a topic message to the primary instance, which doesn't
+ * acknowledge it
+ * @returns false if the primary instance doesn't support topics
+ */
+bool SingleApplicationPrivate::sendTopicMessage( SingleApplication::MessageType type, const QByteArray &content, uint timeout )
+{
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+
+    if( ! connectToPrimary( timeout * 2 / 3 ))
+        return false;
+
+    if( ! ( coder->capabilities() & FrameCodec::Topics ))
+        return false;
+
+    if( ! coder->sendMessage( type, instanceNumber, content ))
+        return false;
+
+    // Publications may be larger than what a single wait writes
+    socket->flush();
+    while( socket->bytesToWrite() > 0 ){
+        const qint64 remaining = timeout - elapsedTime.elapsed();
+        if( remaining <= 0 || ! socket->waitForBytesWritten( static_cast<int>( remaining )))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Records or cancels the subscription of a secondary to a topic
+ */
+void SingleApplicationPrivate::subscribeConnection( ConnectionHandle connection, ConnectionInfo &info, const QByteArray &topic, bool subscribed )
+{
+    if( topic.isEmpty() || ! ( info.capabilities & FrameCodec::Topics ))
+        return;
+
+    if( subscribed ){
+        if( info.topics.contains( topic ))
+            return;
+        info.topics.append( topic );
+        topicSubscribers[topic].append( connection );
+        return;
+    }
+
+    if( ! info.topics.removeOne( topic ))
+        return;
+
+    auto subscribers = topicSubscribers.find( topic );
+    if( subscribers == topicSubscribers.end() )
+        return;
+    subscribers->removeOne( connection );
+    if( subscribers->isEmpty() )
+        topicSubscribers.erase( subscribers );
+}
+
+/**
+ * @brief Routes a publication to the subscribers of its topic
+ *
+ * The frame is forwarded as it was received, shared by the coders of every
+ * subscriber and dropped for slow subscribers, as for broadcasts. Only the
+ * topic is read, the payload is left to the subscribers, which validate
+ * the checksum of the frame.
+ */
+void SingleApplicationPrivate::routePublication( const QByteArray &frame )
+{
+    FrameCodec::Header header;
+    const uchar *data = reinterpret_cast<const uchar*>( frame.constData() );
+    if( FrameCodec::parseHeader( data, frame.size(), header ) != FrameCodec::Result::Complete ||
+        frame.size() != FrameCodec::frameSize( header ))
+        return;
+
+    const qint64 offset = FrameCodec::headerSize( header.version );
+    const QByteArray content = QByteArray::fromRawData( frame.constData() + offset, static_cast<int>( header.length ));
+    const int topicLength = publicationTopicLength( content );
+    if( topicLength < 0 )
+        return;
+
+    // A copy of the list, the primary's own receivers may subscribe or
+    // unsubscribe while the publication is delivered
+    const QByteArray topic = QByteArray::fromRawData( content.constData() + sizeof( quint16 ), topicLength );
+    const QList<ConnectionHandle> subscribers = topicSubscribers.value( topic );
+    for( ConnectionHandle connection : subscribers ){
+        const ConnectionInfo *info = connections.find( connection );
+        if( info != nullptr )
+            info->coder->postFrames( frame, PushBufferSize );
+    }
+
+    if( ! localTopics.contains( topic ))
+        return;
+
+    if( ! FrameCodec::verifyFrame( data, header, data + offset + header.length )){
+        qWarning() << "SingleApplication: Dropping message with an invalid checksum";
+        return;
+    }
+    deliverPublication( content );
+}
+
+/**
+ * @brief Emits a publication if this instance subscribed to its topic
+ */
+void SingleApplicationPrivate::deliverPublication( const QByteArray &content )
+{
+    Q_Q( SingleApplication );
+
+    const int topicLength = publicationTopicLength( content );
+    if( topicLength < 0 )
+        return;
+
+    const char *topic = content.constData() + sizeof( quint16 );
+    if( ! localTopics.contains( QByteArray::fromRawData( topic, topicLength )))
+        return;
+
+    Q_EMIT q->receivedTopicMessage( QString::fromUtf8( topic, topicLength ), content.mid( static_cast<int>( sizeof( quint16 )) + topicLength ));
+}
+
+/**
+ * @brief Returns the length of the topic leading a publication
+ * @returns -1 if the content doesn't start with a topic
+ */
+int SingleApplicationPrivate::publicationTopicLength( const QByteArray &content )
+{
+    if( content.size() < static_cast<int>( sizeof( quint16 )))
+        return -1;
+
+    const int length = qFromBigEndian<quint16>( content.constData() );
+    if( length == 0 || content.size() - static_cast<int>( sizeof( quint16 )) < length )
+        return -1;
+    return length;
+}
+
+/**
+ * @brief Forgets a connection whose socket is gone and frees its coder
+ */
+void SingleApplicationPrivate::removeConnection( ConnectionHandle connection )
+{
+    ConnectionInfo *info = connections.find( connection );
+    if( info == nullptr )
+        return;
+
+    if( info->stream )
+        info->stream->abort( QStringLiteral( "The secondary instance disconnected before the end of the stream" ));
+
+    // Its subscriptions go with it
+    for( const QByteArray &topic : info->topics ){
+        auto subscribers = topicSubscribers.find( topic );
+        if( subscribers == topicSubscribers.end() )
+            continue;
+        subscribers->removeOne( connection );
+        if( subscribers->isEmpty() )
+            topicSubscribers.erase( subscribers );
+    }
+
+    // The coder is deleted by the thread it decodes on
+    MessageCoder *connectionCoder = info->coder;
+    instanceConnections.remove( info->instanceId );
+    connections.remove( connection );
+    if( connectionCoder->thread() == thread() )
+        delete connectionCoder;
+    else
+        connectionCoder->deleteLater();
+}
+
+/**
+ * @brief Dispatches every message queued by the connections since the last
+ * call, then delivers the batch of instance messages
+ */
+void SingleApplicationPrivate::drainIncomingMessages()
+{
+    Q_Q( SingleApplication );
+
+    // Cleared first, a message pushed from now on schedules another call
+    drainScheduled.store( false );
+
+    static const QMetaMethod messagesSignal = QMetaMethod::fromSignal( &SingleApplication::receivedMessages );
+    collectingBatch = q->isSignalConnected( messagesSignal );
+
+    // Requests and handshakes are answered first, so a burst of large
+    // messages doesn't hold them up, then instance messages by priority.
+    // Messages of the same lane keep the order they arrived in.
+    constexpr int priorities = static_cast<int>( SingleApplication::MessagePriority::High ) + 1;
+    QList<IncomingMessage> lanes[1 + priorities];
+
+    IncomingMessage incoming;
+    while( incomingMessages.pop( incoming )){
+        incoming.footprint = MessageCoder::footprint( incoming.message );
+        incoming.deadline = 0;
+
+        int lane = priorities - static_cast<int>( SingleApplication::MessagePriority::Normal );
+        switch( incoming.message.type ){
+        case SingleApplication::MessageType::Acknowledge:
+        case SingleApplication::MessageType::NewInstance:
+        case SingleApplication::MessageType::PrimaryPidRequest:
+        case SingleApplication::MessageType::PrimaryUserRequest:
+        case SingleApplication::MessageType::Ping:
+        case SingleApplication::MessageType::Pong:
+        case SingleApplication::MessageType::InstancesRequest:
+            lane = 0;
+            break;
+        default:
+            break;
+        }
+
+        if( incoming.message.flags & FrameCodec::Enveloped ){
+            FrameCodec::Envelope envelope;
+            if( ! FrameCodec::takeEnvelope( incoming.message.content, envelope ) ||
+                envelope.priority > static_cast<quint8>( SingleApplication::MessagePriority::High )){
+                qWarning() << "SingleApplication: Dropping a message with an invalid envelope";
+                releaseIncomingMessage( incoming.connection, incoming.footprint );
+                continue;
+            }
+            incoming.message.flags &= ~FrameCodec::Enveloped;
+            incoming.deadline = envelope.deadline;
+            if( lane != 0 )
+                lane = priorities - envelope.priority;
+        }
+
+        lanes[lane].append( std::move( incoming ));
+    }
+
+    for( QList<IncomingMessage> &lane : lanes )
+        for( IncomingMessage &message : lane )
+            dispatchIncomingMessage( message );
+
+    collectingBatch = false;
+    if( ! receivedBatch.isEmpty() ){
+        QList<SingleApplication::Message> batch;
+        batch.swap( receivedBatch );
+        Q_EMIT q->receivedMessages( batch );
+    }
+}
+
+/**
+ * @brief Dispatches a message taken from the queue, unless it expired
+ *
+ * Its bytes are released afterwards, letting its connection decode more.
+ * Connections are taken in turns as their coders yield after a quantum, so
+ * one busy sender can't starve the others.
+ */
+void SingleApplicationPrivate::dispatchIncomingMessage( IncomingMessage &incoming )
+{
+    // Any message shows the secondary is alive
+    if( ConnectionInfo *info = connections.find( incoming.connection )){
+        info->lastActivity = heartbeatWheel.currentTick();
+        info->pingSent = false;
+        info->lastSeen = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    // Expired messages are dropped, their acknowledgement tells the sender
+    // so it doesn't wait for its timeout
+    if( incoming.deadline == 0 || QDateTime::currentMSecsSinceEpoch() < incoming.deadline ){
+        slotMessageReceived( incoming.connection, std::move( incoming.message ));
+    } else if( ! ( incoming.message.flags & ( FrameCodec::Batched | FrameCodec::Sequenced ))){
+        if( ConnectionInfo *info = connections.find( incoming.connection ))
+            sendAcknowledgement( info->coder, QByteArray(), FrameCodec::Expired );
+    }
+
+    releaseIncomingMessage( incoming.connection, incoming.footprint );
+}
+
+/**
+ * @brief Releases the bytes flow control accounted for a message
+ */
+void SingleApplicationPrivate::releaseIncomingMessage( ConnectionHandle connection, qint64 footprint )
+{
+    // Without its connection only the shared budget still accounts for it
+    if( ConnectionInfo *info = connections.find( connection ))
+        info->coder->release( footprint );
+    else
+        flowBudget.release( footprint );
+}
+
+/**
+ * @brief Delivers the content of an instance message
+ */
+void SingleApplicationPrivate::deliverMessage( quint64 instanceId, const QByteArray &content )
+{
+    Q_Q( SingleApplication );
+
+    Q_EMIT q->receivedMessage( instanceId, content );
+    if( collectingBatch )
+        receivedBatch.append( SingleApplication::Message{ SingleApplication::MessageType::InstanceMessage, instanceId, content, 0, 0 } );
+}
+
+/**
+ * @brief Dispatches a message decoded from a secondary instance connection
+ * and acknowledges it
+ */
+void SingleApplicationPrivate::slotMessageReceived( ConnectionHandle connection, SingleApplication::Message message )
+{
+    Q_Q( SingleApplication );
+
+    ConnectionInfo *info = connections.find( connection );
+    if( info == nullptr )
+        return;
+
+    // Posted messages are acknowledged cumulatively, once per burst of frames
+    if( message.flags & FrameCodec::Sequenced ){
+        if( ! acceptSequence( *info, message.sequence ))
+            return;
+
+        if( ! info->acknowledgementPending ){
+            info->acknowledgementPending = true;
+            QMetaObject::invokeMethod( this, [connection, this](){ sendSequenceAcknowledgement( connection ); }, Qt::QueuedConnection );
+        }
+    }
+
+    QByteArray reply;
+
+    switch( message.type ){
+    case SingleApplication::MessageType::NewInstance:
+        readIdentity( message.content, *info );
+        info->capabilities = MessageCoder::handshakeCapabilities( message.content );
+        if( ! info->heartbeat && ( info->capabilities & FrameCodec::Heartbeats )){
+            info->heartbeat = true;
+            scheduleHeartbeat( connection, *info );
+        }
+        // Switch to the highest protocol version both instances support and
+        // acknowledge with our own handshake, already using that version
+        {
+            MessageCoder *connectionCoder = info->coder;
+            const QByteArray handshake = message.content;
+            QMetaObject::invokeMethod( connectionCoder, [connectionCoder, handshake](){ connectionCoder->negotiate( handshake ); });
+        }
+        reply = handshake( info->instanceId );
+        Q_EMIT q->instanceStarted();
+        break;
+    case SingleApplication::MessageType::InstanceMessage:
+        if( message.flags & FrameCodec::SharedPayload ){
+            // Let the secondary fall back to sending the content inline
+            reply = QByteArray( 1, receiveSharedMessage( connection, *info, message.content ) ? '\1' : '\0' );
+            break;
+        }
+        deliverMessage( info->instanceId, message.content );
+        break;
+    case SingleApplication::MessageType::TypedMessage:
+        receiveTypedMessage( info->instanceId, message.content );
+        break;
+    case SingleApplication::MessageType::StreamData:
+        // Chunks are not acknowledged, the sender is held back by the socket
+        receiveStreamChunk( connection, *info, std::move( message.content ));
+        return;
+    case SingleApplication::MessageType::StreamEnd:
+        if( info->stream )
+            info->stream->finish();
+        info->stream = nullptr;
+        info->streaming = false;
+        break;
+    case SingleApplication::MessageType::PrimaryPidRequest:
+        reply = QByteArray( sizeof( qint64 ), Qt::Uninitialized );
+        qToBigEndian<qint64>( QCoreApplication::applicationPid(), reply.data() );
+        break;
+    case SingleApplication::MessageType::PrimaryUserRequest:
+        reply = getUsername().toUtf8();
+        break;
+    case SingleApplication::MessageType::InstancesRequest:
+        reply = encodeInstances( instances() );
+        break;
+    case SingleApplication::MessageType::Subscribe:
+    case SingleApplication::MessageType::Unsubscribe:
+        // Topic messages are not acknowledged
+        subscribeConnection( connection, *info, message.content, message.type == SingleApplication::MessageType::Subscribe );
+        return;
+    case SingleApplication::MessageType::Publish:
+        // The coder passes publications on as whole frames
+        routePublication( message.content );
+        return;
+    default:
+        return;
+    }
+
+    // A batch is acknowledged once, after its last message
+    if( message.flags & ( FrameCodec::Batched | FrameCodec::Sequenced ))
+        return;
+
+    // Receivers spinning an event loop may have let the connection go
+    info = connections.find( connection );
+    if( info != nullptr )
+        sendAcknowledgement( info->coder, reply );
+}
+
+/**
+ * @brief Maps the memfd described by a secondary and delivers its content
+ * @returns false if the memfd could not be mapped
+ */
+bool SingleApplicationPrivate::receiveSharedMessage( ConnectionHandle connection, ConnectionInfo &info, const QByteArray &description )
+{
+    Q_Q( SingleApplication );
+
+    MemfdPayload payload;
+    if( ! payload.map( description, peerPid( info.socket )))
+        return false;
+
+    const quint64 instanceId = info.instanceId;
+
+    // The view shares the pages of the sender
+    static const QMetaMethod sharedMessageSignal = QMetaMethod::fromSignal( &SingleApplication::receivedSharedMessage );
+    if( q->isSignalConnected( sharedMessageSignal )){
+        Q_EMIT q->receivedSharedMessage( instanceId, payload.view() );
+        return true;
+    }
+
+    // Without a receiver for the view the content has to outlive the
+    // mapping. Content the secondary can send inline is refused while the
+    // limits don't allow holding it, larger content couldn't be sent at all.
+    const qint64 length = payload.length();
+    if( length <= FrameCodec::MaxContentLength &&
+        (( connectionFlowLimit >= 0 && length > connectionFlowLimit ) || flowBudget.isExhausted() ))
+        return false;
+
+    // The copy is queued and held like a decoded message of the connection
+    // until it was dispatched. The memfd frame was acknowledged already, so
+    // the copy is flagged as part of a batch.
+    SingleApplication::Message message{ SingleApplication::MessageType::InstanceMessage, instanceId, payload.copy(), FrameCodec::Batched, 0 };
+    info.coder->acquire( MessageCoder::footprint( message ));
+    incomingMessages.push( IncomingMessage{ connection, std::move( message ), 0, 0 } );
+    if( ! drainScheduled.exchange( true ))
+        QMetaObject::invokeMethod( this, [this](){ drainIncomingMessages(); }, Qt::QueuedConnection );
+
+    return true;
+}
+
+/**
+ * @brief Dispatches a typed message to the handler registered for its type
+ */
+void SingleApplicationPrivate::receiveTypedMessage( quint64 instanceId, const QByteArray &content )
+{
+    if( content.size() < static_cast<int>( sizeof( quint32 )))
+        return;
+
+    const auto handler = typedMessageHandlers.constFind( qFromBigEndian<quint32>( content.constData() ));
+    if( handler == typedMessageHandlers.cend() )
+        return;
+
+    // The handler only decodes the value, so a view of the content suffices
+    ( *handler )( instanceId, QByteArray::fromRawData( content.constData() + sizeof( quint32 ), content.size() - static_cast<int>( sizeof( quint32 ))));
+}
+
+/**
+ * @brief Returns the process id of the peer of a local socket
+ */
+qint64 SingleApplicationPrivate::peerPid( QLocalSocket *socket )
+{
+#ifdef Q_OS_LINUX
+    struct ucred credentials;
+    socklen_t length = sizeof( credentials );
+    if( ::getsockopt( static_cast<int>( socket->socketDescriptor() ), SOL_SOCKET, SO_PEERCRED, &credentials, &length ) == 0 )
+        return credentials.pid;
+#else
+    Q_UNUSED( socket );
+#endif
+    return -1;
+}
+
+/**
+ * @brief Records the sequence number of a posted message
+ * @returns false if the message is a duplicate that was already delivered
+ */
+bool SingleApplicationPrivate::acceptSequence( ConnectionInfo &info, quint32 sequence )
+{
+    if( ! isSequenceBefore( info.receivedSequence, sequence ) || info.selectiveSequences.contains( sequence ))
+        return false;
+
+    if( sequence != info.receivedSequence + 1 ){
+        // A message went missing, remember what arrived after the gap
+        info.selectiveSequences.insert( std::upper_bound( info.selectiveSequences.begin(), info.selectiveSequences.end(), sequence, isSequenceBefore ), sequence );
+        return true;
+    }
+
+    info.receivedSequence = sequence;
+    while( ! info.selectiveSequences.isEmpty() && info.selectiveSequences.constFirst() == info.receivedSequence + 1 )
+        info.receivedSequence = info.selectiveSequences.takeFirst();
+
+    return true;
+}
+
+void SingleApplicationPrivate::sendSequenceAcknowledgement( ConnectionHandle connection )
+{
+    ConnectionInfo *info = connections.find( connection );
+    if( info == nullptr )
+        return;
+
+    info->acknowledgementPending = false;
+
+    QByteArray selective( info->selectiveSequences.size() * 4, Qt::Uninitialized );
+    for( int i = 0; i < info->selectiveSequences.size(); ++i )
+        qToBigEndian<quint32>( info->selectiveSequences.at( i ), selective.data() + i * 4 );
+
+    sendAcknowledgement( info->coder, selective, FrameCodec::Sequenced, info->receivedSequence );
+}
+
+void SingleApplicationPrivate::receiveStreamChunk( ConnectionHandle connection, ConnectionInfo &info, QByteArray chunk )
+{
+    Q_Q( SingleApplication );
+
+    if( ! info.streaming ){
+        info.streaming = true;
+
+        // Nobody would ever read the stream, so it isn't buffered at all
+        static const QMetaMethod streamSignal = QMetaMethod::fromSignal( &SingleApplication::receivedStream );
+        if( ! q->isSignalConnected( streamSignal )){
+            qWarning() << "SingleApplication: Discarding a stream, nothing is connected to receivedStream()";
+            return;
+        }
+
+        info.stream = new StreamDevice( StreamBufferSize, this );
+        tuneSocketBuffers( info.socket );
+
+        // Reading from a full stream, or deleting it, lets the sender continue
+        QObject::connect( info.stream, &StreamDevice::drained, this,
+            [connection, this](){ resumeConnection( connection ); }, Qt::QueuedConnection );
+        QObject::connect( info.stream, &QObject::destroyed, this,
+            [connection, this](){ resumeConnection( connection ); }, Qt::QueuedConnection );
+
+        Q_EMIT q->receivedStream( info.instanceId, info.stream );
+    }
+
+    // Discarded, or the receiver deleted the stream to discard the rest of it
+    if( ! info.stream )
+        return;
+
+    info.stream->append( std::move( chunk ));
+    if( info.stream && info.stream->isFull() )
+        info.coder->pause();
+}
+
+void SingleApplicationPrivate::resumeConnection( ConnectionHandle connection )
+{
+    ConnectionInfo *info = connections.find( connection );
+    if( info == nullptr || ! info->coder->isPaused() )
+        return;
+
+    if( info->stream && info->stream->isFull() )
+        return;
+
+    info->coder->resume();
+}
+
+void SingleApplicationPrivate::slotConnectionDisconnected( ConnectionHandle connection )
+{
+    ConnectionInfo *info = connections.find( connection );
+    if( info == nullptr )
+        return;
+
+    // Frames still buffered in the socket are decoded first, also behind a
+    // paused or throttled connection or one that gave the others a turn
+    info->disconnected = true;
+    info->coder->notifyWhenIdle();
+}
+
+void SingleApplicationPrivate::recordStartupPhase( const char *name, qint64 start )
+{
+    startupPhases.append( SingleApplication::StartupPhase{ QString::fromLatin1( name ), start, startupTimer.nsecsElapsed() - start } );
+}
+
+/**
+ * @brief Writes the startup phases as a Chrome trace if requested
+ *
+ * SINGLEAPPLICATION_TRACE names the file to write, `%p` in it is replaced
+ * with the process id so every instance of a launch can write its own
+ * file. Events are timestamped with the wall clock, so the traces of
+ * several instances line up once merged.
+ */
+void SingleApplicationPrivate::writeStartupTrace() const
+{
+    QString path = QString::fromLocal8Bit( qgetenv( "SINGLEAPPLICATION_TRACE" ));
+    if( path.isEmpty() )
+        return;
+
+    const qint64 pid = SingleApplication::app_t::applicationPid();
+    path.replace( QStringLiteral( "%p" ), QString::number( pid ));
+
+    QJsonArray events;
+    QJsonObject process;
+    process.insert( QStringLiteral( "name" ), QStringLiteral( "process_name" ));
+    process.insert( QStringLiteral( "ph" ), QStringLiteral( "M" ));
+    process.insert( QStringLiteral( "pid" ), static_cast<double>( pid ));
+    process.insert( QStringLiteral( "args" ), QJsonObject{
+        { QStringLiteral( "name" ), SingleApplication::app_t::applicationName() + ( serverThread ? QStringLiteral( " (primary)" ) : QStringLiteral( " (secondary)" )) }
+    });
+    events.append( process );
+
+    for( const SingleApplication::StartupPhase &phase : startupPhases ){
+        QJsonObject event;
+        event.insert( QStringLiteral( "name" ), phase.name );
+        event.insert( QStringLiteral( "cat" ), QStringLiteral( "SingleApplication" ));
+        event.insert( QStringLiteral( "ph" ), QStringLiteral( "X" ));
+        // Chrome traces count in microseconds
+        event.insert( QStringLiteral( "ts" ), static_cast<double>( startupEpoch * 1000 + phase.start / 1000 ));
+        event.insert( QStringLiteral( "dur" ), static_cast<double>( phase.duration ) / 1000 );
+        event.insert( QStringLiteral( "pid" ), static_cast<double>( pid ));
+        event.insert( QStringLiteral( "tid" ), 0 );
+        events.append( event );
+    }
+
+    QFile file( path );
+    if( ! file.open( QIODevice::WriteOnly | QIODevice::Truncate )){
+        qWarning() << "SingleApplication: Failed to write the startup trace to" << path;
+        return;
+    }
+    file.write( QJsonDocument( QJsonObject{ { QStringLiteral( "traceEvents" ), events } } ).toJson( QJsonDocument::Compact ));
 }
 
 void SingleApplicationPrivate::addAppData(const QString &data)
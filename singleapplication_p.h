@@ -33,73 +33,197 @@
 #ifndef SINGLEAPPLICATION_P_H
 #define SINGLEAPPLICATION_P_H
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QLockFile>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
 #include <QtCore/QSharedMemory>
+#include <QtCore/QTimer>
 #include <QtNetwork/QLocalServer>
 #include <QtNetwork/QLocalSocket>
 
 #include "singleapplication.h"
 #include "message_coder.h"
-#include "singleapplicationmessage.h"
 #include "serverthread.h"
+#include "streamdevice.h"
+#include "memfdpayload.h"
+#include "mpscqueue.h"
+#include "slabtable.h"
+#include "timerwheel.h"
 
-struct InstancesInfo {
-    bool primary;
-    quint32 secondary;
-    qint64 primaryPid;
-    char primaryUser[128];
-    quint16 checksum; // Must be the last field
-};
+#if defined( Q_OS_LINUX ) && QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+#define SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+#endif
 
 struct ConnectionInfo {
-    quint32 instanceId = 0;
-    MessageCoder *coder;
+    quint64 instanceId = 0;
+    QLocalSocket *socket = nullptr;
+    MessageCoder *coder = nullptr;
+    QPointer<StreamDevice> stream;
+    bool streaming = false;
+    quint32 receivedSequence = 0;
+    QList<quint32> selectiveSequences;
+    bool acknowledgementPending = false;
+    bool disconnected = false;
+    quint32 capabilities = 0; ///< Capabilities announced by the secondary
+    bool heartbeat = false; ///< Whether the secondary is pinged
+    bool pingSent = false;
+    quint64 lastActivity = 0; ///< Heartbeat tick of the last message received
+    qint64 pid = -1;
+    QString user;
+    qint64 startTime = 0;
+    qint64 lastSeen = 0;
+    QList<QByteArray> topics; ///< Topics the secondary subscribed to
+};
+
+using ConnectionTable = SlabTable<ConnectionInfo>;
+using ConnectionHandle = ConnectionTable::Handle;
+
+struct IncomingMessage {
+    ConnectionHandle connection;
+    SingleApplication::Message message;
+    qint64 footprint; ///< Bytes accounted by flow control
+    qint64 deadline; ///< Milliseconds since the epoch, 0 if the message doesn't expire
+};
+
+struct PostedMessage {
+    QByteArray content;
+    qint64 resent; ///< Milliseconds since the epoch it was last sent again at, 0 if it wasn't
 };
 
 class SingleApplicationPrivate : public QObject {
 Q_OBJECT
 public:
-    enum ConnectionStage : quint8 {
-        StageInitHeader = 0,
-        StageInitBody = 1,
-        StageConnectedHeader = 2,
-        StageConnectedBody = 3,
-    };
     Q_DECLARE_PUBLIC(SingleApplication)
 
+    static constexpr qint64 StreamChunkSize = 256 * 1024;
+    static constexpr qint64 StreamBufferSize = 4 * StreamChunkSize;
+    static constexpr int SocketBufferSize = 1024 * 1024;
+    static constexpr qint64 PushBufferSize = 4 * FrameCodec::MaxFrameSize; ///< Unwritten bytes from which pushes to a secondary are refused
+    static constexpr int HeartbeatTicks = 8; ///< Ticks of the heartbeat wheel per interval
+    static constexpr uint ProbeTimeout = 100; ///< Milliseconds a server left behind has to accept a connection
+    static constexpr qint64 RetransmitInterval = 100; ///< Milliseconds before a message reported missing is sent again
+
     SingleApplicationPrivate( SingleApplication *q_ptr );
     ~SingleApplicationPrivate() override;
 
     static QString getUsername();
     void genBlockServerName();
+    static QString blockServerNameFor( SingleApplication::Options options, const QStringList &appDataList, const QString &applicationName, const QString &applicationFilePath, const QString &username );
+    static QString lockFilePath( const QString &blockServerName );
+    static bool forwardToPrimary( const QString &blockServerName, SingleApplication::Options options, const QByteArray &message, int timeout );
     void initializeMemoryBlock() const;
+    bool useAbstractNamespace() const;
+    static bool isCurrentUser( QLocalSocket *socket );
+    bool acquirePrimaryLock();
+    void releasePrimaryLock();
     bool connectToPrimary( uint timeout );
     bool startPrimary( uint timeout );
     void notifySecondaryStart( uint timeout );
-    bool sendApplicationMessage( SingleApplication::MessageType messageType, QByteArray content, uint timeout );
-//    bool sendApplicationMessage( SingleApplication::MessageType messageType, QByteArray content, uint timeout, SingleApplicationMessage &response );
-    quint16 blockChecksum() const;
-    qint64 primaryPid() const;
-    QString primaryUser() const;
-    bool isFrameComplete(QLocalSocket *sock);
-    void readMessageHeader(QLocalSocket *socket, ConnectionStage nextStage);
-    void readInitMessageBody(QLocalSocket *socket);
-    static void randomSleep();
+    bool sendApplicationMessage( SingleApplication::MessageType messageType, QByteArray content, uint timeout,
+                                 SingleApplication::MessagePriority priority = SingleApplication::MessagePriority::Normal, int timeToLive = -1 );
+    bool sendApplicationMessages( SingleApplication::MessageType messageType, const QList<QByteArray> &contents, uint timeout, quint8 flags = 0 );
+    bool sendSharedMessage( const QByteArray &content, uint timeout, bool &rejected, const QByteArray &envelope );
+    bool receiveSharedMessage( ConnectionHandle connection, ConnectionInfo &info, const QByteArray &description );
+    void receiveTypedMessage( quint64 instanceId, const QByteArray &content );
+    void decompress( ConnectionHandle connection, const QByteArray &content );
+    static qint64 peerPid( QLocalSocket *socket );
+    bool waitForReply( SingleApplication::MessageType type, uint timeout, SingleApplication::Message &reply );
+    bool postApplicationMessage( QByteArray content, uint timeout );
+    bool waitForPostedMessages( int maxInFlight, uint timeout );
+    void acknowledgePostedMessages( quint32 sequence, const QByteArray &selective );
+    static bool isSequenceBefore( quint32 sequence, quint32 other );
+    static bool acceptSequence( ConnectionInfo &info, quint32 sequence );
+    void sendSequenceAcknowledgement( ConnectionHandle connection );
+    MessageCoder *createCoder( QLocalSocket *socket ) const;
+    void setCompressionThreshold( qint64 threshold );
+    void setIoThreadCount( int threads );
+    void setFlowControlLimits( qint64 connectionBytes, qint64 totalBytes );
+    QThread *nextIoThread();
+    void drainIncomingMessages();
+    void dispatchIncomingMessage( IncomingMessage &incoming );
+    void releaseIncomingMessage( ConnectionHandle connection, qint64 footprint );
+    void removeConnection( ConnectionHandle connection );
+    QByteArray encodePush( SingleApplication::MessageType type, const QByteArray &content ) const;
+    bool sendToInstance( quint64 instanceId, const QByteArray &content );
+    int broadcast( const QByteArray &content );
+    bool setSubscribed( const QString &topic, bool subscribed, int timeout );
+    bool publish( const QString &topic, const QByteArray &payload, int timeout );
+    bool sendTopicMessage( SingleApplication::MessageType type, const QByteArray &content, uint timeout );
+    void subscribeConnection( ConnectionHandle connection, ConnectionInfo &info, const QByteArray &topic, bool subscribed );
+    void routePublication( const QByteArray &frame );
+    void deliverPublication( const QByteArray &content );
+    static int publicationTopicLength( const QByteArray &content );
+    void setHeartbeatInterval( int msecs );
+    void scheduleHeartbeat( ConnectionHandle connection, ConnectionInfo &info );
+    void checkHeartbeat( ConnectionHandle connection );
+    void deliverMessage( quint64 instanceId, const QByteArray &content );
+    void sendAcknowledgement( MessageCoder *connectionCoder, const QByteArray &content, quint8 flags = 0, quint32 sequence = 0 );
+    bool sendApplicationStream( QIODevice *device, uint timeout );
+    void receiveStreamChunk( ConnectionHandle connection, ConnectionInfo &info, QByteArray chunk );
+    void resumeConnection( ConnectionHandle connection );
+    static void tuneSocketBuffers( QLocalSocket *socket );
+    qint64 primaryPid();
+    QString primaryUser();
+    bool queryPrimary( SingleApplication::MessageType request, QByteArray &reply );
+    QByteArray handshake( quint64 instanceId ) const;
+    static void readIdentity( const QByteArray &handshake, ConnectionInfo &info );
+    QList<SingleApplication::InstanceInfo> instances();
+    static QByteArray encodeInstances( const QList<SingleApplication::InstanceInfo> &instances );
+    static QList<SingleApplication::InstanceInfo> decodeInstances( const QByteArray &data );
+    void recordStartupPhase( const char *name, qint64 start );
+    void writeStartupTrace() const;
     void addAppData(const QString &data);
     QStringList appData() const;
 
     SingleApplication *q_ptr;
     QLocalSocket *socket;
+    MessageCoder *coder;
     QLocalServer *server;
     ServerThread *serverThread;
-    quint32 instanceNumber;
-    quint32 instanceCounter;
+    quint64 instanceNumber;
+    quint64 instanceCounter = 0;
     QString blockServerName;
+#ifdef Q_OS_UNIX
+    int lockDescriptor = -1;
+#else
+    QLockFile *lockFile = nullptr;
+#endif
     SingleApplication::Options options;
-    QMap<QLocalSocket*, ConnectionInfo> connectionMap;
+    ConnectionTable connections;
+    QHash<quint64, ConnectionHandle> instanceConnections;
     QStringList appDataList;
+    QElapsedTimer startupTimer;
+    qint64 startupEpoch = 0;
+    QList<SingleApplication::StartupPhase> startupPhases;
+    QList<SingleApplication::Message> replies;
+    QMap<quint32, PostedMessage> postedMessages;
+    quint32 nextSequence = 1;
+    int messageWindow = 64;
+    qint64 compressionThreshold = -1;
+    MpscQueue<IncomingMessage> incomingMessages;
+    std::atomic<bool> drainScheduled{ false };
+    bool collectingBatch = false;
+    QList<SingleApplication::Message> receivedBatch;
+    QList<QThread*> ioThreads;
+    int ioThreadCount = 0;
+    int nextIoThreadIndex = 0;
+    qint64 connectionFlowLimit = 8 * 1024 * 1024;
+    qint64 totalFlowLimit = 64 * 1024 * 1024;
+    FlowBudget flowBudget;
+    int heartbeatInterval = 0;
+    QTimer *heartbeatTimer = nullptr;
+    TimerWheel<ConnectionHandle> heartbeatWheel;
+    QHash<QByteArray, QList<ConnectionHandle>> topicSubscribers;
+    QSet<QByteArray> localTopics;
+    QHash<quint32, std::function<void( quint64, const QByteArray & )>> typedMessageHandlers;
 
 public Q_SLOTS:
-    void slotConnectionEstablished();
+    void slotConnectionEstablished( QLocalSocket *nextConnSocket );
+    void slotMessageReceived( ConnectionHandle connection, SingleApplication::Message message );
+    void slotReplyReceived( SingleApplication::Message message );
+    void slotConnectionDisconnected( ConnectionHandle connection );
     void pingSecondaryInstances();
 };
 #endif // SINGLEAPPLICATION_P_H
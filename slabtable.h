@@ -0,0 +1,178 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+
+#ifndef SLABTABLE_H
+#define SLABTABLE_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <QtCore/QtGlobal>
+
+/**
+ * @brief Table of values addressed by handles, allocated in fixed slabs
+ *
+ * A handle combines the index of a slot with the generation of its value,
+ * so lookups take constant time and a handle of a removed value never finds
+ * the value that reused its slot. Values don't move once inserted, pointers
+ * to them stay valid until they are removed.
+ */
+template<typename T>
+class SlabTable {
+public:
+    using Handle = quint64;
+
+    /**
+     * @brief Handle that never refers to a value
+     */
+    static constexpr Handle InvalidHandle = 0;
+
+    SlabTable() : count( 0 ) {}
+
+    SlabTable( const SlabTable & ) = delete;
+    SlabTable &operator=( const SlabTable & ) = delete;
+
+    /**
+     * @brief Stores a value in a free slot
+     * @return The handle of the value
+     */
+    Handle insert( T value )
+    {
+        if( freeSlots.empty() ){
+            const quint32 first = static_cast<quint32>( slabs.size() * SlabSize );
+            slabs.emplace_back( new Slot[SlabSize] );
+            // Lower slots are handed out first
+            for( quint32 i = SlabSize; i > 0; --i )
+                freeSlots.push_back( first + i - 1 );
+        }
+
+        const quint32 index = freeSlots.back();
+        freeSlots.pop_back();
+
+        Slot &slot = slotAt( index );
+        slot.used = true;
+        slot.value = std::move( value );
+        ++count;
+        return ( static_cast<Handle>( slot.generation ) << 32 ) | index;
+    }
+
+    /**
+     * @brief Returns the value of a handle, or nullptr if it was removed
+     */
+    T *find( Handle handle )
+    {
+        const quint32 index = static_cast<quint32>( handle );
+        if( index >= slabs.size() * SlabSize )
+            return nullptr;
+
+        Slot &slot = slotAt( index );
+        if( ! slot.used || slot.generation != static_cast<quint32>( handle >> 32 ))
+            return nullptr;
+        return &slot.value;
+    }
+
+    /**
+     * @brief Removes the value of a handle and frees its slot
+     * @return false if the handle was already removed
+     */
+    bool remove( Handle handle )
+    {
+        if( find( handle ) == nullptr )
+            return false;
+
+        const quint32 index = static_cast<quint32>( handle );
+        Slot &slot = slotAt( index );
+        slot.used = false;
+        slot.value = T();
+        // Generation 0 is skipped, keeping InvalidHandle invalid
+        if( ++slot.generation == 0 )
+            slot.generation = 1;
+        freeSlots.push_back( index );
+        --count;
+        return true;
+    }
+
+    /**
+     * @brief Returns the number of values in the table
+     */
+    int size() const
+    {
+        return count;
+    }
+
+    /**
+     * @brief Calls a function with the handle and the value of every entry
+     *
+     * The function must not insert or remove values.
+     */
+    template<typename Function>
+    void forEach( Function function )
+    {
+        for( std::size_t i = 0; i < slabs.size(); ++i ){
+            for( quint32 j = 0; j < SlabSize; ++j ){
+                Slot &slot = slabs[i][j];
+                if( slot.used )
+                    function(( static_cast<Handle>( slot.generation ) << 32 ) | ( i * SlabSize + j ), slot.value );
+            }
+        }
+    }
+
+private:
+    static constexpr quint32 SlabSize = 64;
+
+    struct Slot {
+        Slot() : generation( 1 ), used( false ) {}
+
+        quint32 generation;
+        bool used;
+        T value;
+    };
+
+    Slot &slotAt( quint32 index )
+    {
+        return slabs[index / SlabSize][index % SlabSize];
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> slabs;
+    std::vector<quint32> freeSlots;
+    int count;
+};
+
+template<typename T>
+constexpr typename SlabTable<T>::Handle SlabTable<T>::InvalidHandle;
+
+template<typename T>
+constexpr quint32 SlabTable<T>::SlabSize;
+
+#endif // SLABTABLE_H
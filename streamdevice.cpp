@@ -0,0 +1,127 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cstring>
+
+#include "streamdevice.h"
+
+StreamDevice::StreamDevice( qint64 bufferLimit, QObject *parent )
+    : QIODevice( parent ), chunkOffset( 0 ), buffered( 0 ), bufferLimit( bufferLimit ), finished( false )
+{
+    open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+}
+
+bool StreamDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 StreamDevice::bytesAvailable() const
+{
+    return buffered + QIODevice::bytesAvailable();
+}
+
+bool StreamDevice::atEnd() const
+{
+    return finished && QIODevice::atEnd();
+}
+
+void StreamDevice::append( QByteArray chunk )
+{
+    if( finished || chunk.isEmpty() )
+        return;
+
+    buffered += chunk.size();
+    chunks.append( std::move( chunk ));
+    Q_EMIT readyRead();
+}
+
+void StreamDevice::finish()
+{
+    if( finished )
+        return;
+
+    finished = true;
+    Q_EMIT readChannelFinished();
+
+    // Nothing left to read, so nobody would ever trigger the deletion
+    if( buffered == 0 )
+        deleteLater();
+}
+
+void StreamDevice::abort( const QString &reason )
+{
+    if( finished )
+        return;
+
+    setErrorString( reason );
+    finish();
+}
+
+bool StreamDevice::isFull() const
+{
+    return buffered >= bufferLimit;
+}
+
+bool StreamDevice::isFinished() const
+{
+    return finished;
+}
+
+qint64 StreamDevice::readData( char *data, qint64 maxSize )
+{
+    const bool wasFull = isFull();
+    qint64 read = 0;
+
+    while( read < maxSize && ! chunks.isEmpty() ){
+        const QByteArray &chunk = chunks.constFirst();
+        const qint64 count = qMin( maxSize - read, chunk.size() - chunkOffset );
+        memcpy( data + read, chunk.constData() + chunkOffset, static_cast<size_t>( count ));
+        read += count;
+        chunkOffset += count;
+        if( chunkOffset == chunk.size() ){
+            chunks.removeFirst();
+            chunkOffset = 0;
+        }
+    }
+    buffered -= read;
+
+    if( wasFull && ! isFull() )
+        Q_EMIT drained();
+
+    if( finished && buffered == 0 ){
+        // The stream has been consumed entirely
+        deleteLater();
+        if( read == 0 )
+            return -1;
+    }
+
+    return read;
+}
+
+qint64 StreamDevice::writeData( const char *data, qint64 maxSize )
+{
+    Q_UNUSED( data );
+    Q_UNUSED( maxSize );
+    return -1;
+}
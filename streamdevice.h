@@ -0,0 +1,102 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#ifndef STREAMDEVICE_H
+#define STREAMDEVICE_H
+
+#include <QtCore/QIODevice>
+#include <QtCore/QList>
+#include <QtCore/QByteArray>
+
+/**
+ * @brief Read-only sequential device handed to the receiver of a stream
+ *
+ * Buffers the chunks of a stream as they are decoded until they are read.
+ */
+class StreamDevice : public QIODevice {
+Q_OBJECT
+public:
+    /**
+     * @brief Constructs an open, empty stream
+     * @param bufferLimit Amount of buffered data above which the stream is
+     * considered full and the sender should be held back.
+     */
+    explicit StreamDevice( qint64 bufferLimit, QObject *parent = nullptr );
+
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override;
+
+    /**
+     * @brief Appends a chunk of the stream and emits `readyRead()`
+     */
+    void append( QByteArray chunk );
+
+    /**
+     * @brief Marks the end of the stream
+     */
+    void finish();
+
+    /**
+     * @brief Ends the stream prematurely, e.g. if the sender disconnected
+     */
+    void abort( const QString &reason );
+
+    /**
+     * @brief Returns whether the buffered data reached the buffer limit
+     */
+    bool isFull() const;
+
+    /**
+     * @brief Returns whether the end of the stream has been received
+     */
+    bool isFinished() const;
+
+Q_SIGNALS:
+    /**
+     * @brief Emitted when reading made room in a full buffer
+     */
+    void drained();
+
+protected:
+    qint64 readData( char *data, qint64 maxSize ) override;
+    qint64 writeData( const char *data, qint64 maxSize ) override;
+
+private:
+    QList<QByteArray> chunks; ///< Buffered chunks, the first one partially read.
+    qint64 chunkOffset; ///< Read position within the first chunk.
+    qint64 buffered; ///< Unread bytes across all chunks.
+    qint64 bufferLimit; ///< Amount of buffered bytes considered full.
+    bool finished; ///< Whether the stream has ended.
+};
+
+#endif // STREAMDEVICE_H
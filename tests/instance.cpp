@@ -0,0 +1,325 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Secondary instance started by the tests, which run as the primary instance.
+// Usage: instance <application name> <options> <command> [arguments...]
+// It exits with 0 once the command succeeded.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QByteArrayList>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+
+#include "testing.h"
+
+namespace {
+    // Lines printed to stdout are read by the test
+    void print( const QByteArray &line )
+    {
+        std::fputs( line.constData(), stdout );
+        std::fputc( '\n', stdout );
+        std::fflush( stdout );
+    }
+
+    // post <count> <window> [size]: posts the numbers up to count, in order,
+    // padded to size bytes
+    int post( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 0 ).toInt();
+        app.setMessageWindow( arguments.value( 1 ).toInt() );
+        const int size = arguments.value( 2 ).toInt();
+        for( int i = 0; i < count; ++i ){
+            if( ! app.postMessage( QByteArray::number( i ).leftJustified( size, ' ' ), 5000 ) )
+                return 1;
+        }
+        return app.flushMessages( 10000 ) ? 0 : 1;
+    }
+
+    // send <count> [batch]: sends the numbers up to count, waiting for each
+    // to be acknowledged, or all of them as one batch
+    int send( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 0 ).toInt();
+        if( arguments.value( 1 ) == QLatin1String( "batch" )){
+            QList<QByteArray> messages;
+            for( int i = 0; i < count; ++i )
+                messages.append( QByteArray::number( i ));
+            return app.sendMessages( messages, 5000 ) ? 0 : 1;
+        }
+        for( int i = 0; i < count; ++i ){
+            if( ! app.sendMessage( QByteArray::number( i ), 5000 ) )
+                return 1;
+        }
+        return 0;
+    }
+
+    // stream <size>: streams size bytes counting up modulo 251
+    int stream( SingleApplication &app, const QStringList &arguments )
+    {
+        QByteArray data( arguments.value( 0 ).toInt(), Qt::Uninitialized );
+        for( int i = 0; i < data.size(); ++i )
+            data[i] = static_cast<char>( i % 251 );
+        QBuffer device( &data );
+        device.open( QIODevice::ReadOnly );
+        return app.sendStream( &device, 5000 ) ? 0 : 1;
+    }
+
+    // large <size>: sends a single message of size bytes counting up modulo 251
+    int large( SingleApplication &app, const QStringList &arguments )
+    {
+        QByteArray message( arguments.value( 0 ).toInt(), Qt::Uninitialized );
+        for( int i = 0; i < message.size(); ++i )
+            message[i] = static_cast<char>( i % 251 );
+        return app.sendMessage( message, 5000 ) ? 0 : 1;
+    }
+
+    // typed <count>: sends the points (i, -i) up to count as typed messages,
+    // each followed by a value of a type the primary instance doesn't handle
+    int typed( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 0 ).toInt();
+        for( int i = 0; i < count; ++i ){
+            if( ! app.sendTyped( Testing::Point{ i, -i }, 5000 ) || ! app.sendTyped( Testing::Unhandled{ quint64( i ) }, 5000 ))
+                return 1;
+        }
+        return 0;
+    }
+
+    // expire <time to live>: waits for a line on stdin, then sends a message
+    // that should expire, and prints how long sendMessage() took in ms
+    int expire( SingleApplication &app, const QStringList &arguments )
+    {
+        print( "ready" );
+        char line[16];
+        if( std::fgets( line, sizeof( line ), stdin ) == nullptr )
+            return 1;
+
+        QElapsedTimer timer;
+        timer.start();
+        const bool sent = app.sendMessage( "expire", 10000, SingleApplication::MessagePriority::Normal, arguments.value( 0 ).toInt() );
+        print( QByteArray::number( timer.elapsed() ));
+        return sent ? 1 : 0;
+    }
+
+    // latency <count> <priority>: sends count messages of the priority and
+    // prints the median and the 99th percentile of their round trips in ms
+    int latency( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 0 ).toInt();
+        const SingleApplication::MessagePriority priority = static_cast<SingleApplication::MessagePriority>( arguments.value( 1 ).toInt() );
+        std::vector<double> roundTrips;
+        for( int i = 0; i < count; ++i ){
+            QElapsedTimer timer;
+            timer.start();
+            if( ! app.sendMessage( "control", 5000, priority ))
+                return 1;
+            roundTrips.push_back( timer.nsecsElapsed() / 1e6 );
+        }
+        std::sort( roundTrips.begin(), roundTrips.end() );
+        print( QByteArray::number( roundTrips[roundTrips.size() / 2], 'f', 2 ) + ' ' +
+               QByteArray::number( roundTrips[( roundTrips.size() - 1 ) * 99 / 100], 'f', 2 ));
+        return 0;
+    }
+
+    // idle <msecs>: prints the instance id and runs the event loop for msecs
+    int idle( SingleApplication &app, const QStringList &arguments )
+    {
+        print( QByteArray::number( app.instanceId() ));
+        QTimer::singleShot( arguments.value( 0 ).toInt(), &app, &QCoreApplication::quit );
+        return app.exec();
+    }
+
+    // elect <msecs>: prints whether the instance became the primary or a
+    // secondary instance, the primary then runs the event loop for msecs
+    int elect( SingleApplication &app, const QStringList &arguments )
+    {
+        if( app.isSecondary() ){
+            print( "secondary" );
+            return 0;
+        }
+        print( "primary" );
+        QTimer::singleShot( arguments.value( 0 ).toInt(), &app, &QCoreApplication::quit );
+        return app.exec();
+    }
+
+    // stall <msecs>: prints the instance id and blocks for msecs without
+    // processing events, like a hung instance
+    int stall( SingleApplication &app, const QStringList &arguments )
+    {
+        print( QByteArray::number( app.instanceId() ));
+        QThread::msleep( arguments.value( 0 ).toULong() );
+        return 0;
+    }
+
+    // identify <msecs>: sends "hello", prints the instance id and the ids
+    // of the instances the primary instance knows, then blocks for msecs
+    int identify( SingleApplication &app, const QStringList &arguments )
+    {
+        if( ! app.sendMessage( "hello", 5000 )) return 1;
+        print( QByteArray::number( app.instanceId() ));
+        QByteArrayList ids;
+        for( const SingleApplication::InstanceInfo &info : app.instances() )
+            ids.append( QByteArray::number( info.id ));
+        print( ids.join( ' ' ));
+        QThread::msleep( arguments.value( 0 ).toULong() );
+        return 0;
+    }
+
+    // receive <count>: prints the instance id and exits once count messages
+    // of the primary instance were received
+    int receive( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 0 ).toInt();
+        int received = 0;
+        QObject::connect( &app, &SingleApplication::receivedMessage, &app, [&app, &received, count]( quint64 instanceId ){
+            if( instanceId == 0 && ++received == count )
+                app.exit( 0 );
+        });
+        QTimer::singleShot( 30000, &app, [&app](){ app.exit( 1 ); });
+        print( QByteArray::number( app.instanceId() ));
+        return app.exec();
+    }
+
+    // pushed <msecs> <count>: prints the instance id, blocks for msecs while
+    // the primary instance pushes count messages, then sends a message and
+    // exits once its acknowledgement and the pushes were received
+    int pushed( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 1 ).toInt();
+        int received = 0;
+        QObject::connect( &app, &SingleApplication::receivedMessage, &app, [&app, &received, count]( quint64 instanceId ){
+            if( instanceId == 0 && ++received == count )
+                app.exit( 0 );
+        });
+        print( QByteArray::number( app.instanceId() ));
+        QThread::msleep( arguments.value( 0 ).toULong() );
+
+        if( ! app.sendMessage( "pushed", 5000 )) return 1;
+        if( received == count ) return 0;
+        QTimer::singleShot( 30000, &app, [&app](){ app.exit( 1 ); });
+        return app.exec();
+    }
+
+    // subscribe <topic> <count>: prints "ready" once subscribed and exits once
+    // count messages were published on the topic
+    int subscribe( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 1 ).toInt();
+        int received = 0;
+        QObject::connect( &app, &SingleApplication::receivedTopicMessage, &app, [&app, &received, count](){
+            if( ++received == count )
+                app.exit( 0 );
+        });
+        if( ! app.subscribe( arguments.value( 0 ), 5000 ))
+            return 1;
+        // A round trip, so the primary instance recorded the subscription
+        app.instances();
+        QTimer::singleShot( 30000, &app, [&app](){ app.exit( 1 ); });
+        print( "ready" );
+        return app.exec();
+    }
+
+    // publish <topic> <count> [size]: publishes the numbers up to count,
+    // padded to size bytes
+    int publish( SingleApplication &app, const QStringList &arguments )
+    {
+        const int count = arguments.value( 1 ).toInt();
+        const int size = arguments.value( 2 ).toInt();
+        for( int i = 0; i < count; ++i ){
+            if( ! app.publish( arguments.value( 0 ), QByteArray::number( i ).leftJustified( size, ' ' ), 5000 ))
+                return 1;
+        }
+        return 0;
+    }
+
+    // relay <topic> <reply topic> <count>: prints "ready" once subscribed,
+    // publishes every message of the topic again on the reply topic and
+    // exits after count messages
+    int relay( SingleApplication &app, const QStringList &arguments )
+    {
+        const QString reply = arguments.value( 1 );
+        const int count = arguments.value( 2 ).toInt();
+        int received = 0;
+        QObject::connect( &app, &SingleApplication::receivedTopicMessage, &app, [&app, &received, reply, count]( const QString &, const QByteArray &message ){
+            if( ! app.publish( reply, message, 5000 ))
+                app.exit( 1 );
+            else if( ++received == count )
+                app.exit( 0 );
+        });
+        if( ! app.subscribe( arguments.value( 0 ), 5000 ))
+            return 1;
+        // A round trip, so the primary instance recorded the subscription
+        app.instances();
+        QTimer::singleShot( 30000, &app, [&app](){ app.exit( 1 ); });
+        print( "ready" );
+        return app.exec();
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc < 4 ) return 2;
+
+    QCoreApplication::setApplicationName( QString::fromLocal8Bit( argv[1] ));
+    const SingleApplication::Options options( QFlag( QByteArray( argv[2] ).toInt() ));
+
+    // forward [message]: forwards the message without constructing the
+    // application and prints whether the primary instance received it
+    if( qstrcmp( argv[3], "forward" ) == 0 ){
+        const QByteArray message = argc > 4 ? QByteArray( argv[4] ) : QByteArray();
+        print( SingleApplication::forwardIfRunning( argc, argv, options, message, 1000 ) ? "forwarded" : "not forwarded" );
+        return 0;
+    }
+
+    SingleApplication app( argc, argv, true, options, 5000 );
+
+    const QStringList arguments = app.arguments().mid( 4 );
+    const QString command = app.arguments().value( 3 );
+
+    // Only elections may make the instance helper the primary instance
+    if( command == QLatin1String( "elect" ) ) return elect( app, arguments );
+    if( ! app.isSecondary() ) return 2;
+
+    if( command == QLatin1String( "post" ) ) return post( app, arguments );
+    if( command == QLatin1String( "send" ) ) return send( app, arguments );
+    if( command == QLatin1String( "stream" ) ) return stream( app, arguments );
+    if( command == QLatin1String( "large" ) ) return large( app, arguments );
+    if( command == QLatin1String( "typed" ) ) return typed( app, arguments );
+    if( command == QLatin1String( "expire" ) ) return expire( app, arguments );
+    if( command == QLatin1String( "latency" ) ) return latency( app, arguments );
+    if( command == QLatin1String( "idle" ) ) return idle( app, arguments );
+    if( command == QLatin1String( "stall" ) ) return stall( app, arguments );
+    if( command == QLatin1String( "identify" ) ) return identify( app, arguments );
+    if( command == QLatin1String( "receive" ) ) return receive( app, arguments );
+    if( command == QLatin1String( "pushed" ) ) return pushed( app, arguments );
+    if( command == QLatin1String( "subscribe" ) ) return subscribe( app, arguments );
+    if( command == QLatin1String( "publish" ) ) return publish( app, arguments );
+    if( command == QLatin1String( "relay" ) ) return relay( app, arguments );
+    return 2;
+}
@@ -0,0 +1,126 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef SINGLEAPPLICATION_TESTING_H
+#define SINGLEAPPLICATION_TESTING_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtCore/QStringList>
+#include <QtTest/QtTest>
+
+#include "singleapplication.h"
+
+// Shared by the tests that run as the primary instance and the instance
+// helper they start as secondary instances. Every test process uses its own
+// application name, so tests running in parallel don't meet.
+namespace Testing {
+    const SingleApplication::Options DefaultOptions = SingleApplication::Mode::User |
+                                                      SingleApplication::Mode::ExcludeAppPath |
+                                                      SingleApplication::Mode::ExcludeAppVersion;
+
+    // Options of the primary instance, the instance helper uses the same
+    inline SingleApplication::Options &options()
+    {
+        static SingleApplication::Options options = DefaultOptions;
+        return options;
+    }
+
+    inline SingleApplication *application()
+    {
+        return static_cast<SingleApplication *>( QCoreApplication::instance() );
+    }
+
+    inline QString applicationName()
+    {
+        return QStringLiteral( "SingleApplicationTest-%1" ).arg( QCoreApplication::applicationPid() );
+    }
+
+#ifdef SINGLEAPPLICATION_INSTANCE
+    // Starts the instance helper running a command, see instance.cpp, by
+    // default with the application name of the test
+    inline void startInstance( QProcess &process, const QStringList &arguments, const QString &applicationName = QString() )
+    {
+        process.setProcessChannelMode( QProcess::ForwardedErrorChannel );
+        process.start( QStringLiteral( SINGLEAPPLICATION_INSTANCE ),
+                       QStringList{ applicationName.isEmpty() ? QCoreApplication::applicationName() : applicationName,
+                                    QString::number( static_cast<int>( options() )) } + arguments );
+    }
+#endif
+
+    // Reads the next line the instance helper printed, spinning the event
+    // loop of the primary instance meanwhile
+    inline QByteArray readLine( QProcess &process, int timeout = 5000 )
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while( ! process.canReadLine() && process.state() != QProcess::NotRunning && timer.elapsed() < timeout )
+            QTest::qWait( 1 );
+        return process.readLine().trimmed();
+    }
+
+    // Waits for the instance helper to exit, spinning the event loop of the
+    // primary instance meanwhile, and returns whether it succeeded
+    inline bool finish( QProcess &process, int timeout = 10000 )
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while( process.state() != QProcess::NotRunning && timer.elapsed() < timeout )
+            QTest::qWait( 1 );
+        if( process.state() != QProcess::NotRunning ){
+            process.kill();
+            process.waitForFinished();
+            return false;
+        }
+        return process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0;
+    }
+
+    // Types sent as typed messages by the instance helper
+    struct Point {
+        qint32 x;
+        qint32 y;
+    };
+
+    struct Unhandled {
+        quint64 value;
+    };
+}
+
+SINGLEAPPLICATION_MESSAGE_TYPE( Testing::Point, 1 )
+SINGLEAPPLICATION_MESSAGE_TYPE( Testing::Unhandled, 2 )
+
+// Runs a test object in a process that is the primary instance
+#define SINGLEAPPLICATION_TEST_MAIN_WITH_OPTIONS( TestObject, instanceOptions ) \
+int main( int argc, char *argv[] ) \
+{ \
+    QCoreApplication::setApplicationName( Testing::applicationName() ); \
+    Testing::options() = instanceOptions; \
+    SingleApplication app( argc, argv, false, Testing::options() ); \
+    TestObject test; \
+    return QTest::qExec( &test, argc, argv ); \
+}
+
+#define SINGLEAPPLICATION_TEST_MAIN( TestObject ) \
+    SINGLEAPPLICATION_TEST_MAIN_WITH_OPTIONS( TestObject, Testing::DefaultOptions )
+
+#endif // SINGLEAPPLICATION_TESTING_H
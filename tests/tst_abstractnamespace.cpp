@@ -0,0 +1,135 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QProcess>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "singleapplication_p.h"
+#include "testing.h"
+
+class TestAbstractNamespace : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifndef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        QSKIP( "The abstract namespace requires Linux and Qt 6.2" );
+#endif
+    }
+
+    // The primary instance listens without a socket file
+    void noSocketFile()
+    {
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        const SingleApplication *app = Testing::application();
+        const QString name = SingleApplicationPrivate::blockServerNameFor( Testing::options(), app->userData(), app->applicationName(),
+                                                                           app->applicationFilePath(), SingleApplicationPrivate::getUsername() );
+        QVERIFY( ! QFile::exists( QDir::temp().filePath( name )));
+
+        QLocalSocket socket;
+        socket.setSocketOptions( QLocalSocket::AbstractNamespaceOption );
+        socket.connectToServer( name );
+        QVERIFY( socket.waitForConnected( 1000 ));
+#endif
+    }
+
+    // Secondary instances find the primary instance in the abstract namespace
+    void message()
+    {
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        QList<QByteArray> received;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "send" ), QStringLiteral( "1" ) });
+        QVERIFY( Testing::finish( instance ));
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first(), QByteArray( "0" ));
+        disconnect( connection );
+#endif
+    }
+
+    // Messages forwarded before the application object exists reach the
+    // primary instance in the abstract namespace too
+    void forward()
+    {
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        QList<QByteArray> received;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "forward" ), QStringLiteral( "forwarded message" ) });
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "forwarded" ));
+        QVERIFY( Testing::finish( instance ));
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first(), QByteArray( "forwarded message" ));
+        disconnect( connection );
+#endif
+    }
+
+    void connectLatency_data()
+    {
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        QTest::addColumn<bool>( "abstract" );
+
+        QTest::newRow( "file system" ) << false;
+        QTest::newRow( "abstract" ) << true;
+#endif
+    }
+
+    // Time to connect to a server and have the connection accepted
+    void connectLatency()
+    {
+#ifdef SINGLEAPPLICATION_ABSTRACT_NAMESPACE
+        QFETCH( bool, abstract );
+        const QString name = QStringLiteral( "tst_abstractnamespace-%1" ).arg( QCoreApplication::applicationPid() );
+        const QLocalServer::SocketOptions serverOptions = abstract ? QLocalServer::AbstractNamespaceOption : QLocalServer::NoOptions;
+        const QLocalSocket::SocketOptions socketOptions = abstract ? QLocalSocket::AbstractNamespaceOption : QLocalSocket::NoOptions;
+
+        QLocalServer::removeServer( name );
+        QLocalServer server;
+        server.setSocketOptions( serverOptions );
+        QVERIFY( server.listen( name ));
+
+        QBENCHMARK {
+            QLocalSocket socket;
+            socket.setSocketOptions( socketOptions );
+            socket.connectToServer( name );
+            QVERIFY( socket.waitForConnected( 1000 ));
+            QVERIFY( server.waitForNewConnection( 1000 ));
+            delete server.nextPendingConnection();
+        }
+#endif
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN_WITH_OPTIONS( TestAbstractNamespace, Testing::DefaultOptions | SingleApplication::Mode::AbstractNamespace )
+#include "tst_abstractnamespace.moc"
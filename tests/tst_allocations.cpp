@@ -0,0 +1,252 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <atomic>
+#include <cstdlib>
+
+#include <QtCore/QBuffer>
+#include <QtTest/QtTest>
+
+#include "frame_codec.h"
+#include "mpscqueue.h"
+
+namespace {
+    std::atomic<bool> counting{ false };
+    std::atomic<int> allocations{ 0 };
+}
+
+// QByteArray allocates with malloc() rather than operator new, so malloc()
+// itself is replaced to count the allocations of the code under test. glibc
+// exports its own implementation under internal names to forward to.
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS
+
+extern "C" {
+    void *__libc_malloc( size_t size );
+    void *__libc_calloc( size_t count, size_t size );
+    void *__libc_realloc( void *pointer, size_t size );
+    void __libc_free( void *pointer );
+}
+
+extern "C" void *malloc( size_t size ) noexcept
+{
+    if( counting ) ++allocations;
+    return __libc_malloc( size );
+}
+
+extern "C" void *calloc( size_t count, size_t size ) noexcept
+{
+    if( counting ) ++allocations;
+    return __libc_calloc( count, size );
+}
+
+extern "C" void *realloc( void *pointer, size_t size ) noexcept
+{
+    if( counting ) ++allocations;
+    return __libc_realloc( pointer, size );
+}
+
+extern "C" void free( void *pointer ) noexcept
+{
+    __libc_free( pointer );
+}
+#endif
+
+namespace {
+    QByteArray encodeFrame( qint64 length )
+    {
+        const QByteArray content( static_cast<int>( length ), 'x' );
+        QByteArray frame;
+        FrameCodec::appendFrame( frame, FrameCodec::Header{ FrameCodec::ProtocolVersion, SingleApplication::MessageType::InstanceMessage, 0, 0, 1, length }, content.constData() );
+        return frame;
+    }
+}
+
+/**
+ * @brief Counts the allocations of receiving a message
+ *
+ * A non-empty message costs exactly one allocation, its content, which the
+ * receiver owns. Queue nodes are recycled once the queue is warm.
+ */
+class TestAllocations : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifndef COUNT_ALLOCATIONS
+        QSKIP( "Counting allocations requires glibc" );
+#endif
+    }
+
+    void completeFrame_data()
+    {
+        QTest::addColumn<qint64>( "length" );
+        QTest::newRow( "empty" ) << qint64( 0 );
+        QTest::newRow( "small" ) << qint64( 32 );
+        QTest::newRow( "medium" ) << qint64( 4096 );
+        QTest::newRow( "largest" ) << FrameCodec::MaxContentLength;
+    }
+
+    void completeFrame()
+    {
+        QFETCH( qint64, length );
+
+        // The first frame lets the device settle any lazily allocated state
+        const QByteArray frame = encodeFrame( length );
+        QByteArray data = frame + frame;
+        QBuffer device( &data );
+        QVERIFY( device.open( QIODevice::ReadOnly | QIODevice::Unbuffered ));
+
+        FrameCodec::Header header;
+        QByteArray content;
+        QCOMPARE( FrameCodec::readFrame( &device, header, content ), FrameCodec::Result::Complete );
+        content = QByteArray();
+
+        allocations = 0;
+        counting = true;
+        const FrameCodec::Result result = FrameCodec::readFrame( &device, header, content );
+        counting = false;
+
+        QCOMPARE( result, FrameCodec::Result::Complete );
+        QCOMPARE( content.size(), static_cast<int>( length ));
+        QCOMPARE( allocations.load(), length == 0 ? 0 : 1 );
+    }
+
+    void partialFrame_data()
+    {
+        completeFrame_data();
+    }
+
+    void partialFrame()
+    {
+        QFETCH( qint64, length );
+
+        // Waiting for the rest of a frame must not cost anything, however
+        // often the socket reports the arrival of more data
+        QByteArray data = encodeFrame( length );
+        data.chop( 1 );
+        QBuffer device( &data );
+        QVERIFY( device.open( QIODevice::ReadOnly | QIODevice::Unbuffered ));
+
+        FrameCodec::Header header;
+        QByteArray content;
+        QCOMPARE( FrameCodec::readFrame( &device, header, content ), FrameCodec::Result::Incomplete );
+
+        allocations = 0;
+        counting = true;
+        for( int i = 0; i < 100; ++i )
+            FrameCodec::readFrame( &device, header, content );
+        counting = false;
+
+        QCOMPARE( allocations.load(), 0 );
+        QVERIFY( content.isNull() );
+        QCOMPARE( device.pos(), qint64( 0 ));
+    }
+
+    void queueNode()
+    {
+        // Handing a message to the main thread reuses the node of the
+        // previous one once the first push allocated it
+        MpscQueue<QByteArray> queue;
+        const QByteArray content( 1024, 'x' );
+        QByteArray popped;
+        queue.push( content );
+        queue.pop( popped );
+
+        allocations = 0;
+        counting = true;
+        for( int i = 0; i < 100; ++i ){
+            queue.push( content );
+            queue.pop( popped );
+        }
+        counting = false;
+
+        QCOMPARE( allocations.load(), 0 );
+        QVERIFY( popped.isSharedWith( content ));
+    }
+
+    void queueBurst()
+    {
+        // Bursts deeper than the spare ring allocate only their excess
+        const int burst = static_cast<int>( MpscQueue<int>::SpareNodes ) + 10;
+        MpscQueue<int> queue;
+        int popped;
+        for( int round = 0; round < 2; ++round ){
+            if( round == 1 ){
+                allocations = 0;
+                counting = true;
+            }
+            for( int i = 0; i < burst; ++i )
+                queue.push( i );
+            while( queue.pop( popped ));
+        }
+        counting = false;
+
+        QCOMPARE( allocations.load(), burst - static_cast<int>( MpscQueue<int>::SpareNodes ));
+    }
+
+    void perMessage_data()
+    {
+        completeFrame_data();
+    }
+
+    void perMessage()
+    {
+        QFETCH( qint64, length );
+
+        // Decoding a frame and handing it to the consumer, as a connection
+        // does, costs the content and nothing else in steady state
+        const QByteArray frame = encodeFrame( length );
+        QByteArray data;
+        for( int i = 0; i < 11; ++i )
+            data += frame;
+        QBuffer device( &data );
+        QVERIFY( device.open( QIODevice::ReadOnly | QIODevice::Unbuffered ));
+
+        MpscQueue<QByteArray> queue;
+        FrameCodec::Header header;
+        QByteArray content;
+        QCOMPARE( FrameCodec::readFrame( &device, header, content ), FrameCodec::Result::Complete );
+        queue.push( std::move( content ));
+        queue.pop( content );
+        content = QByteArray();
+
+        allocations = 0;
+        counting = true;
+        for( int i = 0; i < 10; ++i ){
+            if( FrameCodec::readFrame( &device, header, content ) != FrameCodec::Result::Complete ) break;
+            queue.push( std::move( content ));
+            queue.pop( content );
+            content = QByteArray();
+        }
+        counting = false;
+
+        QCOMPARE( device.bytesAvailable(), qint64( 0 ));
+        QCOMPARE( allocations.load(), length == 0 ? 0 : 10 );
+    }
+};
+
+QTEST_GUILESS_MAIN( TestAllocations )
+#include "tst_allocations.moc"
@@ -0,0 +1,84 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+class TestBatches : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void sendMessages_data()
+    {
+        QTest::addColumn<int>( "count" );
+
+        QTest::newRow( "1" ) << 1;
+        QTest::newRow( "10" ) << 10;
+        QTest::newRow( "100" ) << 100;
+    }
+
+    // A batch arrives in order, is delivered to receivedMessages() at once
+    // and the sender returns once its single acknowledgement arrived
+    void sendMessages()
+    {
+        QFETCH( int, count );
+
+        QList<QByteArray> received;
+        QList<QList<SingleApplication::Message>> batches;
+        QMetaObject::Connection messageConnection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+        QMetaObject::Connection batchConnection = connect( Testing::application(), &SingleApplication::receivedMessages, this,
+            [&batches]( const QList<SingleApplication::Message> &messages ){ batches.append( messages ); });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "send" ), QString::number( count ), QStringLiteral( "batch" ) });
+        QVERIFY( Testing::finish( instance ));
+        disconnect( messageConnection );
+        disconnect( batchConnection );
+
+        // The handshake of the instance is not an instance message
+        QCOMPARE( batches.size(), 1 );
+        const QList<SingleApplication::Message> &batch = batches.first();
+        QCOMPARE( batch.size(), count );
+        QCOMPARE( received.size(), count );
+        for( int i = 0; i < count; ++i ){
+            QCOMPARE( received.at( i ), QByteArray::number( i ));
+            QCOMPARE( batch.at( i ).content, QByteArray::number( i ));
+            QCOMPARE( batch.at( i ).type, SingleApplication::MessageType::InstanceMessage );
+        }
+    }
+
+    // An empty batch needs no round trip at all
+    void empty()
+    {
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "send" ), QStringLiteral( "0" ), QStringLiteral( "batch" ) });
+        QVERIFY( Testing::finish( instance ));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestBatches )
+#include "tst_batches.moc"
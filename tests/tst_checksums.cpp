@@ -0,0 +1,201 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "crc32c.h"
+#include "message_coder.h"
+
+class TestChecksums : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Connects a sending and a receiving coder over a local socket
+    bool connectCoders()
+    {
+        const QString name = QStringLiteral( "tst_checksums-%1" ).arg( QCoreApplication::applicationPid() );
+        QLocalServer::removeServer( name );
+        server.reset( new QLocalServer );
+        if( ! server->listen( name ))
+            return false;
+        client.reset( new QLocalSocket );
+        client->connectToServer( server->serverName() );
+        if( ! server->waitForNewConnection( 5000 ))
+            return false;
+
+        sender.reset( new MessageCoder( client.data() ));
+        receiver.reset( new MessageCoder( server->nextPendingConnection() ));
+        connect( receiver.data(), &MessageCoder::messageReceived, this, [this]( const SingleApplication::Message &message ){
+            received.append( message );
+        });
+        return true;
+    }
+
+    // Handshake of a peer that only announces its protocol version
+    static QByteArray versionHandshake( quint32 version )
+    {
+        QByteArray handshake( sizeof( quint32 ), Qt::Uninitialized );
+        qToBigEndian<quint32>( version, handshake.data() );
+        return handshake;
+    }
+
+    static QByteArray random( int size )
+    {
+        QByteArray data( size, Qt::Uninitialized );
+        for( int i = 0; i < size; ++i )
+            data[i] = static_cast<char>( QRandomGenerator::global()->generate() );
+        return data;
+    }
+
+    QScopedPointer<QLocalServer> server;
+    QScopedPointer<QLocalSocket> client;
+    QScopedPointer<MessageCoder> sender;
+    QScopedPointer<MessageCoder> receiver;
+    QList<SingleApplication::Message> received;
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qRegisterMetaType<SingleApplication::Message>();
+    }
+
+    void cleanup()
+    {
+        receiver.reset();
+        sender.reset();
+        client.reset();
+        server.reset();
+        received.clear();
+    }
+
+    // The check value of the CRC-32C parameters
+    void knownAnswer()
+    {
+        QCOMPARE( crc32c( "123456789", 9 ), quint32( 0xE3069283 ));
+        QCOMPARE( crc32cPortable( "123456789", 9 ), quint32( 0xE3069283 ));
+        QCOMPARE( crc32c( "", 0 ), quint32( 0 ));
+
+        // Checksummed in parts, as the header and the content of a frame
+        QCOMPARE( crc32c( "56789", 5, crc32c( "1234", 4 )), quint32( 0xE3069283 ));
+    }
+
+    // The CPU instructions, where available, agree with the tables for any
+    // length and alignment
+    void implementations()
+    {
+        const QByteArray data = random( 4096 + 8 );
+        for( int i = 0; i < 2000; ++i ){
+            const int offset = QRandomGenerator::global()->bounded( 8 );
+            const int length = QRandomGenerator::global()->bounded( 4096 );
+            const quint32 initial = i % 2 ? QRandomGenerator::global()->generate() : 0;
+            const char *start = data.constData() + offset;
+            QCOMPARE( crc32c( start, length, initial ), crc32cPortable( start, length, initial ));
+        }
+    }
+
+    void negotiation_data()
+    {
+        QTest::addColumn<QByteArray>( "handshake" );
+        QTest::addColumn<quint32>( "version" );
+
+        QTest::newRow( "no handshake" ) << QByteArray() << quint32( 1 );
+        QTest::newRow( "version 1" ) << versionHandshake( 1 ) << quint32( 1 );
+        QTest::newRow( "version 2" ) << versionHandshake( 2 ) << quint32( 2 );
+        QTest::newRow( "newer version" ) << versionHandshake( 3 ) << quint32( 2 );
+        QTest::newRow( "handshake" ) << MessageCoder::handshake() << quint32( 2 );
+    }
+
+    // Frames are sent with the highest version both peers support and the
+    // receiver answers with the version it was sent
+    void negotiation()
+    {
+        QFETCH( QByteArray, handshake );
+        QFETCH( quint32, version );
+        QVERIFY( connectCoders() );
+        QCOMPARE( sender->negotiatedVersion(), quint32( 1 ));
+
+        sender->negotiate( handshake );
+        QCOMPARE( sender->negotiatedVersion(), version );
+
+        const QByteArray content = random( 64 * 1024 );
+        QVERIFY( sender->sendMessage( SingleApplication::MessageType::InstanceMessage, 1, content ));
+        QVERIFY( sender->sendMessage( SingleApplication::MessageType::InstanceMessage, 1, "small" ));
+        QTRY_COMPARE( received.size(), 2 );
+        QCOMPARE( received.at( 0 ).content, content );
+        QCOMPARE( received.at( 1 ).content, QByteArray( "small" ));
+        QCOMPARE( receiver->negotiatedVersion(), version );
+    }
+
+    // Frames sent without a checksum arrive flagged as such
+    void noChecksum()
+    {
+        QVERIFY( connectCoders() );
+        sender->negotiate( MessageCoder::handshake() );
+        sender->setChecksumEnabled( false );
+
+        const QByteArray content = random( 64 * 1024 );
+        const qint64 before = client->bytesToWrite();
+        QVERIFY( sender->sendMessage( SingleApplication::MessageType::InstanceMessage, 1, content ));
+        QCOMPARE( client->bytesToWrite() - before, FrameCodec::HeaderSizeV2 + content.size() );
+
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first().content, content );
+        QVERIFY( received.first().flags & FrameCodec::NoChecksum );
+    }
+
+    void corrupted_data()
+    {
+        QTest::addColumn<quint32>( "version" );
+
+        QTest::newRow( "version 1" ) << quint32( 1 );
+        QTest::newRow( "version 2" ) << quint32( 2 );
+    }
+
+    // A frame failing its checksum is dropped, the next one still arrives
+    void corrupted()
+    {
+        QFETCH( quint32, version );
+        QVERIFY( connectCoders() );
+
+        const QByteArray content = random( 1024 );
+        QByteArray frames;
+        FrameCodec::appendFrame( frames, FrameCodec::Header{ version, SingleApplication::MessageType::InstanceMessage, 0, 0, 1, content.size() }, content.constData() );
+        const int flipped = static_cast<int>( FrameCodec::headerSize( version )) + 10;
+        frames[flipped] = static_cast<char>( frames.at( flipped ) ^ 1 );
+        FrameCodec::appendFrame( frames, FrameCodec::Header{ version, SingleApplication::MessageType::InstanceMessage, 0, 0, 1, content.size() }, content.constData() );
+
+        QTest::ignoreMessage( QtWarningMsg, "SingleApplication: Dropping message with an invalid checksum" );
+        QCOMPARE( client->write( frames ), qint64( frames.size() ));
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first().content, content );
+    }
+};
+
+QTEST_GUILESS_MAIN( TestChecksums )
+#include "tst_checksums.moc"
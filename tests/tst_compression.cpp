@@ -0,0 +1,218 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "message_coder.h"
+
+class TestCompression : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Connects a sending and a receiving coder over a local socket
+    bool connectCoders( qint64 compressionThreshold, const QByteArray &peerHandshake )
+    {
+        const QString name = QStringLiteral( "tst_compression-%1" ).arg( QCoreApplication::applicationPid() );
+        QLocalServer::removeServer( name );
+        server.reset( new QLocalServer );
+        if( ! server->listen( name ))
+            return false;
+        client.reset( new QLocalSocket );
+        client->connectToServer( server->serverName() );
+        if( ! server->waitForNewConnection( 5000 ))
+            return false;
+
+        sender.reset( new MessageCoder( client.data() ));
+        sender->negotiate( peerHandshake );
+        sender->setCompressionThreshold( compressionThreshold );
+        receiver.reset( new MessageCoder( server->nextPendingConnection() ));
+        connect( receiver.data(), &MessageCoder::messageReceived, this, [this]( const SingleApplication::Message &message ){
+            received.append( message );
+        });
+        return true;
+    }
+
+    // Sends a message and returns the size of the frame written
+    qint64 send( const QByteArray &content )
+    {
+        if( ! sender->sendMessage( SingleApplication::MessageType::InstanceMessage, 1, content ))
+            return -1;
+        return client->bytesToWrite();
+    }
+
+    static QByteArray compressible( int size )
+    {
+        QByteArray content;
+        content.reserve( size );
+        while( content.size() < size )
+            content += QByteArray::number( content.size() ) + " SingleApplication ";
+        content.truncate( size );
+        return content;
+    }
+
+    static QByteArray incompressible( int size )
+    {
+        QByteArray content( size, Qt::Uninitialized );
+        for( int i = 0; i < size; ++i )
+            content[i] = static_cast<char>( QRandomGenerator::global()->generate() );
+        return content;
+    }
+
+    // Handshake of a peer of protocol version 2 that announces no capabilities
+    static QByteArray versionOnlyHandshake()
+    {
+        QByteArray handshake( sizeof( quint32 ), Qt::Uninitialized );
+        qToBigEndian<quint32>( 2, handshake.data() );
+        return handshake;
+    }
+
+    QScopedPointer<QLocalServer> server;
+    QScopedPointer<QLocalSocket> client;
+    QScopedPointer<MessageCoder> sender;
+    QScopedPointer<MessageCoder> receiver;
+    QList<SingleApplication::Message> received;
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifdef QT_NO_COMPRESS
+        QSKIP( "Qt was built without compression" );
+#endif
+        qRegisterMetaType<SingleApplication::Message>();
+    }
+
+    void cleanup()
+    {
+        receiver.reset();
+        sender.reset();
+        client.reset();
+        server.reset();
+        received.clear();
+    }
+
+    // A message larger than a frame compresses below it and arrives intact
+    void negotiated()
+    {
+        QVERIFY( connectCoders( 1024, MessageCoder::handshake() ));
+
+        const QByteArray content = compressible( 4 * 1024 * 1024 );
+        const qint64 written = send( content );
+        QVERIFY( written > 0 );
+        QVERIFY( written < FrameCodec::MaxContentLength );
+
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first().content, content );
+        QVERIFY( received.first().flags & FrameCodec::Compressed );
+    }
+
+    // Compressed content handed out for decompression elsewhere holds back
+    // the following messages until it is back
+    void offloaded()
+    {
+        QVERIFY( connectCoders( 1024, MessageCoder::handshake() ));
+        receiver->setDecompressionOffloaded( true );
+        QByteArray compressed;
+        connect( receiver.data(), &MessageCoder::compressedContentReceived, this, [&compressed]( const QByteArray &content ){
+            compressed = content;
+        });
+
+        const QByteArray content = compressible( 4 * 1024 * 1024 );
+        QVERIFY( send( content ) > 0 );
+        QVERIFY( send( "after" ) > 0 );
+        QTRY_VERIFY( ! compressed.isEmpty() );
+        QTest::qWait( 50 );
+        QVERIFY( received.isEmpty() );
+
+        receiver->completeDecompression( qUncompress( compressed ));
+        QTRY_COMPARE( received.size(), 2 );
+        QCOMPARE( received.at( 0 ).content, content );
+        QCOMPARE( received.at( 1 ).content, QByteArray( "after" ));
+    }
+
+    // Without the peer accepting compressed frames, content is sent as is
+    void notNegotiated()
+    {
+        QVERIFY( connectCoders( 1024, versionOnlyHandshake() ));
+
+        QCOMPARE( send( compressible( 4 * 1024 * 1024 )), qint64( -1 ));
+
+        const QByteArray content = compressible( 64 * 1024 );
+        QVERIFY( send( content ) > content.size() );
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first().content, content );
+    }
+
+    // Content that doesn't get smaller is sent as is
+    void incompressibleContent()
+    {
+        QVERIFY( connectCoders( 1024, MessageCoder::handshake() ));
+
+        const QByteArray content = incompressible( 512 * 1024 );
+        QVERIFY( send( content ) > content.size() );
+        QTRY_COMPARE( received.size(), 1 );
+        QCOMPARE( received.first().content, content );
+        QVERIFY( ! ( received.first().flags & FrameCodec::Compressed ));
+    }
+
+    void throughput_data()
+    {
+        QTest::addColumn<qint64>( "threshold" );
+        QTest::addColumn<int>( "size" );
+
+        QTest::newRow( "64 KiB uncompressed" ) << qint64( -1 ) << 64 * 1024;
+        QTest::newRow( "64 KiB compressed" ) << qint64( 0 ) << 64 * 1024;
+        QTest::newRow( "1 MiB uncompressed" ) << qint64( -1 ) << 1024 * 1024;
+        QTest::newRow( "1 MiB compressed" ) << qint64( 0 ) << 1024 * 1024;
+    }
+
+    // Time to send and receive a compressible message, with and without compression
+    void throughput()
+    {
+        QFETCH( qint64, threshold );
+        QFETCH( int, size );
+        QVERIFY( connectCoders( threshold, MessageCoder::handshake() ));
+        QLocalSocket *peer = server->findChild<QLocalSocket *>();
+        QVERIFY( peer );
+
+        const QByteArray content = compressible( size );
+        QBENCHMARK {
+            received.clear();
+            QVERIFY( send( content ) > 0 );
+            while( received.isEmpty() ){
+                client->flush();
+                peer->waitForReadyRead( 10 );
+            }
+        }
+        QCOMPARE( received.first().content.size(), size );
+    }
+};
+
+QTEST_GUILESS_MAIN( TestCompression )
+#include "tst_compression.moc"
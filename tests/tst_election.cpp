@@ -0,0 +1,115 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QProcess>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "singleapplication_p.h"
+#include "testing.h"
+
+// Runs as a plain application, the instances it starts hold the election
+class TestElection : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // A primary instance killed without a chance to clean up is replaced by
+    // the next instance at once, not after a timeout
+    void crashRecovery()
+    {
+        QProcess primary;
+        Testing::startInstance( primary, { QStringLiteral( "elect" ), QStringLiteral( "30000" ) });
+        QCOMPARE( Testing::readLine( primary ), QByteArray( "primary" ));
+
+        QProcess secondary;
+        Testing::startInstance( secondary, { QStringLiteral( "elect" ), QStringLiteral( "0" ) });
+        QCOMPARE( Testing::readLine( secondary ), QByteArray( "secondary" ));
+        QVERIFY( Testing::finish( secondary ));
+
+        // SIGKILL on Unix, the socket file is left behind
+        primary.kill();
+        QVERIFY( primary.waitForFinished( 5000 ));
+
+        QElapsedTimer timer;
+        timer.start();
+        QProcess successor;
+        Testing::startInstance( successor, { QStringLiteral( "elect" ), QStringLiteral( "0" ) });
+        QCOMPARE( Testing::readLine( successor ), QByteArray( "primary" ));
+        const qint64 elapsed = timer.elapsed();
+        QVERIFY( Testing::finish( successor ));
+
+        // Far below the 5 s the instance helper is allowed to initialize
+        qInfo( "Took over in %lld ms", elapsed );
+        QVERIFY( elapsed < 2500 );
+    }
+
+    // A server listening without holding the lock, like a primary instance
+    // of an older version, keeps its socket and gets the new instance as a
+    // secondary instance
+    void liveServer()
+    {
+        const QString name = SingleApplicationPrivate::blockServerNameFor( Testing::options(), QStringList(), QCoreApplication::applicationName(),
+                                                                           QString(), SingleApplicationPrivate::getUsername() );
+        QLocalServer::removeServer( name );
+        QLocalServer server;
+        QVERIFY( server.listen( name ));
+
+        // Acknowledges every message, as a primary instance of version 1
+        connect( &server, &QLocalServer::newConnection, this, [&server](){
+            while( QLocalSocket *socket = server.nextPendingConnection() ){
+                MessageCoder *coder = new MessageCoder( socket );
+                coder->setParent( socket );
+                connect( coder, &MessageCoder::messageReceived, coder, [coder](){
+                    coder->sendMessage( SingleApplication::MessageType::Acknowledge, 0, QByteArray() );
+                });
+            }
+        });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "elect" ), QStringLiteral( "0" ) });
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "secondary" ));
+        QVERIFY( Testing::finish( instance ));
+
+        QVERIFY( server.isListening() );
+        QVERIFY( QFile::exists( server.fullServerName() ));
+        QLocalSocket socket;
+        socket.connectToServer( name );
+        QVERIFY( socket.waitForConnected( 1000 ));
+    }
+};
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication app( argc, argv );
+    QCoreApplication::setApplicationName( Testing::applicationName() );
+    qRegisterMetaType<SingleApplication::Message>();
+    TestElection test;
+    return QTest::qExec( &test, argc, argv );
+}
+
+#include "tst_election.moc"
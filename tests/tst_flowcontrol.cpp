@@ -0,0 +1,175 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QFile>
+#include <QtCore/QProcess>
+#include <QtCore/QThread>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "message_coder.h"
+#include "singleapplication_p.h"
+#include "testing.h"
+
+namespace {
+    // Peak resident set size of this process in KiB, Linux only
+    qint64 peakResidentSize()
+    {
+        QFile status( QStringLiteral( "/proc/self/status" ));
+        if( ! status.open( QIODevice::ReadOnly )) return -1;
+        for( const QByteArray &line : status.readAll().split( '\n' )){
+            if( line.startsWith( "VmHWM:" ))
+                return line.mid( 6 ).trimmed().split( ' ' ).value( 0 ).toLongLong();
+        }
+        return -1;
+    }
+
+    bool isConnected( quint64 id )
+    {
+        for( const SingleApplication::InstanceInfo &info : Testing::application()->instances() )
+            if( info.id == id )
+                return true;
+        return false;
+    }
+}
+
+class TestFlowControl : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanup()
+    {
+        Testing::application()->setFlowControlLimits( 8 * 1024 * 1024, 64 * 1024 * 1024 );
+    }
+
+    void budget()
+    {
+        FlowBudget budget;
+        budget.setLimit( 100 );
+        QVERIFY( budget.tryAcquire( 60 ));
+        QVERIFY( ! budget.tryAcquire( 50 ));
+        QVERIFY( ! budget.isExhausted() );
+        budget.acquire( 50 );
+        QVERIFY( budget.isExhausted() );
+        budget.release( 50 );
+        QVERIFY( budget.tryAcquire( 40 ));
+        QVERIFY( budget.isExhausted() );
+        budget.release( 100 );
+
+        budget.setLimit( -1 );
+        QVERIFY( budget.tryAcquire( 1024 * 1024 * 1024 ));
+        QVERIFY( ! budget.isExhausted() );
+    }
+
+    // A secondary instance sending far more than the limits to a slow
+    // receiver doesn't grow the memory of the primary instance beyond them
+    void boundedMemory()
+    {
+        const qint64 before = peakResidentSize();
+        if( before < 0 )
+            QSKIP( "Measuring the resident set size requires /proc" );
+
+        SingleApplication *app = Testing::application();
+        app->setFlowControlLimits( 1024 * 1024, 4 * 1024 * 1024 );
+
+        const int count = 128;
+        int received = 0;
+        QMetaObject::Connection connection = connect( app, &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray & ){
+                QThread::msleep( 5 );
+                ++received;
+            });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "post" ), QString::number( count ), QStringLiteral( "64" ),
+                                            QString::number( FrameCodec::MaxContentLength ) });
+        QVERIFY( Testing::finish( instance, 60000 ));
+        QTRY_COMPARE( received, count );
+        disconnect( connection );
+
+        const qint64 growth = ( peakResidentSize() - before ) / 1024;
+        qInfo( "Peak memory grew by %lld MiB while %d MiB were received", growth, count );
+        QVERIFY( growth < 48 );
+    }
+
+    // Messages still buffered when a throttled secondary disconnects are
+    // delivered before its connection goes away
+    void disconnectWhileThrottled()
+    {
+        SingleApplication *app = Testing::application();
+        app->setFlowControlLimits( 64 * 1024, 256 * 1024 );
+
+        const int count = 200;
+        int received = 0;
+        QMetaObject::Connection connection = connect( app, &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray & ){
+                QThread::msleep( 1 );
+                ++received;
+            });
+
+        // Speaks the protocol directly, so it can disconnect as soon as the
+        // messages left its socket
+        QLocalSocket socket;
+        socket.connectToServer( SingleApplicationPrivate::blockServerNameFor( Testing::options(), app->userData(), app->applicationName(),
+                                                                              app->applicationFilePath(), SingleApplicationPrivate::getUsername() ));
+        QVERIFY( socket.waitForConnected( 1000 ));
+        MessageCoder coder( &socket );
+        QVERIFY( coder.sendMessage( SingleApplication::MessageType::NewInstance, 0, MessageCoder::handshake() ));
+        for( int i = 0; i < count; ++i )
+            QVERIFY( coder.sendMessage( SingleApplication::MessageType::InstanceMessage, 0, QByteArray( 16 * 1024, 'x' )));
+        QTRY_COMPARE_WITH_TIMEOUT( socket.bytesToWrite(), qint64( 0 ), 30000 );
+        socket.disconnectFromServer();
+
+        QTRY_COMPARE_WITH_TIMEOUT( received, count, 30000 );
+        disconnect( connection );
+    }
+
+    // Large pushes buffered ahead of the acknowledgement of a message don't
+    // keep the blocking secondary instance from reading it
+    void largePushesBeforeAcknowledgement()
+    {
+        SingleApplication *app = Testing::application();
+        QByteArray message;
+        QMetaObject::Connection connection = connect( app, &SingleApplication::receivedMessage, this,
+            [&message]( quint64, const QByteArray &received ){
+                message = received;
+            });
+
+        const int count = 3;
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "pushed" ), QStringLiteral( "1000" ), QString::number( count ) });
+        const quint64 id = Testing::readLine( instance ).toULongLong();
+        QTRY_VERIFY( isConnected( id ));
+
+        const QByteArray push( FrameCodec::MaxContentLength, 'p' );
+        for( int i = 0; i < count; ++i )
+            QVERIFY( app->sendToInstance( id, push ));
+        QVERIFY( Testing::finish( instance, 30000 ));
+        QCOMPARE( message, QByteArray( "pushed" ));
+        disconnect( connection );
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestFlowControl )
+#include "tst_flowcontrol.moc"
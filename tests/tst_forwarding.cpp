@@ -0,0 +1,104 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+class TestForwarding : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifndef Q_OS_LINUX
+        QSKIP( "Forwarding without an application object requires Linux" );
+#endif
+    }
+
+    // A message forwarded before the application object exists is delivered
+    // like any other
+    void running()
+    {
+        QList<QByteArray> received;
+        int started = 0;
+        QMetaObject::Connection messageConnection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+        QMetaObject::Connection startConnection = connect( Testing::application(), &SingleApplication::instanceStarted, this,
+            [&started](){ ++started; });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "forward" ), QStringLiteral( "forwarded message" ) });
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "forwarded" ));
+        QVERIFY( Testing::finish( instance ));
+
+        // Without a message only the start of the instance is announced
+        Testing::startInstance( instance, { QStringLiteral( "forward" ) });
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "forwarded" ));
+        QVERIFY( Testing::finish( instance ));
+        disconnect( messageConnection );
+        disconnect( startConnection );
+
+        QCOMPARE( received, QList<QByteArray>{ "forwarded message" } );
+        QCOMPARE( started, 2 );
+    }
+
+    // Broadcasts of the primary instance don't make a forwarded message fail,
+    // which would have the caller send it a second time
+    void duringBroadcasts()
+    {
+        QList<QByteArray> received;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "forward" ), QStringLiteral( "forwarded message" ) });
+        QElapsedTimer timer;
+        timer.start();
+        while( ! instance.canReadLine() && instance.state() != QProcess::NotRunning && timer.elapsed() < 5000 ){
+            Testing::application()->broadcast( "broadcast" );
+            QTest::qWait( 1 );
+        }
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "forwarded" ));
+        QVERIFY( Testing::finish( instance ));
+        disconnect( connection );
+
+        QCOMPARE( received, QList<QByteArray>{ "forwarded message" } );
+    }
+
+    // Without a primary instance the caller has to construct the application
+    void notRunning()
+    {
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "forward" ), QStringLiteral( "lost message" ) },
+                                Testing::applicationName() + QStringLiteral( "-none" ));
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "not forwarded" ));
+        QVERIFY( Testing::finish( instance ));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestForwarding )
+#include "tst_forwarding.moc"
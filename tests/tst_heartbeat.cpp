@@ -0,0 +1,121 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+#include "timerwheel.h"
+
+namespace {
+    bool isConnected( quint64 id )
+    {
+        for( const SingleApplication::InstanceInfo &info : Testing::application()->instances() )
+            if( info.id == id )
+                return true;
+        return false;
+    }
+}
+
+class TestHeartbeat : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // Every value expires exactly at its tick, on any level of the wheel
+    void wheel()
+    {
+        TimerWheel<quint64> wheel;
+        const std::vector<quint64> delays = { 1, 2, 63, 64, 65, 100, 4095, 4096, 5000, 300000 };
+        for( quint64 delay : delays )
+            wheel.schedule( delay, delay );
+
+        std::vector<quint64> expired;
+        while( wheel.currentTick() < delays.back() ){
+            wheel.tick( [&]( quint64 delay ){
+                QCOMPARE( wheel.currentTick(), delay );
+                expired.push_back( delay );
+            });
+        }
+        QCOMPARE( expired, delays );
+    }
+
+    void tick_data()
+    {
+        QTest::addColumn<int>( "connections" );
+
+        QTest::newRow( "10" ) << 10;
+        QTest::newRow( "5000" ) << 5000;
+    }
+
+    // A tick costs the same however many connections are waiting
+    void tick()
+    {
+        QFETCH( int, connections );
+
+        TimerWheel<int> wheel;
+        for( int i = 0; i < connections; ++i )
+            wheel.schedule( 100000 + i, i );
+
+        int expired = 0;
+        QBENCHMARK {
+            wheel.tick( [&expired]( int ){ ++expired; });
+        }
+        QCOMPARE( expired, 0 );
+    }
+
+    // A secondary instance that stops processing events is disconnected
+    // within two intervals, a responsive one stays connected
+    void evictHung()
+    {
+        const int interval = 200;
+        Testing::application()->setHeartbeatInterval( interval );
+
+        QProcess responsive;
+        Testing::startInstance( responsive, { QStringLiteral( "idle" ), QStringLiteral( "3000" ) });
+        QProcess hung;
+        Testing::startInstance( hung, { QStringLiteral( "stall" ), QStringLiteral( "3000" ) });
+        const quint64 responsiveId = Testing::readLine( responsive ).toULongLong();
+        const quint64 hungId = Testing::readLine( hung ).toULongLong();
+        QVERIFY( responsiveId != 0 );
+        QVERIFY( hungId != 0 );
+        QTRY_VERIFY( isConnected( responsiveId ));
+        QTRY_VERIFY( isConnected( hungId ));
+
+        QElapsedTimer timer;
+        timer.start();
+        QTRY_VERIFY_WITH_TIMEOUT( ! isConnected( hungId ), 5 * interval );
+        qInfo( "Hung instance evicted after %lld ms", timer.elapsed() );
+        QVERIFY( isConnected( responsiveId ));
+
+        QVERIFY( Testing::finish( hung ));
+        QVERIFY( Testing::finish( responsive ));
+        Testing::application()->setHeartbeatInterval( 0 );
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestHeartbeat )
+#include "tst_heartbeat.moc"
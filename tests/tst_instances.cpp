@@ -0,0 +1,114 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QDateTime>
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "frame_codec.h"
+#include "message_coder.h"
+#include "singleapplication_p.h"
+#include "testing.h"
+
+namespace {
+    SingleApplication::InstanceInfo findInstance( quint64 id )
+    {
+        for( const SingleApplication::InstanceInfo &info : Testing::application()->instances() )
+            if( info.id == id )
+                return info;
+        return SingleApplication::InstanceInfo{ 0, -1, QString(), 0, 0, 0 };
+    }
+
+    qint64 frameSize( quint32 version, qint64 length )
+    {
+        return FrameCodec::frameSize( FrameCodec::Header{ version, 0, 0, 0, 0, length });
+    }
+}
+
+class TestInstances : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // Version 2 headers carry the whole id, version 1 headers its low bits
+    void wideIds()
+    {
+        const quint64 id = Q_UINT64_C( 0x123456789abc );
+        for( quint32 version : { 1u, 2u }){
+            QByteArray frame;
+            FrameCodec::appendFrame( frame, FrameCodec::Header{ version, SingleApplication::MessageType::InstanceMessage, 0, 0, id, 0 }, nullptr );
+            FrameCodec::Header header;
+            QCOMPARE( FrameCodec::parseHeader( reinterpret_cast<const uchar*>( frame.constData() ), frame.size(), header ), FrameCodec::Result::Complete );
+            QCOMPARE( header.instanceId, version == 1 ? id & 0xffff : id );
+        }
+    }
+
+    // The registry describes the connected instances, the same way for the
+    // primary and the secondary instances
+    void registry()
+    {
+        const qint64 started = QDateTime::currentMSecsSinceEpoch();
+        QProcess first;
+        Testing::startInstance( first, { QStringLiteral( "identify" ), QStringLiteral( "3000" ) });
+        const quint64 firstId = Testing::readLine( first ).toULongLong();
+        const QByteArray firstView = Testing::readLine( first );
+        QProcess second;
+        Testing::startInstance( second, { QStringLiteral( "identify" ), QStringLiteral( "3000" ) });
+        const quint64 secondId = Testing::readLine( second ).toULongLong();
+        const QByteArray secondView = Testing::readLine( second );
+
+        // Ids are assigned in order of connection and never reused
+        QVERIFY( firstId > 0 );
+        QVERIFY( secondId > firstId );
+        QVERIFY( firstView.split( ' ' ).contains( QByteArray::number( firstId )));
+        QVERIFY( secondView.split( ' ' ).contains( QByteArray::number( firstId )));
+        QVERIFY( secondView.split( ' ' ).contains( QByteArray::number( secondId )));
+        QVERIFY( secondView.split( ' ' ).contains( "0" ));
+
+        const SingleApplication::InstanceInfo primary = findInstance( 0 );
+        QCOMPARE( primary.pid, QCoreApplication::applicationPid() );
+        QCOMPARE( primary.user, SingleApplicationPrivate::getUsername() );
+
+        // The handshake with the identity of the instance, its message and
+        // its request for the instances, as they were sent
+        const QByteArray user = SingleApplicationPrivate::getUsername().toUtf8();
+        const qint64 sent = frameSize( 1, MessageCoder::handshake().size() + 3 * sizeof( quint64 ) + user.size() ) +
+                            frameSize( FrameCodec::ProtocolVersion, qstrlen( "hello" )) +
+                            frameSize( FrameCodec::ProtocolVersion, 0 );
+
+        for( QProcess *instance : { &first, &second }){
+            const SingleApplication::InstanceInfo info = findInstance( instance == &first ? firstId : secondId );
+            QCOMPARE( info.pid, qint64( instance->processId() ));
+            QCOMPARE( info.user, SingleApplicationPrivate::getUsername() );
+            QVERIFY( info.startTime >= started );
+            QVERIFY( info.lastSeen >= info.startTime );
+            QCOMPARE( info.bytesSent, sent );
+        }
+
+        QVERIFY( Testing::finish( first ));
+        QVERIFY( Testing::finish( second ));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestInstances )
+#include "tst_instances.moc"
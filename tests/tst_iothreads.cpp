@@ -0,0 +1,96 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <memory>
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QProcess>
+#include <QtCore/QThread>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+class TestIoThreads : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void delivery_data()
+    {
+        QTest::addColumn<int>( "threads" );
+
+        QTest::newRow( "main thread" ) << 0;
+        QTest::newRow( "1 I/O thread" ) << 1;
+        QTest::newRow( "4 I/O threads" ) << 4;
+    }
+
+    // Messages of several secondary instances decoded by I/O threads are all
+    // delivered on the main thread, in order per instance
+    void delivery()
+    {
+        QFETCH( int, threads );
+        const int senders = 4;
+        const int count = 1000;
+
+        SingleApplication *app = Testing::application();
+        app->setIoThreadCount( threads );
+        QCOMPARE( app->ioThreadCount(), threads );
+
+        QHash<quint64, QList<QByteArray>> received;
+        int total = 0;
+        bool mainThread = true;
+        QMetaObject::Connection connection = connect( app, &SingleApplication::receivedMessage, this,
+            [&]( quint64 instanceId, const QByteArray &message ){
+                mainThread = mainThread && QThread::currentThread() == QCoreApplication::instance()->thread();
+                received[instanceId].append( message );
+                ++total;
+            });
+
+        QElapsedTimer timer;
+        timer.start();
+        std::vector<std::unique_ptr<QProcess>> instances;
+        for( int i = 0; i < senders; ++i ){
+            instances.emplace_back( new QProcess );
+            Testing::startInstance( *instances.back(), { QStringLiteral( "post" ), QString::number( count ), QStringLiteral( "64" ) });
+        }
+        for( const std::unique_ptr<QProcess> &instance : instances )
+            QVERIFY( Testing::finish( *instance, 60000 ));
+        QTRY_COMPARE( total, senders * count );
+        const qint64 elapsed = timer.elapsed();
+        disconnect( connection );
+
+        QVERIFY( mainThread );
+        QCOMPARE( received.size(), senders );
+        for( const QList<QByteArray> &messages : received ){
+            QCOMPARE( messages.size(), count );
+            for( int i = 0; i < count; ++i )
+                QCOMPARE( messages.at( i ), QByteArray::number( i ));
+        }
+        qInfo( "%d messages from %d instances in %lld ms", senders * count, senders, elapsed );
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestIoThreads )
+#include "tst_iothreads.moc"
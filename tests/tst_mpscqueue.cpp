@@ -0,0 +1,137 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <QtCore/QCoreApplication>
+#include <QtTest/QtTest>
+
+#include "mpscqueue.h"
+
+class TestMpscQueue : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void singleThread()
+    {
+        MpscQueue<int> queue;
+        int value = -1;
+        QVERIFY( ! queue.pop( value ));
+
+        for( int i = 0; i < 10; ++i )
+            queue.push( i );
+        for( int i = 0; i < 10; ++i ){
+            QVERIFY( queue.pop( value ));
+            QCOMPARE( value, i );
+        }
+        QVERIFY( ! queue.pop( value ));
+    }
+
+    // Values of concurrent producers all arrive once, in order per producer
+    void contention()
+    {
+        const int producers = 4;
+        const quint32 count = 100000;
+
+        MpscQueue<quint64> queue;
+        std::vector<std::thread> threads;
+        for( int producer = 0; producer < producers; ++producer ){
+            threads.emplace_back( [&queue, producer, count](){
+                for( quint32 i = 0; i < count; ++i )
+                    queue.push( quint64( producer ) << 32 | i );
+            });
+        }
+
+        std::vector<quint32> expected( producers, 0 );
+        quint64 received = 0;
+        quint64 value = 0;
+        while( received < quint64( producers ) * count ){
+            if( ! queue.pop( value )){
+                std::this_thread::yield();
+                continue;
+            }
+            const int producer = static_cast<int>( value >> 32 );
+            QVERIFY( producer < producers );
+            QCOMPARE( static_cast<quint32>( value ), expected[producer] );
+            ++expected[producer];
+            ++received;
+        }
+        for( std::thread &thread : threads )
+            thread.join();
+
+        QVERIFY( ! queue.pop( value ));
+        for( quint32 next : expected )
+            QCOMPARE( next, count );
+    }
+
+    void handoff_data()
+    {
+        QTest::addColumn<bool>( "batched" );
+
+        QTest::newRow( "event per message" ) << false;
+        QTest::newRow( "queue and one event" ) << true;
+    }
+
+    // Hands 10000 messages from a thread to the main thread, either with a
+    // queued invocation each or through the queue with one wakeup per burst
+    void handoff()
+    {
+        QFETCH( bool, batched );
+        const int count = 10000;
+
+        MpscQueue<int> queue;
+        std::atomic<bool> notified{ false };
+        int received = 0;
+        const auto drain = [&](){
+            notified = false;
+            int value;
+            while( queue.pop( value ))
+                ++received;
+        };
+
+        QBENCHMARK {
+            received = 0;
+            std::thread producer( [&](){
+                for( int i = 0; i < count; ++i ){
+                    if( ! batched ){
+                        QMetaObject::invokeMethod( this, [&received](){ ++received; }, Qt::QueuedConnection );
+                        continue;
+                    }
+                    queue.push( i );
+                    if( ! notified.exchange( true ))
+                        QMetaObject::invokeMethod( this, drain, Qt::QueuedConnection );
+                }
+            });
+            while( received < count )
+                QCoreApplication::processEvents();
+            producer.join();
+        }
+        QCOMPARE( received, count );
+    }
+};
+
+QTEST_GUILESS_MAIN( TestMpscQueue )
+#include "tst_mpscqueue.moc"
@@ -0,0 +1,154 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "singleapplication_p.h"
+#include "testing.h"
+
+class TestPipelining : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void order_data()
+    {
+        QTest::addColumn<QString>( "command" );
+        QTest::addColumn<int>( "window" );
+
+        QTest::newRow( "sendMessage" ) << QStringLiteral( "send" ) << 0;
+        QTest::newRow( "window 1" ) << QStringLiteral( "post" ) << 1;
+        QTest::newRow( "window 16" ) << QStringLiteral( "post" ) << 16;
+        QTest::newRow( "window 64" ) << QStringLiteral( "post" ) << 64;
+    }
+
+    // Posted messages arrive in order and all of them are acknowledged
+    void order()
+    {
+        QFETCH( QString, command );
+        QFETCH( int, window );
+        const int count = 2000;
+
+        QList<QByteArray> received;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+
+        QElapsedTimer timer;
+        timer.start();
+        QProcess instance;
+        Testing::startInstance( instance, { command, QString::number( count ), QString::number( window ) });
+        QVERIFY( Testing::finish( instance, 60000 ));
+        QTRY_COMPARE( received.size(), count );
+        const qint64 elapsed = timer.elapsed();
+        disconnect( connection );
+
+        for( int i = 0; i < count; ++i )
+            QCOMPARE( received.at( i ), QByteArray::number( i ));
+        qInfo( "%d messages in %lld ms", count, elapsed );
+    }
+
+    // The primary instance keeps accepting messages in order once their
+    // sequence numbers wrapped around
+    void acceptWrapped()
+    {
+        ConnectionInfo info;
+        info.receivedSequence = 0xFFFFFFFE;
+
+        QVERIFY( SingleApplicationPrivate::acceptSequence( info, 0xFFFFFFFF ));
+        QVERIFY( ! SingleApplicationPrivate::acceptSequence( info, 0xFFFFFFFF ));
+        QVERIFY( SingleApplicationPrivate::acceptSequence( info, 1 ));
+        QCOMPARE( info.receivedSequence, quint32( 0xFFFFFFFF ));
+        QCOMPARE( info.selectiveSequences, QList<quint32>{ 1 } );
+
+        QVERIFY( SingleApplicationPrivate::acceptSequence( info, 0 ));
+        QCOMPARE( info.receivedSequence, quint32( 1 ));
+        QVERIFY( info.selectiveSequences.isEmpty() );
+        QVERIFY( ! SingleApplicationPrivate::acceptSequence( info, 0 ));
+        QVERIFY( ! SingleApplicationPrivate::acceptSequence( info, 0xFFFFFFFE ));
+    }
+
+    // Posted messages acknowledged across the wrap around are released
+    void acknowledgeWrapped()
+    {
+        SingleApplicationPrivate d( nullptr );
+        for( quint32 sequence : { 0xFFFFFFFEu, 0xFFFFFFFFu, 0u, 1u } )
+            d.postedMessages.insert( sequence, PostedMessage{ QByteArray::number( sequence ), 0 } );
+
+        d.acknowledgePostedMessages( 0xFFFFFFFF, QByteArray() );
+        QCOMPARE( d.postedMessages.keys(), ( QList<quint32>{ 0, 1 } ));
+
+        d.acknowledgePostedMessages( 0, QByteArray() );
+        QCOMPARE( d.postedMessages.keys(), QList<quint32>{ 1 } );
+    }
+
+    // Each acknowledgement following a lost message reports the gap, which
+    // is sent again once per retransmit interval rather than once each
+    void resendGapOnce()
+    {
+        QLocalServer server;
+        QVERIFY( server.listen( QStringLiteral( "tst_pipelining-%1" ).arg( QCoreApplication::applicationPid() )));
+
+        SingleApplicationPrivate d( nullptr );
+        d.socket = new QLocalSocket;
+        d.socket->connectToServer( server.serverName() );
+        QVERIFY( d.socket->waitForConnected( 5000 ));
+        QVERIFY( server.waitForNewConnection( 5000 ));
+        d.coder = new MessageCoder( d.socket );
+
+        MessageCoder primary( server.nextPendingConnection() );
+        QList<QByteArray> resent;
+        connect( &primary, &MessageCoder::messageReceived, this, [&resent]( const SingleApplication::Message &message ){
+            resent.append( message.content );
+        });
+
+        // 1 and 2 were lost, 3 to 10 arrived and were acknowledged one by one
+        for( quint32 sequence = 1; sequence <= 10; ++sequence )
+            d.postedMessages.insert( sequence, PostedMessage{ QByteArray::number( sequence ), 0 } );
+        QByteArray selective;
+        for( quint32 received = 3; received <= 10; ++received ){
+            selective.append( QByteArray( sizeof( quint32 ), Qt::Uninitialized ));
+            qToBigEndian<quint32>( received, selective.data() + selective.size() - sizeof( quint32 ));
+            d.acknowledgePostedMessages( 0, selective );
+        }
+        d.socket->flush();
+
+        QTRY_COMPARE( resent, ( QList<QByteArray>{ "1", "2" } ));
+        QTest::qWait( 50 );
+        QCOMPARE( resent.size(), 2 );
+        QCOMPARE( d.postedMessages.keys(), ( QList<quint32>{ 1, 2 } ));
+
+        // Still missing after the interval, the gap is sent again
+        QTest::qWait( SingleApplicationPrivate::RetransmitInterval );
+        d.acknowledgePostedMessages( 0, selective );
+        d.socket->flush();
+        QTRY_COMPARE( resent.size(), 4 );
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestPipelining )
+#include "tst_pipelining.moc"
@@ -0,0 +1,145 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QProcess>
+#include <QtCore/QThread>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "singleapplication_p.h"
+#include "testing.h"
+
+class TestPriorities : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // A message that expired while the primary instance was busy is dropped,
+    // and the sender learns it right away instead of waiting for its timeout
+    void expired()
+    {
+        int delivered = 0;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&delivered]( quint64, const QByteArray &message ){ delivered += message == "expire"; });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "expire" ), QStringLiteral( "100" ) });
+        QCOMPARE( Testing::readLine( instance ), QByteArray( "ready" ));
+        instance.write( "go\n" );
+        instance.waitForBytesWritten();
+        // Busy longer than the message may live
+        QTest::qSleep( 300 );
+
+        const qint64 elapsed = Testing::readLine( instance ).toLongLong();
+        QVERIFY( Testing::finish( instance ));
+        QVERIFY( elapsed < 2000 );
+        QCOMPARE( delivered, 0 );
+        disconnect( connection );
+    }
+
+    void controlLatency_data()
+    {
+        QTest::addColumn<int>( "priority" );
+
+        QTest::newRow( "normal" ) << static_cast<int>( SingleApplication::MessagePriority::Normal );
+        QTest::newRow( "high" ) << static_cast<int>( SingleApplication::MessagePriority::High );
+    }
+
+    // Round trips of short messages while another secondary instance floods
+    // the primary instance with large ones. High priority messages are
+    // dispatched ahead of the large ones drained together with them.
+    void controlLatency()
+    {
+        QFETCH( int, priority );
+
+        // Slow enough to let the bulk messages queue up
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            []( quint64, const QByteArray &message ){
+                if( message.size() > 1024 )
+                    QThread::usleep( 200 );
+            });
+        int overtaken = 0;
+        QMetaObject::Connection batches = connect( Testing::application(), &SingleApplication::receivedMessages, this,
+            [&overtaken]( const QList<SingleApplication::Message> &messages ){
+                bool bulk = false;
+                for( const SingleApplication::Message &message : messages ){
+                    if( message.content == "control" )
+                        overtaken += bulk;
+                    else
+                        bulk = true;
+                }
+            });
+
+        QProcess bulk;
+        Testing::startInstance( bulk, { QStringLiteral( "post" ), QStringLiteral( "2000" ), QStringLiteral( "64" ), QStringLiteral( "65536" ) });
+        QProcess control;
+        Testing::startInstance( control, { QStringLiteral( "latency" ), QStringLiteral( "200" ), QString::number( priority ) });
+
+        const QList<QByteArray> percentiles = Testing::readLine( control, 60000 ).split( ' ' );
+        QVERIFY( Testing::finish( control ));
+        QVERIFY( Testing::finish( bulk, 60000 ));
+        disconnect( connection );
+        disconnect( batches );
+
+        QCOMPARE( percentiles.size(), 2 );
+        if( priority == static_cast<int>( SingleApplication::MessagePriority::High ))
+            QCOMPARE( overtaken, 0 );
+        qInfo( "Round trip p50 %s ms, p99 %s ms, %d overtaken", percentiles.at( 0 ).constData(), percentiles.at( 1 ).constData(), overtaken );
+    }
+
+    // Requests queued behind instance messages are answered before them
+    // when both are drained together
+    void repliesFirst()
+    {
+        SingleApplication *app = Testing::application();
+        QLocalSocket socket;
+        socket.connectToServer( SingleApplicationPrivate::blockServerNameFor( Testing::options(), app->userData(), app->applicationName(),
+                                                                              app->applicationFilePath(), SingleApplicationPrivate::getUsername() ));
+        QVERIFY( socket.waitForConnected( 1000 ));
+        MessageCoder coder( &socket );
+        QList<SingleApplication::Message> replies;
+        connect( &coder, &MessageCoder::messageReceived, this, [&replies]( const SingleApplication::Message &message ){
+            replies.append( message );
+        });
+        QVERIFY( coder.sendMessage( SingleApplication::MessageType::NewInstance, 0, MessageCoder::handshake() ));
+        QTRY_COMPARE( replies.size(), 1 );
+
+        // Arrive in one read, so the primary instance drains them at once
+        const int count = 50;
+        for( int i = 0; i < count; ++i )
+            QVERIFY( coder.sendMessage( SingleApplication::MessageType::InstanceMessage, 0, QByteArray( 1024, 'x' )));
+        QVERIFY( coder.sendMessage( SingleApplication::MessageType::PrimaryPidRequest, 0, QByteArray() ));
+        socket.flush();
+        QTest::qSleep( 100 );
+
+        QTRY_COMPARE( replies.size(), 2 + count );
+        QCOMPARE( replies.at( 1 ).content.size(), static_cast<int>( sizeof( qint64 )));
+        QCOMPARE( qFromBigEndian<qint64>( replies.at( 1 ).content.constData() ), QCoreApplication::applicationPid() );
+        for( int i = 2; i < replies.size(); ++i )
+            QVERIFY( replies.at( i ).content.isEmpty() );
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestPriorities )
+#include "tst_priorities.moc"
@@ -0,0 +1,168 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <memory>
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+namespace {
+    bool isConnected( quint64 id )
+    {
+        for( const SingleApplication::InstanceInfo &info : Testing::application()->instances() )
+            if( info.id == id )
+                return true;
+        return false;
+    }
+}
+
+class TestPushes : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // Only the primary instance is left from the previous test
+    void init()
+    {
+        QTRY_COMPARE( Testing::application()->instances().size(), 1 );
+    }
+
+    void cleanup()
+    {
+        Testing::application()->setIoThreadCount( 0 );
+    }
+
+    void sendToInstance()
+    {
+        QVERIFY( ! Testing::application()->sendToInstance( quint64( -1 ), "unknown" ));
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "receive" ), QStringLiteral( "100" ) });
+        const quint64 id = Testing::readLine( instance ).toULongLong();
+        QTRY_VERIFY( isConnected( id ));
+
+        for( int i = 0; i < 100; ++i )
+            QVERIFY( Testing::application()->sendToInstance( id, QByteArray::number( i )));
+        QVERIFY( Testing::finish( instance ));
+    }
+
+    void broadcast_data()
+    {
+        QTest::addColumn<int>( "instances" );
+
+        QTest::newRow( "1" ) << 1;
+        QTest::newRow( "4" ) << 4;
+        QTest::newRow( "16" ) << 16;
+    }
+
+    // Time until every secondary instance received 100 broadcasts of 16 KiB,
+    // bench_connections measures the fan-out to thousands of connections
+    void broadcast()
+    {
+        QFETCH( int, instances );
+        const int count = 100;
+
+        std::vector<std::unique_ptr<QProcess>> receivers;
+        for( int i = 0; i < instances; ++i ){
+            receivers.emplace_back( new QProcess );
+            Testing::startInstance( *receivers.back(), { QStringLiteral( "receive" ), QString::number( count ) });
+        }
+        for( const std::unique_ptr<QProcess> &receiver : receivers ){
+            const quint64 id = Testing::readLine( *receiver ).toULongLong();
+            QTRY_VERIFY( isConnected( id ));
+        }
+
+        // Small enough for the receivers never to fall behind the limit
+        const QByteArray message( 16 * 1024, 'b' );
+        QElapsedTimer timer;
+        timer.start();
+        for( int i = 0; i < count; ++i ){
+            QCOMPARE( Testing::application()->broadcast( message ), instances );
+            // Lets the I/O threads and the receivers keep up with the writes
+            QTest::qWait( 1 );
+        }
+        for( const std::unique_ptr<QProcess> &receiver : receivers )
+            QVERIFY( Testing::finish( *receiver ));
+        qInfo( "Fan-out to %d instances took %lld ms", instances, timer.elapsed() );
+    }
+
+    // Broadcasts posted to an I/O thread while the secondary disconnects
+    // are dropped with its socket
+    void broadcastWhileDisconnecting()
+    {
+        SingleApplication *app = Testing::application();
+        app->setIoThreadCount( 2 );
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "stall" ), QStringLiteral( "200" ) });
+        const quint64 id = Testing::readLine( instance ).toULongLong();
+        QTRY_VERIFY( isConnected( id ));
+
+        const QByteArray message( 64 * 1024, 'd' );
+        QElapsedTimer timer;
+        timer.start();
+        while(( instance.state() != QProcess::NotRunning || isConnected( id )) && timer.elapsed() < 10000 ){
+            app->broadcast( message );
+            QTest::qWait( 1 );
+        }
+        QVERIFY( ! isConnected( id ));
+        QCOMPARE( instance.exitCode(), 0 );
+
+        // Nothing is sent to it once its connection is gone
+        for( int i = 0; i < 10; ++i ){
+            QCOMPARE( app->broadcast( message ), 0 );
+            QTest::qWait( 1 );
+        }
+    }
+
+    // A secondary instance that doesn't read doesn't make the primary
+    // instance buffer every message sent to it
+    void bounded()
+    {
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "stall" ), QStringLiteral( "3000" ) });
+        const quint64 id = Testing::readLine( instance ).toULongLong();
+        QTRY_VERIFY( isConnected( id ));
+
+        const QByteArray message( 1024 * 1024, 'm' );
+        int accepted = 0;
+        while( accepted < 100 && Testing::application()->sendToInstance( id, message )){
+            ++accepted;
+            QTest::qWait( 5 );
+        }
+        qInfo( "Accepted %d messages of 1 MiB", accepted );
+        QVERIFY( accepted < 100 );
+
+        // Messages to an instance that exited are refused
+        QVERIFY( Testing::finish( instance ));
+        QTRY_VERIFY( ! isConnected( id ));
+        QVERIFY( ! Testing::application()->sendToInstance( id, message ));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestPushes )
+#include "tst_pushes.moc"
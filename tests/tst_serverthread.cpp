@@ -0,0 +1,138 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "serverthread.h"
+
+namespace {
+    // Voluntary context switches of all threads but the main one, Linux only
+    qint64 backgroundContextSwitches()
+    {
+        qint64 switches = 0;
+        const QString self = QString::number( QCoreApplication::applicationPid() );
+        const QDir tasks( QStringLiteral( "/proc/self/task" ));
+        for( const QString &task : tasks.entryList( QDir::Dirs | QDir::NoDotAndDotDot )){
+            if( task == self ) continue;
+            QFile status( tasks.filePath( task + QStringLiteral( "/status" )));
+            if( ! status.open( QIODevice::ReadOnly )) continue;
+            for( const QByteArray &line : status.readAll().split( '\n' )){
+                if( line.startsWith( "voluntary_ctxt_switches:" ))
+                    switches += line.mid( line.indexOf( ':' ) + 1 ).trimmed().toLongLong();
+            }
+        }
+        return switches;
+    }
+
+    QString serverName()
+    {
+        return QStringLiteral( "tst_serverthread-%1" ).arg( QCoreApplication::applicationPid() );
+    }
+}
+
+class TestServerThread : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init()
+    {
+        QLocalServer::removeServer( serverName() );
+    }
+
+    // A listening server sleeps until a connection arrives
+    void idleWakeups()
+    {
+        if( ! QFile::exists( QStringLiteral( "/proc/self/task" )))
+            QSKIP( "Counting context switches requires /proc" );
+
+        ServerThread thread( serverName() );
+        thread.start();
+        QVERIFY( thread.waitForListening( 5000 ));
+
+        const qint64 before = backgroundContextSwitches();
+        QTest::qSleep( 1000 );
+        const qint64 wakeups = backgroundContextSwitches() - before;
+        qInfo( "%lld wakeups in 1 s", wakeups );
+        QVERIFY( wakeups <= 2 );
+    }
+
+    // stop() ends the event loop at once
+    void stop()
+    {
+        ServerThread thread( serverName() );
+        thread.start();
+        QVERIFY( thread.waitForListening( 5000 ));
+
+        QElapsedTimer timer;
+        timer.start();
+        thread.stop();
+        QVERIFY( thread.wait( 5000 ));
+        QVERIFY( timer.elapsed() < 100 );
+    }
+
+    // Accepted sockets live in the thread of the ServerThread object
+    void threadAffinity()
+    {
+        ServerThread thread( serverName() );
+        QLocalSocket *accepted = nullptr;
+        connect( &thread, &ServerThread::newConnection, this, [&accepted]( QLocalSocket *socket ){ accepted = socket; });
+        thread.start();
+        QVERIFY( thread.waitForListening( 5000 ));
+
+        QLocalSocket client;
+        client.connectToServer( serverName() );
+        QVERIFY( client.waitForConnected( 1000 ));
+        QTRY_VERIFY( accepted != nullptr );
+        QCOMPARE( accepted->thread(), QThread::currentThread() );
+        QVERIFY( accepted->parent() == nullptr );
+
+        // Readable from this thread
+        client.write( "ping" );
+        client.flush();
+        QTRY_COMPARE( accepted->bytesAvailable(), qint64( 4 ));
+        QCOMPARE( accepted->readAll(), QByteArray( "ping" ));
+        delete accepted;
+    }
+
+    // A server that can't listen reports it instead of pretending to run
+    void listenFailure()
+    {
+        ServerThread first( serverName() );
+        first.start();
+        QVERIFY( first.waitForListening( 5000 ));
+
+        ServerThread second( serverName() );
+        QSignalSpy errors( &second, &ServerThread::error );
+        second.start();
+        QVERIFY( ! second.waitForListening( 5000 ));
+        QTRY_COMPARE( errors.count(), 1 );
+    }
+};
+
+QTEST_GUILESS_MAIN( TestServerThread )
+#include "tst_serverthread.moc"
@@ -0,0 +1,194 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QFile>
+#include <QtCore/QProcess>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtTest/QtTest>
+
+#include "singleapplication_p.h"
+#include "testing.h"
+
+#ifdef Q_OS_LINUX
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+    // Content the large command of the instance helper sends
+    QByteArray expected( int size )
+    {
+        QByteArray content( size, Qt::Uninitialized );
+        for( int i = 0; i < size; ++i )
+            content[i] = static_cast<char>( i % 251 );
+        return content;
+    }
+}
+
+class TestSharedPayloads : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        if( ! MemfdPayload::isSupported() )
+            QSKIP( "Shared payloads require memfd support" );
+    }
+
+    void shared_data()
+    {
+        QTest::addColumn<bool>( "view" );
+
+        QTest::newRow( "receivedSharedMessage" ) << true;
+        QTest::newRow( "receivedMessage" ) << false;
+    }
+
+    // Content too large for a frame arrives through the memfd, as a view of
+    // the sender's pages or as a copy
+    void shared()
+    {
+        QFETCH( bool, view );
+        const int size = static_cast<int>( 4 * FrameCodec::MaxContentLength );
+
+        QList<QByteArray> received;
+        QMetaObject::Connection connection;
+        if( view ){
+            connection = connect( Testing::application(), &SingleApplication::receivedSharedMessage, this,
+                [&received]( quint64, const QByteArray &message ){
+                    // The view is only valid during the emission
+                    received.append( QByteArray( message.constData(), message.size() ));
+                });
+        } else {
+            connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+                [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+        }
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "large" ), QString::number( size ) });
+        QVERIFY( Testing::finish( instance ));
+        QTRY_COMPARE( received.size(), 1 );
+        disconnect( connection );
+
+        QVERIFY( received.first() == expected( size ));
+    }
+
+    // Content beyond the default flow control limits is still copied and
+    // delivered, as the secondary couldn't send it inline
+    void beyondLimits()
+    {
+        const int size = 12 * 1024 * 1024;
+
+        QList<QByteArray> received;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "large" ), QString::number( size ) });
+        QVERIFY( Testing::finish( instance ));
+        QTRY_COMPARE( received.size(), 1 );
+        disconnect( connection );
+
+        QVERIFY( received.first() == expected( size ));
+    }
+
+    // A primary instance that can't take the content rejects the memfd and
+    // the secondary sends the content inline
+    void rejected()
+    {
+        const int size = static_cast<int>( 2 * MemfdPayload::Threshold );
+        SingleApplication *app = Testing::application();
+        app->setFlowControlLimits( MemfdPayload::Threshold, 64 * 1024 * 1024 );
+
+        QList<QByteArray> received;
+        QMetaObject::Connection connection = connect( app, &SingleApplication::receivedMessage, this,
+            [&received]( quint64, const QByteArray &message ){ received.append( message ); });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "large" ), QString::number( size ) });
+        QVERIFY( Testing::finish( instance ));
+        disconnect( connection );
+        app->setFlowControlLimits( 8 * 1024 * 1024, 64 * 1024 * 1024 );
+
+        QCOMPARE( received.size(), 1 );
+        QVERIFY( received.first() == expected( size ));
+    }
+
+    // Without the primary instance announcing shared payloads the content
+    // is sent inline. A fake primary instance, which holds the election
+    // lock of another application name, leaves the capability out.
+    void notNegotiated()
+    {
+#ifdef Q_OS_LINUX
+        const int size = static_cast<int>( 2 * MemfdPayload::Threshold );
+        const QString applicationName = Testing::applicationName() + QStringLiteral( "-fake" );
+        const QString name = SingleApplicationPrivate::blockServerNameFor( Testing::options(), QStringList(), applicationName, QString(),
+                                                                           SingleApplicationPrivate::getUsername() );
+
+        const int lock = ::open( QFile::encodeName( SingleApplicationPrivate::lockFilePath( name )).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+        QVERIFY( lock != -1 );
+        QCOMPARE( ::flock( lock, LOCK_EX | LOCK_NB ), 0 );
+
+        QLocalServer::removeServer( name );
+        QLocalServer server;
+        QVERIFY( server.listen( name ));
+
+        QProcess instance;
+        instance.setProcessChannelMode( QProcess::ForwardedErrorChannel );
+        instance.start( QStringLiteral( SINGLEAPPLICATION_INSTANCE ), { applicationName, QString::number( static_cast<int>( Testing::options() )),
+                                                                        QStringLiteral( "large" ), QString::number( size ) });
+        QVERIFY( server.waitForNewConnection( 5000 ));
+
+        MessageCoder coder( server.nextPendingConnection() );
+        QList<SingleApplication::Message> received;
+        connect( &coder, &MessageCoder::messageReceived, this, [&coder, &received]( const SingleApplication::Message &message ){
+            received.append( message );
+
+            // Every capability of this build but shared payloads, followed
+            // by the id assigned to the instance
+            QByteArray reply;
+            if( message.type == SingleApplication::MessageType::NewInstance ){
+                coder.negotiate( message.content );
+                reply = MessageCoder::handshake() + QByteArray( sizeof( quint64 ), Qt::Uninitialized );
+                qToBigEndian<quint32>( MessageCoder::handshakeCapabilities( reply ) & ~FrameCodec::SharedPayloads, reply.data() + sizeof( quint32 ));
+                qToBigEndian<quint64>( 1, reply.data() + 2 * sizeof( quint32 ));
+            }
+            coder.sendMessage( SingleApplication::MessageType::Acknowledge, 0, reply );
+        });
+        const bool finished = Testing::finish( instance );
+        ::close( lock );
+        QVERIFY( finished );
+
+        QCOMPARE( received.size(), 2 );
+        QCOMPARE( received.at( 1 ).type, SingleApplication::MessageType::InstanceMessage );
+        QVERIFY( ! ( received.at( 1 ).flags & FrameCodec::SharedPayload ));
+        QVERIFY( received.at( 1 ).content == expected( size ));
+#endif
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestSharedPayloads )
+#include "tst_sharedpayloads.moc"
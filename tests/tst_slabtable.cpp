@@ -0,0 +1,157 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <memory>
+#include <vector>
+
+#include <QtCore/QMap>
+#include <QtTest/QtTest>
+
+#include "slabtable.h"
+
+class TestSlabTable : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void insertFindRemove()
+    {
+        SlabTable<int> table;
+        QVERIFY( table.find( SlabTable<int>::InvalidHandle ) == nullptr );
+
+        const SlabTable<int>::Handle first = table.insert( 1 );
+        const SlabTable<int>::Handle second = table.insert( 2 );
+        QVERIFY( first != SlabTable<int>::InvalidHandle );
+        QVERIFY( first != second );
+        QCOMPARE( table.size(), 2 );
+        QCOMPARE( *table.find( first ), 1 );
+        QCOMPARE( *table.find( second ), 2 );
+
+        QVERIFY( table.remove( first ));
+        QVERIFY( ! table.remove( first ));
+        QVERIFY( table.find( first ) == nullptr );
+        QCOMPARE( *table.find( second ), 2 );
+        QCOMPARE( table.size(), 1 );
+    }
+
+    // A handle of a removed value never finds the value that reused its slot
+    void staleHandle()
+    {
+        SlabTable<int> table;
+        const SlabTable<int>::Handle removed = table.insert( 1 );
+        QVERIFY( table.remove( removed ));
+
+        const SlabTable<int>::Handle reused = table.insert( 2 );
+        QCOMPARE( static_cast<quint32>( reused ), static_cast<quint32>( removed ));
+        QVERIFY( reused != removed );
+        QVERIFY( table.find( removed ) == nullptr );
+        QVERIFY( ! table.remove( removed ));
+        QCOMPARE( *table.find( reused ), 2 );
+    }
+
+    // Removing a value destroys what it owns right away
+    void teardown()
+    {
+        SlabTable<std::shared_ptr<int>> table;
+        std::shared_ptr<int> value = std::make_shared<int>( 1 );
+        const SlabTable<std::shared_ptr<int>>::Handle handle = table.insert( value );
+        QCOMPARE( value.use_count(), 2L );
+
+        QVERIFY( table.remove( handle ));
+        QCOMPARE( value.use_count(), 1L );
+    }
+
+    // Values keep their address while the table grows
+    void stableAddresses()
+    {
+        const int count = 5000;
+        SlabTable<int> table;
+        std::vector<SlabTable<int>::Handle> handles;
+        std::vector<int *> addresses;
+        for( int i = 0; i < count; ++i ){
+            handles.push_back( table.insert( i ));
+            addresses.push_back( table.find( handles.back() ));
+        }
+        QCOMPARE( table.size(), count );
+
+        for( int i = 0; i < count; ++i ){
+            QCOMPARE( table.find( handles[i] ), addresses[i] );
+            QCOMPARE( *addresses[i], i );
+        }
+    }
+
+    void forEach()
+    {
+        SlabTable<int> table;
+        QMap<SlabTable<int>::Handle, int> expected;
+        for( int i = 0; i < 200; ++i )
+            expected.insert( table.insert( i ), i );
+        for( int i = 0; i < 200; i += 3 ){
+            const SlabTable<int>::Handle handle = expected.firstKey();
+            QVERIFY( table.remove( handle ));
+            expected.remove( handle );
+        }
+
+        QMap<SlabTable<int>::Handle, int> visited;
+        table.forEach( [&visited]( SlabTable<int>::Handle handle, int &value ){
+            visited.insert( handle, value );
+        });
+        QCOMPARE( visited, expected );
+    }
+
+    void lookup_data()
+    {
+        QTest::addColumn<bool>( "slab" );
+
+        QTest::newRow( "QMap" ) << false;
+        QTest::newRow( "SlabTable" ) << true;
+    }
+
+    // Cost of finding the connection of an event among 5000 connections
+    void lookup()
+    {
+        QFETCH( bool, slab );
+        const int count = 5000;
+
+        SlabTable<int> table;
+        std::vector<SlabTable<int>::Handle> handles;
+        QMap<quintptr, int> map;
+        std::vector<quintptr> keys;
+        for( int i = 0; i < count; ++i ){
+            handles.push_back( table.insert( i ));
+            // Spread like the addresses of sockets
+            keys.push_back( quintptr( i ) * 4096 + 0x10000 );
+            map.insert( keys.back(), i );
+        }
+
+        qint64 sum = 0;
+        QBENCHMARK {
+            for( int i = 0; i < count; ++i )
+                sum += slab ? *table.find( handles[i] ) : map.find( keys[i] ).value();
+        }
+        QVERIFY( sum > 0 );
+    }
+};
+
+QTEST_GUILESS_MAIN( TestSlabTable )
+#include "tst_slabtable.moc"
@@ -0,0 +1,117 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QProcess>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+namespace {
+    QStringList phaseNames( const QList<SingleApplication::StartupPhase> &phases )
+    {
+        QStringList names;
+        for( const SingleApplication::StartupPhase &phase : phases )
+            names.append( phase.name );
+        return names;
+    }
+}
+
+class TestStartupTimings : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // The primary instance recorded its phases in the order they ran
+    void primaryPhases()
+    {
+        const QList<SingleApplication::StartupPhase> phases = Testing::application()->startupTimings();
+        QCOMPARE( phaseNames( phases ), ( QStringList{ QStringLiteral( "getUsername" ), QStringLiteral( "genBlockServerName" ),
+                                                       QStringLiteral( "acquirePrimaryLock" ), QStringLiteral( "startPrimary" ) }));
+
+        qint64 end = 0;
+        for( const SingleApplication::StartupPhase &phase : phases ){
+            QVERIFY( phase.start >= end );
+            QVERIFY( phase.duration >= 0 );
+            end = phase.start + phase.duration;
+        }
+    }
+
+    // A secondary instance writes its phases as a Chrome trace to the file
+    // named by SINGLEAPPLICATION_TRACE
+    void trace()
+    {
+        QTemporaryDir directory;
+        QVERIFY( directory.isValid() );
+        QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+        environment.insert( QStringLiteral( "SINGLEAPPLICATION_TRACE" ), directory.filePath( QStringLiteral( "trace-%p.json" )));
+
+        QProcess instance;
+        instance.setProcessEnvironment( environment );
+        Testing::startInstance( instance, { QStringLiteral( "send" ), QStringLiteral( "0" ) });
+        QVERIFY( instance.waitForStarted() );
+        const qint64 pid = instance.processId();
+        QVERIFY( Testing::finish( instance ));
+
+        QFile file( directory.filePath( QStringLiteral( "trace-%1.json" ).arg( pid )));
+        QVERIFY( file.open( QIODevice::ReadOnly ));
+        QJsonParseError error;
+        const QJsonDocument document = QJsonDocument::fromJson( file.readAll(), &error );
+        QCOMPARE( error.error, QJsonParseError::NoError );
+        QVERIFY( document.isObject() );
+        const QJsonArray events = document.object().value( QStringLiteral( "traceEvents" )).toArray();
+        QVERIFY( ! events.isEmpty() );
+
+        // Metadata naming the process first, then a complete event per phase
+        const QJsonObject process = events.first().toObject();
+        QCOMPARE( process.value( QStringLiteral( "ph" )).toString(), QStringLiteral( "M" ));
+        QCOMPARE( process.value( QStringLiteral( "name" )).toString(), QStringLiteral( "process_name" ));
+        QCOMPARE( process.value( QStringLiteral( "pid" )).toDouble(), static_cast<double>( pid ));
+        QVERIFY( process.value( QStringLiteral( "args" )).toObject().value( QStringLiteral( "name" )).toString().endsWith( QStringLiteral( "(secondary)" )));
+
+        QStringList names;
+        double end = 0;
+        for( int i = 1; i < events.size(); ++i ){
+            const QJsonObject event = events.at( i ).toObject();
+            QCOMPARE( event.value( QStringLiteral( "ph" )).toString(), QStringLiteral( "X" ));
+            QCOMPARE( event.value( QStringLiteral( "pid" )).toDouble(), static_cast<double>( pid ));
+            QVERIFY( event.value( QStringLiteral( "ts" )).isDouble() );
+            QVERIFY( event.value( QStringLiteral( "dur" )).toDouble() >= 0 );
+            // Microseconds since the epoch, so traces of several processes
+            // line up, the start rounded down to a whole microsecond
+            QVERIFY( event.value( QStringLiteral( "ts" )).toDouble() >= end - 1 );
+            end = event.value( QStringLiteral( "ts" )).toDouble() + event.value( QStringLiteral( "dur" )).toDouble();
+            names.append( event.value( QStringLiteral( "name" )).toString() );
+        }
+        QCOMPARE( names, ( QStringList{ QStringLiteral( "getUsername" ), QStringLiteral( "genBlockServerName" ), QStringLiteral( "acquirePrimaryLock" ),
+                                        QStringLiteral( "connectToPrimary" ), QStringLiteral( "notifySecondaryStart" ) }));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestStartupTimings )
+#include "tst_startuptimings.moc"
@@ -0,0 +1,89 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QPointer>
+#include <QtCore/QProcess>
+#include <QtCore/QTimer>
+#include <QtTest/QtTest>
+
+#include "singleapplication_p.h"
+#include "testing.h"
+
+class TestStreams : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // A stream many times larger than the buffer of the primary instance
+    // arrives intact through a slow reader, which holds the sender back
+    void slowReader()
+    {
+        const int size = static_cast<int>( 16 * SingleApplicationPrivate::StreamBufferSize );
+
+        QPointer<QIODevice> stream;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedStream, this,
+            [&stream]( quint64, QIODevice *device ){ stream = device; });
+
+        QByteArray received;
+        qint64 maxBuffered = 0;
+        QTimer reader;
+        connect( &reader, &QTimer::timeout, this, [&](){
+            if( ! stream )
+                return;
+            maxBuffered = qMax( maxBuffered, stream->bytesAvailable() );
+            received += stream->read( 64 * 1024 );
+        });
+        reader.start( 2 );
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "stream" ), QString::number( size ) });
+        QTRY_COMPARE_WITH_TIMEOUT( received.size(), size, 30000 );
+        QVERIFY( Testing::finish( instance ));
+        disconnect( connection );
+
+        for( int i = 0; i < size; ++i )
+            QCOMPARE( received.at( i ), static_cast<char>( i % 251 ));
+
+        // Read to the end, the device deletes itself
+        QTRY_VERIFY( stream.isNull() );
+
+        // Decoding pauses once the buffer is full, at most a quantum late
+        qInfo( "At most %lld bytes buffered", maxBuffered );
+        QVERIFY( maxBuffered <= SingleApplicationPrivate::StreamBufferSize + MessageCoder::DecodeQuantum + SingleApplicationPrivate::StreamChunkSize );
+    }
+
+    // Without a receiver the stream is dropped instead of pausing the
+    // connection, so the sender finishes
+    void noReceiver()
+    {
+        const int size = static_cast<int>( 4 * SingleApplicationPrivate::StreamBufferSize );
+
+        QTest::ignoreMessage( QtWarningMsg, "SingleApplication: Discarding a stream, nothing is connected to receivedStream()" );
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "stream" ), QString::number( size ) });
+        QVERIFY( Testing::finish( instance ));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestStreams )
+#include "tst_streams.moc"
@@ -0,0 +1,151 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>
+#include <vector>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+class TestTopics : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void routing_data()
+    {
+        QTest::addColumn<int>( "size" );
+        QTest::addColumn<int>( "count" );
+
+        QTest::newRow( "small" ) << 16 << 100;
+        // Below the bytes a slow subscriber may be left to read
+        QTest::newRow( "512 KiB" ) << 512 * 1024 << 6;
+    }
+
+    // Publications of a secondary instance reach the subscribers, the
+    // primary instance included, in order and only on their topic
+    void routing()
+    {
+        QFETCH( int, size );
+        QFETCH( int, count );
+
+        QList<QByteArray> received;
+        int other = 0;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedTopicMessage, this,
+            [&]( const QString &topic, const QByteArray &message ){
+                if( topic == QLatin1String( "news" ))
+                    received.append( message.trimmed() );
+                else
+                    ++other;
+            });
+        QVERIFY( Testing::application()->subscribe( QStringLiteral( "news" )));
+
+        QProcess subscriber;
+        Testing::startInstance( subscriber, { QStringLiteral( "subscribe" ), QStringLiteral( "news" ), QString::number( count ) });
+        QCOMPARE( Testing::readLine( subscriber ), QByteArray( "ready" ));
+
+        QProcess unrelated;
+        Testing::startInstance( unrelated, { QStringLiteral( "publish" ), QStringLiteral( "other" ), QStringLiteral( "10" ) });
+        QVERIFY( Testing::finish( unrelated ));
+        QProcess publisher;
+        Testing::startInstance( publisher, { QStringLiteral( "publish" ), QStringLiteral( "news" ), QString::number( count ), QString::number( size ) });
+        QVERIFY( Testing::finish( publisher ));
+        QVERIFY( Testing::finish( subscriber ));
+
+        QTRY_COMPARE( received.size(), count );
+        for( int i = 0; i < count; ++i )
+            QCOMPARE( received.at( i ), QByteArray::number( i ));
+        QCOMPARE( other, 0 );
+
+        QVERIFY( Testing::application()->unsubscribe( QStringLiteral( "news" )));
+        disconnect( connection );
+    }
+
+    // The primary instance encodes its publications once for every subscriber
+    void primaryPublish()
+    {
+        const int count = 50;
+
+        int received = 0;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedTopicMessage, this,
+            [&received](){ ++received; });
+        QVERIFY( Testing::application()->subscribe( QStringLiteral( "news" )));
+
+        QProcess first;
+        Testing::startInstance( first, { QStringLiteral( "subscribe" ), QStringLiteral( "news" ), QString::number( count ) });
+        QProcess second;
+        Testing::startInstance( second, { QStringLiteral( "subscribe" ), QStringLiteral( "news" ), QString::number( count ) });
+        QCOMPARE( Testing::readLine( first ), QByteArray( "ready" ));
+        QCOMPARE( Testing::readLine( second ), QByteArray( "ready" ));
+
+        for( int i = 0; i < count; ++i )
+            QVERIFY( Testing::application()->publish( QStringLiteral( "news" ), QByteArray::number( i )));
+        QCOMPARE( received, count );
+        QVERIFY( Testing::finish( first ));
+        QVERIFY( Testing::finish( second ));
+
+        QVERIFY( Testing::application()->unsubscribe( QStringLiteral( "news" )));
+        disconnect( connection );
+    }
+
+    // Round trips through a secondary instance that publishes every message
+    // again, each crossing the router of the primary instance twice
+    void hopLatency()
+    {
+        const int count = 200;
+
+        int replies = 0;
+        QMetaObject::Connection connection = connect( Testing::application(), &SingleApplication::receivedTopicMessage, this,
+            [&replies](){ ++replies; });
+        QVERIFY( Testing::application()->subscribe( QStringLiteral( "pong" )));
+
+        QProcess relay;
+        Testing::startInstance( relay, { QStringLiteral( "relay" ), QStringLiteral( "ping" ), QStringLiteral( "pong" ), QString::number( count ) });
+        QCOMPARE( Testing::readLine( relay ), QByteArray( "ready" ));
+
+        std::vector<double> roundTrips;
+        for( int i = 0; i < count; ++i ){
+            QElapsedTimer timer;
+            timer.start();
+            QVERIFY( Testing::application()->publish( QStringLiteral( "ping" ), QByteArray::number( i )));
+            while( replies <= i && timer.elapsed() < 5000 )
+                QCoreApplication::processEvents();
+            QCOMPARE( replies, i + 1 );
+            roundTrips.push_back( timer.nsecsElapsed() / 1e6 );
+        }
+        QVERIFY( Testing::finish( relay ));
+
+        std::sort( roundTrips.begin(), roundTrips.end() );
+        qInfo( "Round trip p50 %.3f ms, p99 %.3f ms", roundTrips[count / 2], roundTrips[( count - 1 ) * 99 / 100] );
+
+        QVERIFY( Testing::application()->unsubscribe( QStringLiteral( "pong" )));
+        disconnect( connection );
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestTopics )
+#include "tst_topics.moc"
@@ -0,0 +1,94 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <QtCore/QProcess>
+#include <QtTest/QtTest>
+
+#include "testing.h"
+
+class TestTypedMessages : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // Handlers capture the locals of a test, so none outlives it
+    void cleanup()
+    {
+        Testing::application()->onMessage<Testing::Point>( []( quint64, const Testing::Point & ){} );
+    }
+
+    // Values reach the handler of their type in order, values of a type
+    // without a handler are dropped and neither reaches receivedMessage()
+    void dispatch()
+    {
+        SingleApplication *app = Testing::application();
+        const int count = 10;
+
+        QList<QPair<qint32, qint32>> points;
+        app->onMessage<Testing::Point>( [&points]( quint64, const Testing::Point &point ){
+            points.append( qMakePair( point.x, point.y ));
+        });
+        int untyped = 0;
+        QMetaObject::Connection connection = connect( app, &SingleApplication::receivedMessage, this,
+            [&untyped](){ ++untyped; });
+
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "typed" ), QString::number( count ) });
+        QVERIFY( Testing::finish( instance ));
+        disconnect( connection );
+
+        QCOMPARE( points.size(), count );
+        for( int i = 0; i < count; ++i )
+            QCOMPARE( points.at( i ), qMakePair( i, -i ));
+        QCOMPARE( untyped, 0 );
+    }
+
+    // Setting a handler replaces the previous one of the same type
+    void replaced()
+    {
+        SingleApplication *app = Testing::application();
+
+        int first = 0;
+        app->onMessage<Testing::Point>( [&first]( quint64, const Testing::Point & ){ ++first; });
+        QProcess instance;
+        Testing::startInstance( instance, { QStringLiteral( "typed" ), QStringLiteral( "1" ) });
+        QVERIFY( Testing::finish( instance ));
+        QCOMPARE( first, 1 );
+
+        int second = 0;
+        app->onMessage<Testing::Point>( [&second]( quint64, const Testing::Point & ){ ++second; });
+        Testing::startInstance( instance, { QStringLiteral( "typed" ), QStringLiteral( "1" ) });
+        QVERIFY( Testing::finish( instance ));
+        QCOMPARE( first, 1 );
+        QCOMPARE( second, 1 );
+    }
+
+    // Typed messages can only be sent to the primary instance
+    void fromPrimary()
+    {
+        QVERIFY( ! Testing::application()->sendTyped( Testing::Point{ 1, 2 } ));
+    }
+};
+
+SINGLEAPPLICATION_TEST_MAIN( TestTypedMessages )
+#include "tst_typedmessages.moc"
@@ -0,0 +1,156 @@
+// Copyright (c) Itay Grudev 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the SingleApplication API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <utility>
+#include <vector>
+
+#include <QtCore/QtGlobal>
+
+/**
+ * @brief Hierarchical timer wheel scheduling values a number of ticks ahead
+ *
+ * Each level is a ring of 64 slots, a slot of the first level spans one tick
+ * and a slot of each further level spans a whole revolution of the level
+ * below. A value is filed into the level its delay fits in and moves down
+ * as its tick approaches, so scheduling and each tick take constant time
+ * regardless of how many values are waiting.
+ *
+ * Values can't be cancelled, the owner is expected to check whether an
+ * expired value is still relevant.
+ */
+template<typename T>
+class TimerWheel {
+public:
+    TimerWheel() : now( 0 ) {}
+
+    /**
+     * @brief Returns the number of ticks since the wheel was created
+     */
+    quint64 currentTick() const
+    {
+        return now;
+    }
+
+    /**
+     * @brief Schedules a value to expire after the given number of ticks
+     *
+     * A delay of 0 expires with the next tick, delays beyond the range of
+     * the wheel are shortened to the longest one it supports.
+     */
+    void schedule( quint64 delay, T value )
+    {
+        place( now + qBound<quint64>( 1, delay, MaxDelay ), std::move( value ));
+    }
+
+    /**
+     * @brief Advances the wheel by a tick and passes every value that
+     * expired to a function, which may schedule values again
+     */
+    template<typename Function>
+    void tick( Function expired )
+    {
+        ++now;
+
+        // Values of a higher level slot come due within the next revolution
+        // of the level below once the lower levels wrapped around
+        for( int level = 1; level < Levels; ++level ){
+            if(( now & (( quint64( 1 ) << ( level * Bits )) - 1 )) != 0 )
+                break;
+
+            std::vector<Entry> entries;
+            entries.swap( slots[level][( now >> ( level * Bits )) & Mask] );
+            for( Entry &entry : entries )
+                place( entry.due, std::move( entry.value ));
+        }
+
+        std::vector<Entry> entries;
+        entries.swap( slots[0][now & Mask] );
+        for( Entry &entry : entries )
+            expired( std::move( entry.value ));
+    }
+
+    /**
+     * @brief Drops every scheduled value
+     */
+    void clear()
+    {
+        for( int level = 0; level < Levels; ++level )
+            for( int slot = 0; slot < Slots; ++slot )
+                slots[level][slot].clear();
+    }
+
+private:
+    static constexpr int Bits = 6;
+    static constexpr int Slots = 1 << Bits;
+    static constexpr quint64 Mask = Slots - 1;
+    static constexpr int Levels = 4;
+    static constexpr quint64 MaxDelay = ( quint64( 1 ) << ( Levels * Bits )) - 1;
+
+    struct Entry {
+        quint64 due;
+        T value;
+    };
+
+    void place( quint64 due, T value )
+    {
+        const quint64 delay = due - now;
+        int level = 0;
+        while( level + 1 < Levels && delay >= ( quint64( 1 ) << (( level + 1 ) * Bits )))
+            ++level;
+
+        slots[level][( due >> ( level * Bits )) & Mask].push_back( Entry{ due, std::move( value ) } );
+    }
+
+    quint64 now;
+    std::vector<Entry> slots[Levels][Slots];
+};
+
+template<typename T>
+constexpr int TimerWheel<T>::Bits;
+
+template<typename T>
+constexpr int TimerWheel<T>::Slots;
+
+template<typename T>
+constexpr quint64 TimerWheel<T>::Mask;
+
+template<typename T>
+constexpr int TimerWheel<T>::Levels;
+
+template<typename T>
+constexpr quint64 TimerWheel<T>::MaxDelay;
+
+#endif // TIMERWHEEL_H